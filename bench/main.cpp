@@ -0,0 +1,501 @@
+// microbenchmarks of the kernels on deterministic synthetic volumes. Volume
+// benchmarks take {edge, threads} or {edge, threads, isa}, where edge is the
+// side of a cubic volume, threads the OpenMP thread count and isa the
+// instruction set level (0 scalar, 1 avx2, 2 avx512, -1 the active one);
+// single threaded stage benchmarks leave out threads. items/s counts voxels,
+// bytes/s the input bytes read.
+#include "Info/ForceDirected.hpp"
+#include "Info/HierarchicalCluster.hpp"
+#include "Info/MutualInformation.hpp"
+#include "Info/MutualInformationMatrix.hpp"
+#include "VolCorrelation/CpuDispatch.hpp"
+#include "VolCorrelation/GradientSimilarityMeasure.hpp"
+#include "VolCorrelation/LocalCorrelationCoefficient.hpp"
+#include "VolCorrelation/ResultCache.hpp"
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+using Field = std::vector<uint8_t>;
+
+// uniform in [0, 1), a pure function of seed and index so that every run and
+// every thread count sees the same volume
+auto random(uint64_t seed, uint64_t index) -> double {
+  using VolCorrelation::mixHash;
+  const auto bits = mixHash(seed ^ mixHash(index));
+  return static_cast<double>(bits >> 11) * 0x1.0p-53;
+}
+
+// value noise: random values on a lattice every scale voxels, trilinearly
+// interpolated, so neighboring voxels are correlated like simulation output
+auto smoothNoise(uint32_t edge, uint32_t scale, uint64_t seed) -> Field {
+  const auto lattice = edge / scale + 2;
+  auto at = [&](uint32_t x, uint32_t y, uint32_t z) {
+    return random(seed, (static_cast<uint64_t>(z) * lattice + y) * lattice + x);
+  };
+  Field field(static_cast<size_t>(edge) * edge * edge);
+  size_t index = 0;
+  for (uint32_t z = 0; z < edge; z++) {
+    for (uint32_t y = 0; y < edge; y++) {
+      for (uint32_t x = 0; x < edge; x++) {
+        const auto lx = x / scale, ly = y / scale, lz = z / scale;
+        const auto fx = static_cast<double>(x % scale) / scale;
+        const auto fy = static_cast<double>(y % scale) / scale;
+        const auto fz = static_cast<double>(z % scale) / scale;
+        auto value = 0.0;
+        for (uint32_t corner = 0; corner < 8; corner++) {
+          const auto cx = corner & 1, cy = (corner >> 1) & 1, cz = corner >> 2;
+          value += at(lx + cx, ly + cy, lz + cz) * (cx ? fx : 1 - fx) *
+                   (cy ? fy : 1 - fy) * (cz ? fz : 1 - fz);
+        }
+        field[index++] = static_cast<uint8_t>(value * 255);
+      }
+    }
+  }
+  return field;
+}
+
+// mostly zero with a fraction density of random nonzero voxels, like particle
+// or sparse feature volumes
+auto sparseCloud(uint32_t edge, double density, uint64_t seed) -> Field {
+  Field field(static_cast<size_t>(edge) * edge * edge, 0);
+  for (size_t idx = 0; idx < field.size(); idx++) {
+    if (random(seed, idx) < density) {
+      field[idx] = static_cast<uint8_t>(1 + random(seed + 1, idx) * 254);
+    }
+  }
+  return field;
+}
+
+// two smooth fields sharing a fraction correlation of their signal
+auto correlatedPair(uint32_t edge, double correlation, uint64_t seed)
+    -> std::vector<Field> {
+  auto a = smoothNoise(edge, 8, seed);
+  const auto noise = smoothNoise(edge, 4, seed + 1);
+  Field b(a.size());
+  for (size_t idx = 0; idx < a.size(); idx++) {
+    b[idx] = static_cast<uint8_t>(correlation * a[idx] +
+                                  (1 - correlation) * noise[idx]);
+  }
+  return {std::move(a), std::move(b)};
+}
+
+auto pointers(const std::vector<Field> &fields)
+    -> std::vector<const uint8_t *> {
+  std::vector<const uint8_t *> result;
+  for (auto &field : fields) {
+    result.push_back(field.data());
+  }
+  return result;
+}
+
+// applies the threads argument and reports it
+void setThreads(benchmark::State &state, int64_t threads) {
+#ifdef _OPENMP
+  omp_set_num_threads(static_cast<int>(threads));
+#endif
+  state.counters["threads"] = static_cast<double>(threads);
+}
+
+// applies the isa argument, -1 keeping the active level, and skips levels
+// the cpu does not support; the previous level is restored on destruction,
+// also after a skip, so no cap leaks into later benchmarks
+class IsaArgument {
+public:
+  IsaArgument(benchmark::State &state, int64_t isa)
+      : previous(VolCorrelation::activeIsa()) {
+    if (isa < 0) {
+      return;
+    }
+    const auto requested = static_cast<VolCorrelation::Isa>(isa);
+    const auto active = VolCorrelation::setActiveIsa(requested);
+    if (active != requested) {
+      state.SkipWithError("instruction set not supported");
+      supported = false;
+      return;
+    }
+    state.SetLabel(VolCorrelation::isaName(active));
+  }
+  ~IsaArgument() { VolCorrelation::setActiveIsa(previous); }
+  IsaArgument(const IsaArgument &) = delete;
+  IsaArgument &operator=(const IsaArgument &) = delete;
+
+  explicit operator bool() const { return supported; }
+
+private:
+  VolCorrelation::Isa previous;
+  bool supported = true;
+};
+
+void setVoxels(benchmark::State &state, size_t voxels, size_t bytes) {
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * voxels));
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+}
+
+auto maxThreads() -> int64_t {
+#ifdef _OPENMP
+  return omp_get_num_procs();
+#else
+  return 1;
+#endif
+}
+
+// edges x powers of two threads up to the core count
+void volumeArgs(benchmark::internal::Benchmark *b,
+                std::vector<int64_t> edges) {
+  for (auto edge : edges) {
+    for (int64_t threads = 1; threads < maxThreads() * 2; threads *= 2) {
+      b->Args({edge, std::min(threads, maxThreads())});
+    }
+  }
+}
+
+void isaArgs(benchmark::internal::Benchmark *b, int64_t edge) {
+  for (int64_t isa = 0; isa <= 2; isa++) {
+    b->Args({edge, maxThreads(), isa});
+  }
+}
+
+void BM_GradientSimilarity(benchmark::State &state) {
+  const auto edge = static_cast<uint32_t>(state.range(0));
+  setThreads(state, state.range(1));
+  const auto fields = correlatedPair(edge, 0.8, 1);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(VolCorrelation::calculateGradientSimilarity(
+        pointers(fields), edge, edge, edge));
+  }
+  setVoxels(state, fields[0].size(), 2 * fields[0].size());
+}
+BENCHMARK(BM_GradientSimilarity)
+    ->Apply([](auto b) { volumeArgs(b, {32, 64, 128}); })
+    ->Unit(benchmark::kMillisecond);
+
+void BM_GradientSimilarityVoxelOuter(benchmark::State &state) {
+  const auto edge = static_cast<uint32_t>(state.range(0));
+  setThreads(state, state.range(1));
+  const IsaArgument isa(state, state.range(2));
+  if (!isa) {
+    return;
+  }
+  const std::vector<Field> fields{smoothNoise(edge, 8, 1),
+                                  smoothNoise(edge, 4, 2),
+                                  sparseCloud(edge, 0.05, 3)};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        VolCorrelation::calculateGradientSimilarityVoxelOuter(
+            pointers(fields), edge, edge, edge));
+  }
+  setVoxels(state, fields[0].size(), fields.size() * fields[0].size());
+}
+BENCHMARK(BM_GradientSimilarityVoxelOuter)
+    ->Apply([](auto b) {
+      for (auto edge : {32, 64, 128}) {
+        for (int64_t threads = 1; threads < maxThreads() * 2; threads *= 2) {
+          b->Args({edge, std::min(threads, maxThreads()), -1});
+        }
+      }
+      isaArgs(b, 64);
+    })
+    ->Unit(benchmark::kMillisecond);
+
+// the gradient stage alone: the Sobel row stencils of every row of one
+// normalized field into row buffers that stay in cache, single threaded
+void BM_SobelGradientRows(benchmark::State &state) {
+  const auto edge = static_cast<uint32_t>(state.range(0));
+  const IsaArgument isa(state, state.range(1));
+  if (!isa) {
+    return;
+  }
+  const auto source = smoothNoise(edge, 8, 1);
+  const auto field = VolCorrelation::normalizeField<uint8_t, double>(
+      source.data(), source.size());
+  const VolCorrelation::Vec3<uint32_t> dimensions(edge, edge, edge);
+  std::vector<double> gx(edge), gy(edge), gz(edge);
+  for (auto _ : state) {
+    for (uint32_t z = 0; z < edge; z++) {
+      for (uint32_t y = 0; y < edge; y++) {
+        VolCorrelation::sobelGradientRow(field.data(), dimensions, y, z,
+                                         gx.data(), gy.data(), gz.data());
+        benchmark::DoNotOptimize(gx.data());
+        benchmark::DoNotOptimize(gy.data());
+        benchmark::DoNotOptimize(gz.data());
+      }
+    }
+  }
+  setVoxels(state, field.size(), field.size() * sizeof(double));
+}
+BENCHMARK(BM_SobelGradientRows)
+    ->ArgsProduct({{64, 128}, {0, 1, 2}})
+    ->Unit(benchmark::kMillisecond);
+
+// the gradient stage with its output: a GradientVolume of one normalized
+// field, 3 doubles written per voxel
+void BM_GradientVolume(benchmark::State &state) {
+  const auto edge = static_cast<uint32_t>(state.range(0));
+  setThreads(state, state.range(1));
+  const IsaArgument isa(state, state.range(2));
+  if (!isa) {
+    return;
+  }
+  const auto source = smoothNoise(edge, 8, 1);
+  const auto field = VolCorrelation::normalizeField<uint8_t, double>(
+      source.data(), source.size());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        VolCorrelation::calculateGradientVolume(field.data(), edge, edge,
+                                                edge));
+  }
+  setVoxels(state, field.size(), field.size() * sizeof(double));
+}
+BENCHMARK(BM_GradientVolume)
+    ->Apply([](auto b) {
+      for (auto edge : {64, 128}) {
+        for (int64_t threads = 1; threads < maxThreads() * 2; threads *= 2) {
+          b->Args({edge, std::min(threads, maxThreads()), -1});
+        }
+      }
+      isaArgs(b, 128);
+    })
+    ->Unit(benchmark::kMillisecond);
+
+void BM_LocalCorrelation(benchmark::State &state) {
+  const auto edge = static_cast<uint32_t>(state.range(0));
+  setThreads(state, state.range(1));
+  const auto backend = static_cast<VolCorrelation::LCCBackend>(state.range(2));
+  const auto fields = correlatedPair(edge, 0.8, 1);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(VolCorrelation::calcLocalCorrelationCoefficient(
+        pointers(fields), edge, edge, edge, 3, backend));
+  }
+  state.SetLabel(backend == VolCorrelation::LCCBackend::Direct ? "direct"
+                                                              : "summed area");
+  setVoxels(state, fields[0].size(), 2 * fields[0].size());
+}
+BENCHMARK(BM_LocalCorrelation)
+    ->Apply([](auto b) {
+      for (auto edge : {32, 64}) {
+        for (int64_t threads = 1; threads < maxThreads() * 2; threads *= 2) {
+          for (int64_t backend = 0; backend <= 1; backend++) {
+            b->Args({edge, std::min(threads, maxThreads()), backend});
+          }
+        }
+      }
+    })
+    ->Unit(benchmark::kMillisecond);
+
+void BM_LocalCorrelationVoxelOuter(benchmark::State &state) {
+  const auto edge = static_cast<uint32_t>(state.range(0));
+  setThreads(state, state.range(1));
+  const IsaArgument isa(state, state.range(2));
+  if (!isa) {
+    return;
+  }
+  const std::vector<Field> fields{smoothNoise(edge, 8, 1),
+                                  smoothNoise(edge, 4, 2),
+                                  sparseCloud(edge, 0.05, 3)};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        VolCorrelation::calcLocalCorrelationCoefficientVoxelOuter(
+            pointers(fields), edge, edge, edge));
+  }
+  setVoxels(state, fields[0].size(), fields.size() * fields[0].size());
+}
+BENCHMARK(BM_LocalCorrelationVoxelOuter)
+    ->Apply([](auto b) {
+      for (auto edge : {32, 64}) {
+        for (int64_t threads = 1; threads < maxThreads() * 2; threads *= 2) {
+          b->Args({edge, std::min(threads, maxThreads()), -1});
+        }
+      }
+      isaArgs(b, 32);
+    })
+    ->Unit(benchmark::kMillisecond);
+
+// the window statistics alone: getLLC of one pair at every voxel, single
+// threaded; takes {edge, windowSize, isa}
+void BM_WindowStatistics(benchmark::State &state) {
+  const auto edge = static_cast<uint32_t>(state.range(0));
+  const auto windowSize = static_cast<int>(state.range(1));
+  const IsaArgument isa(state, state.range(2));
+  if (!isa) {
+    return;
+  }
+  const auto fields = correlatedPair(edge, 0.8, 1);
+  const auto size = fields[0].size();
+  const auto a = VolCorrelation::normalizeField<uint8_t, double>(
+      fields[0].data(), size);
+  const auto b = VolCorrelation::normalizeField<uint8_t, double>(
+      fields[1].data(), size);
+  const VolCorrelation::Vec3<uint32_t> dimensions(edge, edge, edge);
+  const auto offsetXY = static_cast<int>(edge * edge);
+  for (auto _ : state) {
+    auto sum = 0.0;
+    for (uint32_t z = 0; z < edge; z++) {
+      for (uint32_t y = 0; y < edge; y++) {
+        for (uint32_t x = 0; x < edge; x++) {
+          sum += VolCorrelation::getLLC(
+              a, b, VolCorrelation::Vec3<uint32_t>(x, y, z), dimensions,
+              offsetXY, windowSize);
+        }
+      }
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  setVoxels(state, size, 2 * size * sizeof(double));
+}
+BENCHMARK(BM_WindowStatistics)
+    ->ArgsProduct({{32, 64}, {1, 3}, {0, 1, 2}})
+    ->Unit(benchmark::kMillisecond);
+
+void BM_MutualInformation(benchmark::State &state) {
+  const auto edge = static_cast<uint32_t>(state.range(0));
+  setThreads(state, state.range(1));
+  const IsaArgument isa(state, state.range(2));
+  if (!isa) {
+    return;
+  }
+  const auto fields = correlatedPair(edge, 0.8, 1);
+  const auto size = fields[0].size();
+  const auto a = Info::CountValue(fields[0].data(), size);
+  const auto b = Info::CountValue(fields[1].data(), size);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Info::CalculateMutationInformation(
+        fields[0].data(), fields[1].data(), a, b, size));
+  }
+  setVoxels(state, size, 2 * size);
+}
+BENCHMARK(BM_MutualInformation)
+    ->Apply([](auto b) {
+      for (auto edge : {64, 128, 256}) {
+        for (int64_t threads = 1; threads < maxThreads() * 2; threads *= 2) {
+          b->Args({edge, std::min(threads, maxThreads()), -1});
+        }
+      }
+      isaArgs(b, 128);
+    })
+    ->Unit(benchmark::kMillisecond);
+
+// all pairs of 8 fields in one pass; items/s counts voxels of one field
+void BM_MutualInformationMatrix(benchmark::State &state) {
+  const auto edge = static_cast<uint32_t>(state.range(0));
+  setThreads(state, state.range(1));
+  std::vector<Field> fields;
+  for (uint64_t i = 0; i < 8; i++) {
+    fields.push_back(i % 2 == 0 ? smoothNoise(edge, 4 + 4 * (i % 3), i)
+                                : sparseCloud(edge, 0.1, i));
+  }
+  const auto size = fields[0].size();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        Info::CalculateMutualInformationMatrix(pointers(fields), size));
+  }
+  setVoxels(state, size, fields.size() * size);
+}
+BENCHMARK(BM_MutualInformationMatrix)
+    ->Apply([](auto b) { volumeArgs(b, {64, 128}); })
+    ->Unit(benchmark::kMillisecond);
+
+// all pairs of many fields, where the joint tables outgrow the cache and the
+// pairs are counted in tiles; items/s counts voxels of all pairs
+void BM_MutualInformationMatrixFields(benchmark::State &state) {
+  const auto edge = static_cast<uint32_t>(state.range(0));
+  const auto fieldNum = static_cast<uint64_t>(state.range(1));
+  setThreads(state, maxThreads());
+  std::vector<Field> fields;
+  for (uint64_t i = 0; i < fieldNum; i++) {
+    fields.push_back(smoothNoise(edge, 4 + 4 * (i % 3), i));
+  }
+  const auto size = fields[0].size();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        Info::CalculateMutualInformationMatrix(pointers(fields), size));
+  }
+  setVoxels(state, size * fieldNum * (fieldNum - 1) / 2,
+            fields.size() * size);
+}
+BENCHMARK(BM_MutualInformationMatrixFields)
+    ->ArgsProduct({{128, 256}, {8, 16, 32}})
+    ->Unit(benchmark::kMillisecond);
+
+void BM_CountValue(benchmark::State &state) {
+  const auto edge = static_cast<uint32_t>(state.range(0));
+  setThreads(state, state.range(1));
+  const auto field = smoothNoise(edge, 8, 1);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Info::CountValue(field.data(), field.size()));
+  }
+  setVoxels(state, field.size(), field.size());
+}
+BENCHMARK(BM_CountValue)
+    ->Apply([](auto b) { volumeArgs(b, {128, 256}); })
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_ConvertData(benchmark::State &state) {
+  const auto edge = static_cast<uint32_t>(state.range(0));
+  setThreads(state, state.range(1));
+  const auto source = smoothNoise(edge, 8, 1);
+  const std::vector<float> field(source.begin(), source.end());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Info::ConvertData(field.data(), field.size()));
+  }
+  setVoxels(state, field.size(), field.size() * sizeof(float));
+}
+BENCHMARK(BM_ConvertData)
+    ->Apply([](auto b) { volumeArgs(b, {128, 256}); })
+    ->Unit(benchmark::kMicrosecond);
+
+// distances of n points on a random plane, so clusters are well formed
+auto planeDistances(size_t n) -> std::vector<std::vector<double>> {
+  std::vector<std::vector<double>> distances(n, std::vector<double>(n, 0.0));
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = i + 1; j < n; j++) {
+      const auto dx = random(1, i) - random(1, j);
+      const auto dy = random(2, i) - random(2, j);
+      distances[i][j] = distances[j][i] = 100 * std::sqrt(dx * dx + dy * dy);
+    }
+  }
+  return distances;
+}
+
+// items/s counts fields
+void BM_HierarchicalCluster(benchmark::State &state) {
+  const auto n = static_cast<size_t>(state.range(0));
+  const auto distances = planeDistances(n);
+  for (auto _ : state) {
+    Info::HierarchicalCluster cluster;
+    cluster.process(distances, n / 4);
+    benchmark::DoNotOptimize(cluster);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * n));
+}
+BENCHMARK(BM_HierarchicalCluster)
+    ->RangeMultiplier(4)
+    ->Range(16, 1024)
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_ForceDirected(benchmark::State &state) {
+  const auto n = static_cast<size_t>(state.range(0));
+  const auto distances = planeDistances(n);
+  // a fixed step budget, random distances need not converge to epsilon
+  Info::ForceDirectedOptions options;
+  options.maxIterations = 100 * n;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        Info::CalculateForceDirected(distances, 400, 600, options));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * n));
+}
+BENCHMARK(BM_ForceDirected)
+    ->RangeMultiplier(2)
+    ->Range(8, 128)
+    ->Unit(benchmark::kMillisecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
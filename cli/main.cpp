@@ -0,0 +1,446 @@
+// headless batch driver: computes GSM, LCC and MI over the volumes of a
+// manifest and writes the results to an output directory, without Qt
+#include "Info/MutualInformationMatrix.hpp"
+#include "VolCorrelation/GradientSimilarityMeasure.hpp"
+#include "VolCorrelation/LocalCorrelationCoefficient.hpp"
+#include "VolCorrelation/MappedVolume.hpp"
+#include "VolCorrelation/SlabStreaming.hpp"
+#include "VolCorrelation/Trace.hpp"
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace VolCorrelation;
+
+namespace {
+
+constexpr auto Usage =
+    "usage: volcorrelation <manifest> [options]\n"
+    "\n"
+    "The manifest lists one volume per line as\n"
+    "  <path> <width> <height> <depth> <uint8|uint16|float|double>\n"
+    "Relative paths are resolved against the manifest's directory, blank\n"
+    "lines and lines starting with # are skipped. All volumes must share\n"
+    "their dimensions and data type.\n"
+    "\n"
+    "options:\n"
+    "  --metrics <list>      comma separated gsm,lcc,mi (default all)\n"
+    "  --output <dir>        output directory (default .)\n"
+    "  --threads <n>         OpenMP threads (default all cores)\n"
+    "  --memory <MB>         bound on the slabs of gsm and lcc and on the\n"
+    "                        tables and conversion chunks of mi\n"
+    "  --output-type <type>  uint8, uint16 or float result volumes (default\n"
+    "                        float)\n"
+    "  --sensitivity <n>     gradient similarity sensitivity (default 2)\n"
+    "  --window <n>          local correlation window size (default 3)\n"
+    "  --trace <file>        write a Chrome trace of the kernels to file and\n"
+    "                        print a per-stage summary\n";
+
+struct Volume {
+  std::string name;
+  std::string path;
+  uint32_t width, height, depth;
+  DataType type;
+};
+
+struct Options {
+  std::string manifest;
+  std::string output = ".";
+  bool gsm = true, lcc = true, mi = true;
+  int threads = 0;
+  size_t memoryLimit = std::numeric_limits<size_t>::max();
+  std::string outputType = "float";
+  int sensitivity = 2;
+  int windowSize = 3;
+  std::string trace;
+};
+
+auto readManifest(const std::string &path) -> std::vector<Volume> {
+  std::ifstream in(path);
+  if (!in.is_open()) {
+    throw std::runtime_error("failed to open " + path);
+  }
+  const auto directory = std::filesystem::path(path).parent_path();
+  std::vector<Volume> volumes;
+  std::string line;
+  for (size_t number = 1; std::getline(in, line); number++) {
+    std::istringstream fields(line);
+    std::string file, type;
+    if (!(fields >> file) || file[0] == '#') {
+      continue;
+    }
+    Volume volume;
+    if (!(fields >> volume.width >> volume.height >> volume.depth >> type)) {
+      throw std::runtime_error(path + ":" + std::to_string(number) +
+                               ": expected <path> <width> <height> <depth> "
+                               "<type>");
+    }
+    volume.type = parseDataType(type);
+    const auto filePath = std::filesystem::path(file);
+    volume.path = (filePath.is_absolute() ? filePath : directory / filePath)
+                      .string();
+    volume.name = filePath.stem().string();
+    volumes.push_back(std::move(volume));
+  }
+  if (volumes.empty()) {
+    throw std::runtime_error(path + " lists no volumes");
+  }
+  for (auto &volume : volumes) {
+    if (volume.width != volumes[0].width ||
+        volume.height != volumes[0].height ||
+        volume.depth != volumes[0].depth || volume.type != volumes[0].type) {
+      throw std::runtime_error(volume.name +
+                               " differs in dimensions or data type");
+    }
+  }
+  return volumes;
+}
+
+auto parseOptions(int argc, char **argv) -> Options {
+  Options options;
+  auto value = [&](int &i) -> std::string {
+    if (i + 1 >= argc) {
+      throw std::invalid_argument(std::string(argv[i]) + " needs a value");
+    }
+    return argv[++i];
+  };
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--metrics") {
+      const auto list = "," + value(i) + ",";
+      options.gsm = list.find(",gsm,") != std::string::npos;
+      options.lcc = list.find(",lcc,") != std::string::npos;
+      options.mi = list.find(",mi,") != std::string::npos;
+    } else if (arg == "--output") {
+      options.output = value(i);
+    } else if (arg == "--threads") {
+      options.threads = std::stoi(value(i));
+    } else if (arg == "--memory") {
+      options.memoryLimit = std::stoull(value(i)) * 1024 * 1024;
+    } else if (arg == "--output-type") {
+      options.outputType = value(i);
+    } else if (arg == "--sensitivity") {
+      options.sensitivity = std::stoi(value(i));
+    } else if (arg == "--window") {
+      options.windowSize = std::stoi(value(i));
+    } else if (arg == "--trace") {
+      options.trace = value(i);
+    } else if (arg == "-h" || arg == "--help") {
+      std::cout << Usage;
+      std::exit(0);
+    } else if (arg[0] != '-' && options.manifest.empty()) {
+      options.manifest = arg;
+    } else {
+      throw std::invalid_argument("unknown argument " + arg);
+    }
+  }
+  if (options.manifest.empty()) {
+    throw std::invalid_argument("no manifest given");
+  }
+  if (options.outputType != "uint8" && options.outputType != "uint16" &&
+      options.outputType != "float") {
+    throw std::invalid_argument("unknown output type " + options.outputType);
+  }
+  return options;
+}
+
+// seconds spent per step, in the order the steps ran
+class Timings {
+public:
+  template <typename Func> void measure(const std::string &step, Func func) {
+    const auto start = std::chrono::steady_clock::now();
+    func();
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    steps.emplace_back(step, elapsed.count());
+    std::cerr << step << ": " << elapsed.count() << " s" << std::endl;
+  }
+
+  const std::vector<std::pair<std::string, double>> &all() const {
+    return steps;
+  }
+
+private:
+  std::vector<std::pair<std::string, double>> steps;
+};
+
+// calls func with a value of the volumes' type and one of the output type
+template <typename Func>
+void visitTypes(DataType type, const std::string &outputType, Func func) {
+  auto withOut = [&](auto tag) {
+    if (outputType == "uint8") {
+      func(tag, uint8_t());
+    } else if (outputType == "uint16") {
+      func(tag, uint16_t());
+    } else {
+      func(tag, float());
+    }
+  };
+  switch (type) {
+  case DataType::UInt16:
+    return withOut(uint16_t());
+  case DataType::Float32:
+    return withOut(float());
+  case DataType::Float64:
+    return withOut(double());
+  default:
+    return withOut(uint8_t());
+  }
+}
+
+void writeMatrix(const std::string &path, const std::vector<Volume> &volumes,
+                 const std::vector<std::vector<double>> &matrix) {
+  std::ofstream out(path);
+  out << std::setprecision(17) << "name";
+  for (auto &volume : volumes) {
+    out << "," << volume.name;
+  }
+  out << "\n";
+  for (size_t i = 0; i < volumes.size(); i++) {
+    out << volumes[i].name;
+    for (size_t j = 0; j < volumes.size(); j++) {
+      out << "," << matrix[i][j];
+    }
+    out << "\n";
+  }
+  if (!out) {
+    throw std::runtime_error("failed to write " + path);
+  }
+}
+
+// reverse of MI mapped to 0~100 by the smallest MI between two fields, as in
+// the clustering demo; symmetric with a zero diagonal
+auto distancesOf(const std::vector<std::vector<double>> &mi)
+    -> std::vector<std::vector<double>> {
+  const auto fieldNum = mi.size();
+  auto min = std::numeric_limits<double>::max();
+  for (size_t i = 0; i < fieldNum; i++) {
+    for (size_t j = i + 1; j < fieldNum; j++) {
+      min = std::min(min, mi[i][j]);
+    }
+  }
+  std::vector<std::vector<double>> distances(
+      fieldNum, std::vector<double>(fieldNum, 0.0));
+  for (size_t i = 0; i < fieldNum; i++) {
+    for (size_t j = i + 1; j < fieldNum; j++) {
+      const auto I = mi[i][j];
+      distances[i][j] = distances[j][i] = I == 0 ? 100.0 : 100.0 * min / I;
+    }
+  }
+  return distances;
+}
+
+auto megabytes(size_t bytes) -> std::string {
+  return std::to_string((bytes + 1024 * 1024 - 1) / (1024 * 1024)) + " MB";
+}
+
+// deepest slab of a metric that stays within the memory limit; even a slab
+// of one slice may not, which is reported instead of exceeding the limit
+template <typename T, typename Out>
+auto slabDepthWithin(const std::string &metric, size_t fieldCount,
+                     const Volume &volume, uint32_t halo, size_t memoryLimit)
+    -> uint32_t {
+  const auto slabDepth = slabDepthForMemory<T, Out>(
+      fieldCount, volume.width, volume.height, volume.depth, halo,
+      memoryLimit);
+  const auto memory = estimateSlabStreamingMemory<T, Out>(
+      fieldCount, volume.width, volume.height, slabDepth, halo);
+  if (memory > memoryLimit) {
+    throw std::runtime_error(metric + " needs " + megabytes(memory) +
+                             " for a slab of one slice, more than --memory");
+  }
+  return slabDepth;
+}
+
+// voxels per chunk in which mi converts volumes that are not uint8: whole
+// slices, as many as the memory limit leaves room for beside the joint
+// tables. uint8 volumes are counted in place and only need the tables.
+auto miChunkSize(const std::vector<Volume> &volumes, size_t memoryLimit)
+    -> size_t {
+  const auto &first = volumes[0];
+  const auto size = static_cast<size_t>(first.width) * first.height *
+                    first.depth;
+  const auto slice = static_cast<size_t>(first.width) * first.height;
+  const auto fieldNum = volumes.size();
+  const auto isUint8 = first.type == DataType::UInt8;
+  const auto tables = Info::EstimateMutualInformationMemory(fieldNum, size, 0);
+  const auto needed =
+      isUint8 ? tables
+              : Info::EstimateMutualInformationMemory(fieldNum, size, slice);
+  if (needed > memoryLimit) {
+    throw std::runtime_error(
+        "mi needs " + megabytes(needed) +
+        (isUint8 ? " for its tables" : " for its tables and one slice") +
+        ", more than --memory");
+  }
+  if (memoryLimit == std::numeric_limits<size_t>::max()) {
+    return size;
+  }
+  return (memoryLimit - tables) / fieldNum / slice * slice;
+}
+
+// MI over the 256 buckets of Info; volumes of other types are converted
+// chunkSize voxels at a time
+auto mutualInformation(const std::vector<Volume> &volumes, size_t chunkSize)
+    -> Info::MutualInformationMatrix {
+  std::vector<MappedVolume> mapped;
+  std::vector<const MappedVolume *> pointers;
+  for (auto &volume : volumes) {
+    mapped.emplace_back(volume.path, volume.width, volume.height,
+                        volume.depth, volume.type);
+  }
+  for (auto &volume : mapped) {
+    pointers.push_back(&volume);
+  }
+  const auto size = mapped[0].voxelCount();
+  return visitVolumes(pointers, [&](const auto &fields) {
+    using T = std::remove_const_t<
+        std::remove_pointer_t<typename std::decay_t<decltype(fields)>::
+                                  value_type>>;
+    if constexpr (std::is_same<T, uint8_t>::value) {
+      return Info::CalculateMutualInformationMatrix(fields, size);
+    } else {
+      return Info::CalculateConvertedMutualInformationMatrix(fields, size,
+                                                             chunkSize);
+    }
+  });
+}
+
+void writeTimings(const std::string &path, const Options &options,
+                  const std::vector<Volume> &volumes, const Timings &timings,
+                  const std::vector<std::pair<std::string, ResultRange>>
+                      &ranges) {
+  const auto voxels = static_cast<size_t>(volumes[0].width) *
+                      volumes[0].height * volumes[0].depth;
+  std::ofstream out(path);
+  out << std::setprecision(17) << "{\n";
+  out << "  \"volumes\": " << volumes.size() << ",\n";
+  out << "  \"voxels\": " << voxels << ",\n";
+#ifdef _OPENMP
+  out << "  \"threads\": " << omp_get_max_threads() << ",\n";
+#else
+  out << "  \"threads\": 1,\n";
+#endif
+  if (options.memoryLimit != std::numeric_limits<size_t>::max()) {
+    out << "  \"memory_limit\": " << options.memoryLimit << ",\n";
+  }
+  out << "  \"ranges\": {";
+  for (size_t i = 0; i < ranges.size(); i++) {
+    out << (i == 0 ? "\n" : ",\n") << "    \"" << ranges[i].first
+        << "\": [" << ranges[i].second.min << ", " << ranges[i].second.max
+        << "]";
+  }
+  out << "\n  },\n";
+  out << "  \"seconds\": {";
+  const auto &steps = timings.all();
+  for (size_t i = 0; i < steps.size(); i++) {
+    out << (i == 0 ? "\n" : ",\n") << "    \"" << steps[i].first
+        << "\": " << steps[i].second;
+  }
+  out << "\n  }\n}\n";
+  if (!out) {
+    throw std::runtime_error("failed to write " + path);
+  }
+}
+
+void run(const Options &options) {
+  Tracer::instance().enable(!options.trace.empty());
+  const auto volumes = readManifest(options.manifest);
+  const auto &first = volumes[0];
+#ifdef _OPENMP
+  if (options.threads > 0) {
+    omp_set_num_threads(options.threads);
+  }
+#endif
+  std::filesystem::create_directories(options.output);
+  const auto output = std::filesystem::path(options.output);
+
+  std::vector<std::string> paths;
+  for (auto &volume : volumes) {
+    paths.push_back(volume.path);
+  }
+
+  // every metric is checked against the memory limit before any runs
+  const auto miChunk =
+      options.mi ? miChunkSize(volumes, options.memoryLimit) : 0;
+
+  Timings timings;
+  std::vector<std::pair<std::string, ResultRange>> ranges;
+  // gsm and lcc stream the raw files in z-slabs, as deep as the memory
+  // limit allows
+  visitTypes(first.type, options.outputType, [&](auto tag, auto outTag) {
+    using T = decltype(tag);
+    using Out = decltype(outTag);
+    const auto gsmDepth =
+        options.gsm ? slabDepthWithin<T, Out>("gsm", volumes.size(), first, 1,
+                                              options.memoryLimit)
+                    : 0;
+    const auto lccDepth =
+        options.lcc ? slabDepthWithin<T, Out>(
+                          "lcc", volumes.size(), first,
+                          static_cast<uint32_t>(options.windowSize),
+                          options.memoryLimit)
+                    : 0;
+    if (options.gsm) {
+      timings.measure("gsm", [&] {
+        ranges.emplace_back(
+            "gsm", streamGradientSimilarity<T, double, Out>(
+                       paths, (output / "gsm.raw").string(), first.width,
+                       first.height, first.depth, options.sensitivity,
+                       gsmDepth));
+      });
+    }
+    if (options.lcc) {
+      timings.measure("lcc", [&] {
+        ranges.emplace_back(
+            "lcc", streamLocalCorrelationCoefficient<T, double, Out>(
+                       paths, (output / "lcc.raw").string(), first.width,
+                       first.height, first.depth, options.windowSize,
+                       lccDepth));
+      });
+    }
+  });
+
+  if (options.mi) {
+    Info::MutualInformationMatrix matrix;
+    timings.measure("mi", [&] {
+      matrix = mutualInformation(volumes, miChunk);
+    });
+    writeMatrix((output / "mi.csv").string(), volumes, matrix.mi);
+    writeMatrix((output / "distances.csv").string(), volumes,
+                distancesOf(matrix.mi));
+  }
+
+  writeTimings((output / "timings.json").string(), options, volumes, timings,
+               ranges);
+  if (!options.trace.empty()) {
+    Tracer::instance().writeChromeTrace(options.trace);
+    Tracer::instance().writeSummary(std::cerr);
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    run(parseOptions(argc, argv));
+  } catch (const std::invalid_argument &e) {
+    std::cerr << e.what() << "\n\n" << Usage;
+    return 2;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
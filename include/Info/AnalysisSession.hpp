@@ -0,0 +1,207 @@
+#pragma once
+
+#include "ForceDirected.hpp"
+#include "HierarchicalCluster.hpp"
+#include "MutualInformationCache.hpp"
+#include <array>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace Info {
+
+// joint histograms of field against every one of others, flat with one
+// JointBucketNum block per other field; counted in tiles like
+// FillJointHistograms
+template <typename Count>
+void FillJointHistogramsWith(const uint8_t *field,
+                             const std::vector<const uint8_t *> &others,
+                             size_t size, size_t blockSize,
+                             std::vector<Count> &joints,
+                             ProgressTracker *tracker = nullptr) {
+  std::vector<const uint8_t *> fields{field};
+  std::vector<std::pair<size_t, size_t>> pairs;
+  for (size_t i = 0; i < others.size(); i++) {
+    fields.push_back(others[i]);
+    pairs.emplace_back(0, i + 1);
+  }
+  FillJointHistograms(fields, pairs, size, blockSize, joints, tracker);
+}
+
+// a working set of fields whose histograms and pairwise MI are kept between
+// changes. Adding a field counts only its pairs with the fields already in the
+// set, removing one drops its row, and the layout starts from the previous
+// positions, so growing a set of n fields by one costs n joint histograms
+// instead of n (n + 1) / 2. Fields are not copied and must stay valid while
+// they are in the session.
+class AnalysisSession {
+public:
+  explicit AnalysisSession(size_t size, const ResultCache *cache = nullptr)
+      : size(size), cache(cache) {
+    assert(size != 0);
+  }
+
+  // index of the new field, the fields after a removed one move down by one.
+  // A cancelled add throws OperationCancelled and leaves the session as it
+  // was.
+  size_t AddField(const uint8_t *field, const Progress &progress = {}) {
+    const auto hash =
+        cache != nullptr ? VolCorrelation::contentHash(field, size) : 0;
+    auto histogram = cache != nullptr ? CountValue(field, size, *cache, hash)
+                                      : CountValue(field, size);
+    const auto entropy = CalculateEntropy(histogram, size);
+
+    // joint histograms with every field in the set, loading cached pairs
+    const auto fieldNum = histograms.size();
+    std::vector<Counts> joints(fieldNum);
+    std::vector<size_t> missing;
+    for (size_t i = 0; i < fieldNum; i++) {
+      if (cache == nullptr ||
+          !cache->load(JointHistogramKey(hash, hashes[i], size), joints[i]) ||
+          joints[i].size() != JointBucketNum) {
+        missing.push_back(i);
+      }
+    }
+    if (!missing.empty()) {
+      std::vector<const uint8_t *> others;
+      for (auto i : missing) {
+        others.push_back(fields[i]);
+      }
+      ProgressTracker tracker(progress, size * others.size());
+      auto countMissing = [&](auto &counted) {
+        FillJointHistogramsWith(field, others, size,
+                                MutualInformationBlockSize, counted, &tracker);
+        tracker.throwIfCancelled();
+        for (size_t m = 0; m < missing.size(); m++) {
+          const auto begin = counted.begin() + m * JointBucketNum;
+          joints[missing[m]].assign(begin, begin + JointBucketNum);
+        }
+      };
+      if (size <= std::numeric_limits<uint32_t>::max()) {
+        std::vector<uint32_t> counted;
+        countMissing(counted);
+      } else {
+        std::vector<size_t> counted;
+        countMissing(counted);
+      }
+      if (cache != nullptr) {
+        for (auto i : missing) {
+          cache->store(JointHistogramKey(hash, hashes[i], size), joints[i]);
+        }
+      }
+    }
+
+    // the joint histograms are indexed new * 256 + other
+    for (size_t i = 0; i < fieldNum; i++) {
+      const auto I = CalculateMutationInformation(
+          joints[i].data(), histogram, histograms[i], size);
+      mi[i].push_back(I);
+    }
+    mi.emplace_back();
+    for (size_t i = 0; i < fieldNum; i++) {
+      mi.back().push_back(mi[i].back());
+    }
+    mi.back().push_back(entropy);
+
+    fields.push_back(field);
+    hashes.push_back(hash);
+    histograms.push_back(std::move(histogram));
+    entropies.push_back(entropy);
+    positions.push_back(PlaceNear(fieldNum));
+    return fieldNum;
+  }
+
+  void RemoveField(size_t index) {
+    assert(index < histograms.size());
+    fields.erase(fields.begin() + index);
+    hashes.erase(hashes.begin() + index);
+    histograms.erase(histograms.begin() + index);
+    entropies.erase(entropies.begin() + index);
+    positions.erase(positions.begin() + index);
+    mi.erase(mi.begin() + index);
+    for (auto &row : mi) {
+      row.erase(row.begin() + index);
+    }
+  }
+
+  size_t FieldNum() const { return histograms.size(); }
+  const Counts &Histogram(size_t i) const { return histograms[i]; }
+  double Entropy(size_t i) const { return entropies[i]; }
+  const std::vector<double> &Entropies() const { return entropies; }
+  // layout positions, NaN for fields added since the last Layout
+  const std::vector<std::array<double, 2>> &Positions() const {
+    return positions;
+  }
+
+  // symmetric, the diagonal holds the entropy of each field
+  const std::vector<std::vector<double>> &MutualInformation() const {
+    return mi;
+  }
+
+  // reverse of MI mapped to 0~100 by the smallest MI of the set; pairs without
+  // shared information are 100 apart. Only the upper triangle is filled.
+  std::vector<std::vector<double>> Distances() const {
+    const auto fieldNum = FieldNum();
+    auto min = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < fieldNum; i++) {
+      for (size_t j = i + 1; j < fieldNum; j++) {
+        min = std::min(min, mi[i][j]);
+      }
+    }
+    std::vector<std::vector<double>> distances(
+        fieldNum, std::vector<double>(fieldNum, 0.0));
+    for (size_t i = 0; i < fieldNum; i++) {
+      for (size_t j = i + 1; j < fieldNum; j++) {
+        const auto I = mi[i][j];
+        distances[i][j] = I == 0 ? 100.0 : 100.0 * min / I;
+      }
+    }
+    return distances;
+  }
+
+  // hierarchical clustering of the current distances
+  std::unique_ptr<HierarchicalCluster>
+  Cluster(size_t k, Linkage linkage = Linkage::Average) const {
+    auto cluster = std::make_unique<HierarchicalCluster>();
+    cluster->process(CondensedDistanceMatrix(Distances()), k, linkage);
+    return cluster;
+  }
+
+  // force-directed layout started from the positions of the previous call;
+  // a new field starts next to the field it is closest to
+  const std::vector<std::array<double, 2>> &
+  Layout(uint32_t width, uint32_t height, ForceDirectedOptions options = {}) {
+    options.initialPositions = positions;
+    positions = CalculateForceDirected(Distances(), width, height, options);
+    return positions;
+  }
+
+private:
+  // start position of field index: a few pixels off the position of the
+  // field it shares the most information with, NaN when that has none yet
+  std::array<double, 2> PlaceNear(size_t index) const {
+    const auto nan = std::numeric_limits<double>::quiet_NaN();
+    std::array<double, 2> position{nan, nan};
+    auto best = -1.0;
+    for (size_t i = 0; i < index; i++) {
+      if (!std::isnan(positions[i][0]) && mi[index][i] > best) {
+        best = mi[index][i];
+        position = {positions[i][0] + 10.0, positions[i][1] + 10.0};
+      }
+    }
+    return position;
+  }
+
+  size_t size;
+  const ResultCache *cache;
+  std::vector<const uint8_t *> fields;
+  std::vector<uint64_t> hashes;
+  std::vector<Counts> histograms;
+  std::vector<double> entropies;
+  std::vector<std::vector<double>> mi;
+  std::vector<std::array<double, 2>> positions;
+};
+
+} // namespace Info
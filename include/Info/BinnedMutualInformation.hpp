@@ -0,0 +1,275 @@
+#pragma once
+
+#include "MutualInformation.hpp"
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace Info {
+
+// bins are stored as 16 bit indices
+constexpr size_t MaxBinNum = 65536;
+
+// per-thread bytes up to which the joint histogram is a dense table; larger
+// bin counts count into a hash table of the occupied bins instead
+constexpr size_t DenseJointLimit = 4 * 1024 * 1024;
+
+// voxels binned at a time before they are counted
+constexpr size_t BinBlockSize = 4096;
+
+// binNum evenly spaced bins over [min, max] of a field, the same spacing
+// ConvertData uses for 256 bins
+struct Binning {
+  double min = 0.0;
+  double width = 0.0;
+  size_t binNum = BucketNum + 1;
+
+  template <typename T>
+  void Apply(const T *data, size_t size, uint16_t *bins) const {
+    // a constant field has no width, every voxel stays in bin 0
+    if (width == 0) {
+      std::fill(bins, bins + size, 0);
+      return;
+    }
+    const auto last = static_cast<double>(binNum - 1);
+    for (size_t i = 0; i < size; i++) {
+      auto w = static_cast<double>(data[i]) - min;
+      bins[i] = static_cast<uint16_t>(w / width * last);
+    }
+  }
+};
+
+template <typename T>
+Binning MakeBinning(const T *data, size_t size, size_t binNum) {
+  if (binNum < 2 || binNum > MaxBinNum) {
+    throw std::invalid_argument("bin count must be in [2, 65536]");
+  }
+  assert(size != 0);
+  const auto range = VolCorrelation::valueRange(data, size);
+  Binning binning;
+  binning.min = static_cast<double>(range.min);
+  binning.width = static_cast<double>(range.max) - binning.min;
+  binning.binNum = binNum;
+  return binning;
+}
+
+// calls func(begin, end, thread) for one contiguous chunk per thread
+template <typename Func> void ForEachThreadChunk(size_t size, Func func) {
+#pragma omp parallel
+  {
+#ifdef _OPENMP
+    const auto thread = static_cast<size_t>(omp_get_thread_num());
+    const auto teamSize = static_cast<size_t>(omp_get_num_threads());
+#else
+    const auto thread = static_cast<size_t>(0);
+    const auto teamSize = static_cast<size_t>(1);
+#endif
+    const auto chunk = size / teamSize, extra = size % teamSize;
+    const auto begin = chunk * thread + std::min(thread, extra);
+    const auto end = begin + chunk + (thread < extra ? 1 : 0);
+    func(begin, end, thread);
+  }
+}
+
+inline size_t MaxThreadNum() {
+#ifdef _OPENMP
+  return static_cast<size_t>(omp_get_max_threads());
+#else
+  return 1;
+#endif
+}
+
+// histogram of a field in binning.binNum bins, noise removed as in
+// CountValue
+template <typename T>
+Counts CountBinnedValue(const T *data, size_t size, const Binning &binning) {
+  std::vector<Counts> locals(MaxThreadNum(), Counts(binning.binNum, 0));
+  ForEachThreadChunk(size, [&](size_t begin, size_t end, size_t thread) {
+    auto &local = locals[thread];
+    uint16_t bins[BinBlockSize];
+    for (auto block = begin; block < end; block += BinBlockSize) {
+      const auto count = std::min(end - block, BinBlockSize);
+      binning.Apply(data + block, count, bins);
+      for (size_t i = 0; i < count; i++) {
+        local[bins[i]] += 1;
+      }
+    }
+  });
+
+  Counts counts(binning.binNum, 0);
+  for (auto &local : locals) {
+    for (size_t i = 0; i < counts.size(); i++) {
+      counts[i] += local[i];
+    }
+  }
+  RemoveNoise(counts);
+  return counts;
+}
+
+template <typename T>
+Counts CountBinnedValue(const T *data, size_t size, size_t binNum) {
+  return CountBinnedValue(data, size, MakeBinning(data, size, binNum));
+}
+
+// entropy of a field in binNum bins, read in its own type
+template <typename T>
+double CalculateBinnedEntropy(const T *data, size_t size, size_t binNum) {
+  auto counts = CountBinnedValue(data, size, binNum);
+  return CalculateEntropy(counts, size);
+}
+
+// open addressing table of the occupied joint bins, keyed by
+// binA * binNum + binB; a zero count marks an empty slot
+class JointHashTable {
+public:
+  explicit JointHashTable(size_t capacity = 1024) {
+    size_t slots = 16;
+    while (slots < 2 * capacity) {
+      slots *= 2;
+    }
+    keys.assign(slots, 0);
+    counts.assign(slots, 0);
+  }
+
+  void Add(uint32_t key, uint64_t count) {
+    // kept at most half full so that probe runs stay short
+    if ((used + 1) * 2 > keys.size()) {
+      Grow();
+    }
+    const auto slot = Find(key);
+    if (counts[slot] == 0) {
+      keys[slot] = key;
+      used++;
+    }
+    counts[slot] += count;
+  }
+
+  template <typename Func> void ForEach(Func func) const {
+    for (size_t slot = 0; slot < keys.size(); slot++) {
+      if (counts[slot] != 0) {
+        func(keys[slot], counts[slot]);
+      }
+    }
+  }
+
+  size_t Size() const { return used; }
+
+private:
+  size_t Find(uint32_t key) const {
+    const auto mask = keys.size() - 1;
+    auto slot =
+        (static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull >> 32) & mask;
+    while (counts[slot] != 0 && keys[slot] != key) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  void Grow() {
+    JointHashTable grown(keys.size());
+    ForEach([&](uint32_t key, uint64_t count) { grown.Add(key, count); });
+    *this = std::move(grown);
+  }
+
+  std::vector<uint32_t> keys;
+  std::vector<uint64_t> counts;
+  size_t used = 0;
+};
+
+// mutual information of two fields of any type in binNum bins each. The
+// joint histogram is a dense binNum x binNum table while a per-thread copy
+// fits in denseLimit bytes, otherwise a hash table of the occupied bins, whose
+// size is bounded by the number of distinct value pairs instead of binNum^2.
+// With 256 bins the result equals CalculateMutationInformation on
+// ConvertData of both fields.
+template <typename TA, typename TB>
+double CalculateBinnedMutualInformation(const TA *fieldA, const TB *fieldB,
+                                        size_t size, size_t binNum,
+                                        size_t denseLimit = DenseJointLimit) {
+  assert(size != 0);
+  VOLCORRELATION_TRACE_SCOPE("binned mutual information");
+  VOLCORRELATION_TRACE_COUNT("joint histogram voxels", size);
+  const auto binningA = MakeBinning(fieldA, size, binNum);
+  const auto binningB = MakeBinning(fieldB, size, binNum);
+  const auto a = CountBinnedValue(fieldA, size, binningA);
+  const auto b = CountBinnedValue(fieldB, size, binningB);
+  const auto jointNum = binNum * binNum;
+
+  auto pmi = [&](size_t i, size_t j, double count) {
+    if (a[i] == 0 || b[j] == 0) {
+      return 0.0;
+    }
+    const auto expected = static_cast<double>(a[i]) * b[j];
+    return count / size * log(count * size / expected);
+  };
+
+  // bins both fields of one thread chunk a block at a time
+  auto countChunk = [&](size_t begin, size_t end, auto add) {
+    uint16_t binsA[BinBlockSize], binsB[BinBlockSize];
+    for (auto block = begin; block < end; block += BinBlockSize) {
+      const auto count = std::min(end - block, BinBlockSize);
+      binningA.Apply(fieldA + block, count, binsA);
+      binningB.Apply(fieldB + block, count, binsB);
+      for (size_t i = 0; i < count; i++) {
+        add(static_cast<uint32_t>(binsA[i] * binNum + binsB[i]));
+      }
+    }
+  };
+
+  auto mi = 0.0;
+  if (jointNum * sizeof(uint32_t) <= denseLimit &&
+      size <= std::numeric_limits<uint32_t>::max()) {
+    std::vector<std::vector<uint32_t>> locals(MaxThreadNum());
+    ForEachThreadChunk(size, [&](size_t begin, size_t end, size_t thread) {
+      auto &local = locals[thread];
+      local.assign(jointNum, 0);
+      countChunk(begin, end, [&](uint32_t key) { local[key] += 1; });
+    });
+    for (size_t i = 0; i < binNum; i++) {
+      for (size_t j = 0; j < binNum; j++) {
+        size_t bin = 0;
+        for (auto &local : locals) {
+          bin += local.empty() ? 0 : local[i * binNum + j];
+        }
+        if (bin != 0) {
+          mi += pmi(i, j, static_cast<double>(bin));
+        }
+      }
+    }
+    return mi;
+  }
+
+  std::vector<JointHashTable> locals(MaxThreadNum());
+  ForEachThreadChunk(size, [&](size_t begin, size_t end, size_t thread) {
+    auto &local = locals[thread];
+    // runs of the same bin pair are counted once
+    uint32_t last = 0;
+    uint64_t run = 0;
+    countChunk(begin, end, [&](uint32_t key) {
+      if (run != 0 && key == last) {
+        run++;
+        return;
+      }
+      if (run != 0) {
+        local.Add(last, run);
+      }
+      last = key;
+      run = 1;
+    });
+    if (run != 0) {
+      local.Add(last, run);
+    }
+  });
+  for (size_t t = 1; t < locals.size(); t++) {
+    locals[t].ForEach(
+        [&](uint32_t key, uint64_t count) { locals[0].Add(key, count); });
+  }
+  locals[0].ForEach([&](uint32_t key, uint64_t count) {
+    mi += pmi(key / binNum, key % binNum, static_cast<double>(count));
+  });
+  return mi;
+}
+
+} // namespace Info
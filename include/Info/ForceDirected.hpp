@@ -2,7 +2,9 @@
 
 #include "HierarchicalCluster.hpp"
 #include <array>
-#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <limits>
 #include <random>
 #include <utility>
 
@@ -88,9 +90,150 @@ CalculateMove(const std::vector<std::array<double, 2>> &particles,
   return std::array<double, 2>{X, Y};
 }
 
+struct ForceDirectedOptions {
+  // stop once every particle's energy gradient is below epsilon
+  double epsilon = 1e-8;
+  // budget of Newton steps over all particles
+  size_t maxIterations = std::numeric_limits<size_t>::max();
+  // budget of wall time in seconds
+  double timeBudget = std::numeric_limits<double>::infinity();
+  // start positions per particle, e.g. a previous layout; particles without
+  // one (or with a NaN coordinate) start at random positions
+  std::vector<std::array<double, 2>> initialPositions;
+};
+
+// Kamada-Kawai state with flat l/k matrices and the energy gradient of every
+// particle kept up to date, so moving one particle costs O(n) instead of
+// recomputing all gradients in O(n^2)
+class KamadaKawaiSolver {
+public:
+  KamadaKawaiSolver(std::vector<std::array<double, 2>> particles,
+                    std::vector<double> l, std::vector<double> k)
+      : particles(std::move(particles)), l(std::move(l)), k(std::move(k)),
+        num(this->particles.size()), gradients(num) {
+    refresh();
+  }
+
+  // recompute all gradients from scratch, bounding the drift of the
+  // incremental updates
+  void refresh() {
+    for (size_t i = 0; i < num; i++) {
+      gradients[i] = derivatives(i)[0];
+    }
+  }
+
+  // particle with the largest energy gradient and that gradient's norm
+  std::pair<size_t, double> maxDelta() const {
+    double maxDelta = 0.0;
+    size_t maxIdx = 0;
+    for (size_t i = 0; i < num; i++) {
+      auto tmp = norm(gradients[i]);
+      if (tmp > maxDelta) {
+        maxDelta = tmp;
+        maxIdx = i;
+      }
+    }
+    return {maxIdx, maxDelta};
+  }
+
+  // Newton steps on particle m until its gradient is below epsilon or the
+  // step budget runs out; returns the number of steps taken
+  template <typename Budget> size_t relax(size_t m, double epsilon,
+                                          Budget exhausted) {
+    const auto old = particles[m];
+    size_t steps = 0;
+    auto current = derivatives(m);
+    double delta = 0.0;
+    do {
+      const auto &rhs = current[0];
+      const auto &coef = current[1];
+      auto X = (-rhs[0] * coef[3] - -rhs[1] * coef[1]) /
+               (coef[0] * coef[3] - coef[2] * coef[1]);
+      auto Y = (-rhs[0] * coef[2] - -rhs[1] * coef[0]) /
+               (coef[1] * coef[2] - coef[3] * coef[0]);
+      particles[m][0] += X;
+      particles[m][1] += Y;
+      steps++;
+      current = derivatives(m);
+      delta = norm(current[0]);
+    } while (delta > epsilon && !exhausted(steps));
+    gradients[m] = current[0];
+
+    // only the terms of the other particles that involve m change
+    for (size_t i = 0; i < num; i++) {
+      if (i == m || k[i * num + m] == 0) {
+        continue;
+      }
+      const auto before = term(i, m, old);
+      const auto after = term(i, m, particles[m]);
+      gradients[i][0] += after[0] - before[0];
+      gradients[i][1] += after[1] - before[1];
+    }
+    return steps;
+  }
+
+  std::vector<std::array<double, 2>> &getParticles() { return particles; }
+
+private:
+  static double norm(const std::array<double, 4> &gradient) {
+    return sqrt(gradient[0] * gradient[0] + gradient[1] * gradient[1]);
+  }
+
+  // contribution of a particle at position p to the gradient of particle i
+  std::array<double, 2> term(size_t i, size_t j,
+                             const std::array<double, 2> &p) const {
+    auto k_ij = k[i * num + j];
+    auto l_ij = l[i * num + j];
+    auto delta_x = particles[i][0] - p[0];
+    auto delta_y = particles[i][1] - p[1];
+    auto distance = sqrt(delta_x * delta_x + delta_y * delta_y);
+    return {k_ij * (delta_x - (l_ij * delta_x / distance)),
+            k_ij * (delta_y - (l_ij * delta_y / distance))};
+  }
+
+  // first (x, y) and second (xx, xy, yx, yy) partial derivatives of the
+  // energy with respect to particle idx, in one pass
+  std::array<std::array<double, 4>, 2> derivatives(size_t idx) const {
+    double resX = 0.0, resY = 0.0;
+    double resXX = 0.0, resYY = 0.0, resXY = 0.0;
+    const auto &current = particles[idx];
+    const auto kRow = k.data() + idx * num;
+    const auto lRow = l.data() + idx * num;
+    for (size_t i = 0; i < num; i++) {
+      if (i == idx) {
+        continue;
+      }
+      auto k_mi = kRow[i];
+      auto l_mi = lRow[i];
+      auto delta_x = current[0] - particles[i][0];
+      auto delta_x_squr = delta_x * delta_x;
+      auto delta_y = current[1] - particles[i][1];
+      auto delta_y_squr = delta_y * delta_y;
+      auto squr = delta_x_squr + delta_y_squr;
+      auto distance = sqrt(squr);
+      auto dividor = squr * distance;
+      resX += k_mi * (delta_x - (l_mi * delta_x / distance));
+      resY += k_mi * (delta_y - (l_mi * delta_y / distance));
+      resXX += k_mi * (1 - (l_mi * delta_y_squr / dividor));
+      resYY += k_mi * (1 - (l_mi * delta_x_squr / dividor));
+      resXY += k_mi * l_mi * delta_x * delta_y / dividor;
+    }
+    return {std::array<double, 4>{resX, resY, 0.0, 0.0},
+            std::array<double, 4>{resXX, resXY, resXY, resYY}};
+  }
+
+  std::vector<std::array<double, 2>> particles;
+  std::vector<double> l;
+  std::vector<double> k;
+  size_t num;
+  std::vector<std::array<double, 4>> gradients;
+};
+
 inline std::vector<std::array<double, 2>>
 CalculateForceDirected(const std::vector<std::vector<double>> &ds,
-                       uint32_t width, uint32_t height) {
+                       uint32_t width, uint32_t height,
+                       const ForceDirectedOptions &options = {}) {
+  VOLCORRELATION_TRACE_SCOPE("layout");
   const auto num = ds.size() + 1;
 
   // add a fake particle at center of the graph
@@ -115,6 +258,13 @@ CalculateForceDirected(const std::vector<std::vector<double>> &ds,
     p[0] = distrib(rng);
     p[1] = distrib(rng);
   }
+  for (size_t i = 0; i < ds.size() && i < options.initialPositions.size();
+       i++) {
+    const auto &p = options.initialPositions[i];
+    if (!std::isnan(p[0]) && !std::isnan(p[1])) {
+      particles[i] = p;
+    }
+  }
   particles[num - 1][0] = width / 2;
   particles[num - 1][1] = height / 2;
 
@@ -129,61 +279,48 @@ CalculateForceDirected(const std::vector<std::vector<double>> &ds,
     }
   }
   L = L0 / L;
-  std::vector<std::vector<double>> l(num);
+  std::vector<double> l(num * num, 0.0);
   for (size_t i = 0; i < num; i++) {
-    l[i].resize(num);
     for (size_t j = i + 1; j < num; j++) {
-      l[i][j] = L * distances[i][j];
+      l[i * num + j] = L * distances[i][j];
     }
   }
 
   // compute k_ij for 1 <= i != j <= n
   const auto K = 1.0;
-  std::vector<std::vector<double>> k(num);
+  std::vector<double> k(num * num, 0.0);
   for (size_t i = 0; i < num; i++) {
-    k[i].resize(num);
     for (size_t j = i + 1; j < num; j++) {
-      k[i][j] = K / (distances[i][j] * distances[i][j]);
-    }
-  }
-
-  const double exp = 1e-8;
-  double maxDelta = 0.0;
-  size_t maxIdx = 0;
-
-  for (size_t i = 0; i < particles.size(); i++) {
-    auto tmp = CalculateEnergeDelta(particles, l, k, i);
-    if (tmp > maxDelta) {
-      maxDelta = tmp;
-      maxIdx = i;
+      k[i * num + j] = K / (distances[i][j] * distances[i][j]);
     }
   }
 
+  const auto start = std::chrono::steady_clock::now();
   size_t count = 0;
-  while (maxDelta > exp) {
-    // let p_m be the particle satisfying delta_m = max_i_delta_i
-    auto delta = FLT_MAX;
-    auto &p = particles[maxIdx];
-    while (delta > exp) {
-      auto move = CalculateMove(particles, l, k, maxIdx);
-      p[0] += move[0];
-      p[1] += move[1];
-      delta = CalculateEnergeDelta(particles, l, k, maxIdx);
-      count++;
+  auto exhausted = [&](size_t steps) {
+    if (count + steps >= options.maxIterations) {
+      return true;
     }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() >= options.timeBudget;
+  };
 
-    maxDelta = 0.0;
-    for (size_t i = 0; i < particles.size(); i++) {
-      auto tmp = CalculateEnergeDelta(particles, l, k, i);
-      if (tmp > maxDelta) {
-        maxDelta = tmp;
-        maxIdx = i;
-      }
+  KamadaKawaiSolver solver(std::move(particles), std::move(l), std::move(k));
+  auto max = solver.maxDelta();
+  size_t moves = 0;
+  while (max.second > options.epsilon && !exhausted(0)) {
+    // let p_m be the particle satisfying delta_m = max_i_delta_i
+    count += solver.relax(max.first, options.epsilon, exhausted);
+    if (++moves % num == 0) {
+      solver.refresh();
     }
+    max = solver.maxDelta();
   }
 
-  std::cout << "Force-directed iteration: " << count << std::endl;
+  VOLCORRELATION_TRACE_COUNT("layout newton iterations", count);
 
+  particles = std::move(solver.getParticles());
   particles.pop_back();
   return particles;
 }
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "MutualInformation.hpp"
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <map>
 #include <utility>
 
@@ -46,43 +48,200 @@ inline double calcDistance(Node *a, Node *b,
   return distance;
 }
 
+enum class Linkage { Single, Complete, Average, Ward };
+
+// upper triangle of a symmetric distance matrix, stored row by row
+class CondensedDistanceMatrix {
+public:
+  CondensedDistanceMatrix() = default;
+  explicit CondensedDistanceMatrix(size_t n)
+      : n(n), values(n < 2 ? 0 : n * (n - 1) / 2, 0.0) {}
+
+  // reads the upper triangle of a square matrix
+  explicit CondensedDistanceMatrix(
+      const std::vector<std::vector<double>> &distances)
+      : CondensedDistanceMatrix(distances.size()) {
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = i + 1; j < n; j++) {
+        at(i, j) = distances[i][j];
+      }
+    }
+  }
+
+  size_t size() const { return n; }
+
+  double &at(size_t i, size_t j) { return values[index(i, j)]; }
+  double at(size_t i, size_t j) const { return values[index(i, j)]; }
+
+private:
+  size_t index(size_t i, size_t j) const {
+    if (i > j) {
+      std::swap(i, j);
+    }
+    return n * i - i * (i + 1) / 2 + (j - i - 1);
+  }
+
+  size_t n = 0;
+  std::vector<double> values;
+};
+
+// distance from cluster k to the union of i and j, given the distances to
+// both parts (Lance-Williams)
+inline double LanceWilliams(Linkage linkage, double dki, double dkj,
+                            double dij, size_t ni, size_t nj, size_t nk) {
+  switch (linkage) {
+  case Linkage::Single:
+    return std::min(dki, dkj);
+  case Linkage::Complete:
+    return std::max(dki, dkj);
+  case Linkage::Ward: {
+    const auto total = static_cast<double>(ni + nj + nk);
+    const auto squared = ((ni + nk) * dki * dki + (nj + nk) * dkj * dkj -
+                          nk * dij * dij) /
+                         total;
+    return std::sqrt(std::max(squared, 0.0));
+  }
+  default:
+    return (ni * dki + nj * dkj) / static_cast<double>(ni + nj);
+  }
+}
+
+// two positions of the node list, first < second, merged at distance
+struct Merge {
+  size_t first;
+  size_t second;
+  double distance;
+};
+
+// the merges of a greedy closest-pair search over a node list: the closest
+// pair is merged into the first position and the last node moves into the
+// second, and ties go to the smallest (first, second). Each position caches
+// its nearest later position and only positions whose neighbor changed are
+// rescanned, which is O(n^2) on typical matrices and O(n^3) at worst. Average
+// linkage keeps sums of leaf distances and divides by the pair count, as
+// calcDistance does.
+inline std::vector<Merge> NearestNeighborMerges(CondensedDistanceMatrix d,
+                                                Linkage linkage) {
+  const auto n = d.size();
+  std::vector<Merge> merges;
+  if (n < 2) {
+    return merges;
+  }
+  merges.reserve(n - 1);
+
+  // matrix slot of every position, and the size of every slot
+  std::vector<size_t> slots(n);
+  std::vector<size_t> sizes(n, 1);
+  for (size_t i = 0; i < n; i++) {
+    slots[i] = i;
+  }
+  auto value = [&](size_t p, size_t q) {
+    const auto a = slots[p], b = slots[q];
+    return linkage == Linkage::Average
+               ? d.at(a, b) / static_cast<double>(sizes[a] * sizes[b])
+               : d.at(a, b);
+  };
+
+  std::vector<size_t> neighbor(n);
+  std::vector<double> nearest(n);
+  auto rescan = [&](size_t p) {
+    neighbor[p] = p + 1;
+    nearest[p] = value(p, p + 1);
+    for (size_t q = p + 2; q < slots.size(); q++) {
+      const auto distance = value(p, q);
+      if (distance < nearest[p]) {
+        nearest[p] = distance;
+        neighbor[p] = q;
+      }
+    }
+  };
+  for (size_t p = 0; p + 1 < n; p++) {
+    rescan(p);
+  }
+
+  while (slots.size() > 1) {
+    size_t first = 0;
+    for (size_t p = 1; p + 1 < slots.size(); p++) {
+      if (nearest[p] < nearest[first]) {
+        first = p;
+      }
+    }
+    const auto second = neighbor[first];
+    const auto last = slots.size() - 1;
+    const auto distance = nearest[first];
+    merges.push_back(Merge{first, second, distance});
+
+    const auto a = slots[first], b = slots[second];
+    const auto dab = d.at(a, b);
+    for (auto k : slots) {
+      if (k == a || k == b) {
+        continue;
+      }
+      d.at(k, a) = linkage == Linkage::Average
+                       ? d.at(k, a) + d.at(k, b)
+                       : LanceWilliams(linkage, d.at(k, a), d.at(k, b), dab,
+                                       sizes[a], sizes[b], sizes[k]);
+    }
+    sizes[a] += sizes[b];
+    slots[second] = slots[last];
+    slots.pop_back();
+
+    // positions before the merge only look at the two changed positions,
+    // unless their neighbor was one of them or the node that moved
+    for (size_t p = 0; p + 1 < slots.size(); p++) {
+      if (p == first || p == second || neighbor[p] == first ||
+          neighbor[p] == second || neighbor[p] == last) {
+        rescan(p);
+        continue;
+      }
+      for (auto q : {first, second}) {
+        if (q <= p || q >= slots.size()) {
+          continue;
+        }
+        const auto candidate = value(p, q);
+        if (candidate < nearest[p] ||
+            (candidate == nearest[p] && q < neighbor[p])) {
+          nearest[p] = candidate;
+          neighbor[p] = q;
+        }
+      }
+    }
+  }
+  return merges;
+}
+
 class HierarchicalCluster {
 public:
-  void process(const std::vector<std::vector<double>> &distances, size_t k) {
-    std::vector<Node *> nodes(distances.size());
+  void process(const std::vector<std::vector<double>> &distances, size_t k,
+               Linkage linkage = Linkage::Average) {
+    process(CondensedDistanceMatrix(distances), k, linkage);
+  }
+
+  void process(CondensedDistanceMatrix distances, size_t k,
+               Linkage linkage = Linkage::Average) {
+    VOLCORRELATION_TRACE_SCOPE("clustering");
+    const auto n = distances.size();
+    std::vector<Node *> nodes(n);
     for (size_t i = 0; i < nodes.size(); i++) {
       nodes[i] = new Node();
       nodes[i]->id = i;
     }
+    if (nodes.empty()) {
+      return;
+    }
 
-    size_t i = 0, j = 0;
-    while (nodes.size() > 1) {
-      auto closest = std::make_pair<size_t, size_t>(0, 0);
-      double min = FLT_MAX;
-      for (i = 0; i < nodes.size(); i++) {
-        auto nodeA = nodes[i];
-        for (j = i + 1; j < nodes.size(); j++) {
-          auto nodeB = nodes[j];
-          auto distance = calcDistance(nodeA, nodeB, distances);
-          distance /= (nodeA->count * nodeB->count);
-          if (distance < min) {
-            min = distance;
-            closest.first = i;
-            closest.second = j;
-          }
-        }
-      }
-      auto nodeA = nodes[closest.first];
-      auto nodeB = nodes[closest.second];
+    for (auto &merge : NearestNeighborMerges(std::move(distances), linkage)) {
+      auto nodeA = nodes[merge.first];
+      auto nodeB = nodes[merge.second];
       // merge
       auto node = new Node();
       node->isLeaf = false;
       node->count = nodeA->count + nodeB->count;
       node->left = nodeA;
       node->right = nodeB;
-      node->distance = min;
-      nodes[closest.first] = node;
-      nodes[closest.second] = nodes.back();
+      node->distance = merge.distance;
+      nodes[merge.first] = node;
+      nodes[merge.second] = nodes.back();
       nodes.pop_back();
 
       if (nodes.size() == k) {
@@ -162,6 +321,9 @@ public:
   Node *getRoot() const { return root; }
 
   ~HierarchicalCluster() {
+    if (this->root == nullptr) {
+      return;
+    }
     // free all nodes
     std::map<Node *, bool> history;
     std::vector<Node *> stack;
@@ -170,9 +332,9 @@ public:
     while (!stack.empty()) {
       auto node = stack.back();
       if (node->isLeaf) {
+        history.emplace(node, true);
         delete node;
         stack.pop_back();
-        history.emplace(node, true);
         continue;
       }
 
@@ -193,7 +355,7 @@ public:
   }
 
 private:
-  Node *root;
+  Node *root = nullptr;
   std::vector<Node *> clusters;
 };
 
@@ -1,8 +1,20 @@
 #pragma once
 
+#include "../VolCorrelation/CpuDispatch.hpp"
+#include "../VolCorrelation/FieldRange.hpp"
+#include "../VolCorrelation/Trace.hpp"
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
 #include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace Info {
 
@@ -10,51 +22,192 @@ using Counts = std::vector<size_t>;
 
 constexpr size_t BucketNum = 256 - 1;
 
-// convert data to type of uint8_t
+// maps [min, min + width] onto the buckets, truncating like the scalar cast
 template <typename T>
-std::vector<uint8_t> ConvertData(const std::vector<T> &data) {
-  std::vector<uint8_t> result;
-  result.reserve(data.size());
-
-  T max = data[0];
-  T min = data[0];
-  std::for_each(data.begin(), data.end(), [&max, &min](auto value) {
-    if (value > max) {
-      max = value;
-    } else if (value < min) {
-      min = value;
-    }
-  });
+void QuantizeScalar(const T *data, size_t size, double min, double width,
+                    uint8_t *out) {
+  for (size_t i = 0; i < size; i++) {
+    auto w = static_cast<double>(data[i]) - min;
+    auto newValue = w / width * BucketNum;
+    out[i] = static_cast<uint8_t>(newValue);
+  }
+}
 
-  double width = static_cast<double>(max) - static_cast<double>(min);
-  std::for_each(
-      data.begin(), data.end(), [&result, width, min, max](auto value) {
-        auto w = static_cast<double>(value) - static_cast<double>(min);
-        auto newValue = w / width * BucketNum;
-        result.push_back(static_cast<uint8_t>(newValue));
-      });
+#ifdef VOLCORRELATION_X86
+VOLCORRELATION_TARGET("avx2")
+inline __m256d LoadAsDouble(const uint8_t *p) {
+  int32_t bytes;
+  std::memcpy(&bytes, p, sizeof(bytes));
+  return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+}
 
-  return result;
+VOLCORRELATION_TARGET("avx2")
+inline __m256d LoadAsDouble(const uint16_t *p) {
+  return _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p))));
 }
 
-inline Counts CountValue(const std::vector<uint8_t> &data) {
-  Counts counts(BucketNum + 1, 0);
+VOLCORRELATION_TARGET("avx2")
+inline __m256d LoadAsDouble(const float *p) {
+  return _mm256_cvtps_pd(_mm_loadu_ps(p));
+}
 
-  for (auto value : data) {
-    counts[value] += 1;
+VOLCORRELATION_TARGET("avx2")
+inline __m256d LoadAsDouble(const double *p) { return _mm256_loadu_pd(p); }
+
+// same operations as QuantizeScalar, 16 voxels at a time; bucket indices lie
+// in [0, 255], so the saturating packs are exact
+template <typename T>
+VOLCORRELATION_TARGET("avx2")
+void QuantizeAVX2(const T *data, size_t size, double min, double width,
+                  uint8_t *out) {
+  const auto vmin = _mm256_set1_pd(min), vwidth = _mm256_set1_pd(width),
+             scale = _mm256_set1_pd(static_cast<double>(BucketNum));
+  __m128i buckets[4];
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    for (int k = 0; k < 4; k++) {
+      const auto w = _mm256_sub_pd(LoadAsDouble(data + i + 4 * k), vmin);
+      buckets[k] = _mm256_cvttpd_epi32(
+          _mm256_mul_pd(_mm256_div_pd(w, vwidth), scale));
+    }
+    const auto packed =
+        _mm_packus_epi16(_mm_packus_epi32(buckets[0], buckets[1]),
+                         _mm_packus_epi32(buckets[2], buckets[3]));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), packed);
   }
+  QuantizeScalar(data + i, size - i, min, width, out + i);
+}
+#endif
 
-  // remove noise
+template <typename T>
+void Quantize(const T *data, size_t size, double min, double width,
+              uint8_t *out) {
+#ifdef VOLCORRELATION_X86
+  if constexpr (VolCorrelation::HasVectorKernel<T>) {
+    if (VolCorrelation::activeIsa() != VolCorrelation::Isa::Scalar) {
+      QuantizeAVX2(data, size, min, width, out);
+      return;
+    }
+  }
+#endif
+  QuantizeScalar(data, size, min, width, out);
+}
+
+// converts size values into out with the buckets of a field whose values
+// span range, so that the chunks of a field convert like the whole field
+template <typename T, typename Value = std::remove_const_t<T>>
+void ConvertData(const T *begin, size_t size,
+                 const VolCorrelation::ValueRange<Value> &range, uint8_t *out) {
+  const auto min = static_cast<double>(range.min);
+  const auto width = static_cast<double>(range.max) - min;
+  // a constant field has no width, every voxel stays in bucket 0
+  if (width == 0) {
+    std::fill(out, out + size, uint8_t(0));
+    return;
+  }
+
+  const auto blockSize = static_cast<int64_t>(64 * 1024);
+  const auto blockNum =
+      (static_cast<int64_t>(size) + blockSize - 1) / blockSize;
+#pragma omp parallel for schedule(static)
+  for (int64_t block = 0; block < blockNum; block++) {
+    const auto first = static_cast<size_t>(block * blockSize);
+    const auto count = std::min(size - first, static_cast<size_t>(blockSize));
+    Quantize<Value>(begin + first, count, min, width, out + first);
+  }
+}
+
+// convert data to type of uint8_t, buckets spread evenly over [min, max]
+template <typename T>
+std::vector<uint8_t> ConvertData(const T *begin, size_t size) {
+  std::vector<uint8_t> result(size, 0);
+  if (size == 0) {
+    return result;
+  }
+  ConvertData(begin, size, VolCorrelation::valueRange(begin, size),
+              result.data());
+  return result;
+}
+
+template <typename T>
+std::vector<uint8_t> ConvertData(const std::vector<T> &data) {
+  return ConvertData(data.data(), data.size());
+}
+
+// fold buckets holding at most one voxel into bucket 0
+inline void RemoveNoise(Counts &counts) {
   for (size_t i = 0; i < counts.size(); i++) {
     if (counts[i] <= 1) {
       counts[0] += counts[i];
       counts[i] = 0;
     }
   }
+}
+
+// four interleaved histograms, so that runs of equal values update different
+// counters instead of waiting on the previous store to the same one
+struct alignas(64) SubHistograms {
+  std::array<size_t, 4 * (BucketNum + 1)> bins{};
+};
+
+inline void CountValueChunk(const uint8_t *data, size_t size,
+                            SubHistograms &local) {
+  auto bins = local.bins.data();
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    bins[data[i]] += 1;
+    bins[(BucketNum + 1) + data[i + 1]] += 1;
+    bins[2 * (BucketNum + 1) + data[i + 2]] += 1;
+    bins[3 * (BucketNum + 1) + data[i + 3]] += 1;
+  }
+  for (; i < size; i++) {
+    bins[data[i]] += 1;
+  }
+}
+
+inline Counts CountValue(const uint8_t *data, size_t size) {
+  VOLCORRELATION_TRACE_SCOPE("histogram");
+  VOLCORRELATION_TRACE_COUNT("histogram voxels", size);
+  Counts counts(BucketNum + 1, 0);
+#ifdef _OPENMP
+  const auto threadNum = static_cast<size_t>(omp_get_max_threads());
+#else
+  const auto threadNum = static_cast<size_t>(1);
+#endif
+  std::vector<SubHistograms> locals(threadNum);
+
+#pragma omp parallel num_threads(static_cast<int>(threadNum))
+  {
+#ifdef _OPENMP
+    const auto thread = static_cast<size_t>(omp_get_thread_num());
+    const auto teamSize = static_cast<size_t>(omp_get_num_threads());
+#else
+    const auto thread = static_cast<size_t>(0);
+    const auto teamSize = static_cast<size_t>(1);
+#endif
+    const auto chunk = size / teamSize, extra = size % teamSize;
+    const auto begin = chunk * thread + std::min(thread, extra);
+    const auto end = begin + chunk + (thread < extra ? 1 : 0);
+    CountValueChunk(data + begin, end - begin, locals[thread]);
+  }
+
+  for (auto &local : locals) {
+    for (size_t i = 0; i < local.bins.size(); i++) {
+      counts[i % (BucketNum + 1)] += local.bins[i];
+    }
+  }
+
+  // remove noise
+  RemoveNoise(counts);
 
   return counts;
 }
 
+inline Counts CountValue(const std::vector<uint8_t> &data) {
+  return CountValue(data.data(), data.size());
+}
+
 inline double CalculateEntropy(Counts &counts, size_t total) {
   auto entropy = 0.0;
   for (auto count : counts) {
@@ -66,27 +219,132 @@ inline double CalculateEntropy(Counts &counts, size_t total) {
   return -entropy;
 }
 
-inline double CalculateMutationInformation(uint8_t *fieldA, uint8_t *fieldB, Counts &a,
-                                    Counts &b, size_t size) {
-  assert(size != 0);
+constexpr size_t JointBucketNum = (BucketNum + 1) * (BucketNum + 1);
 
-  auto mi = 0.0;
+// one thread's private 256x256 joint counts, cache line aligned so that
+// neighbouring threads never share a line
+template <typename Count> struct alignas(64) JointCounts {
+  std::array<Count, JointBucketNum> bins{};
+};
 
-  std::vector<std::vector<size_t>> counts(BucketNum + 1);
-  for (auto &c : counts) {
-    c.resize(BucketNum + 1, 0);
+template <typename Count>
+void CountJointScalar(const uint8_t *fieldA, const uint8_t *fieldB,
+                      size_t size, Count *bins) {
+  for (size_t i = 0; i < size; i++) {
+    bins[(static_cast<size_t>(fieldA[i]) << 8) | fieldB[i]] += 1;
   }
+}
 
-  for (size_t i = 0; i < size; i++) {
-    counts[fieldA[i]][fieldB[i]] += 1;
+#ifdef VOLCORRELATION_X86
+// builds 32 bin indices at a time by interleaving the bytes of both fields,
+// b lands in the low and a in the high byte of every 16 bit index
+template <typename Count>
+VOLCORRELATION_TARGET("avx2")
+void CountJointAVX2(const uint8_t *fieldA, const uint8_t *fieldB, size_t size,
+                    Count *bins) {
+  alignas(32) uint16_t indices[32];
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    const auto a = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(fieldA + i));
+    const auto b = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(fieldB + i));
+    _mm256_store_si256(reinterpret_cast<__m256i *>(indices),
+                       _mm256_unpacklo_epi8(b, a));
+    _mm256_store_si256(reinterpret_cast<__m256i *>(indices + 16),
+                       _mm256_unpackhi_epi8(b, a));
+    for (auto index : indices) {
+      bins[index] += 1;
+    }
   }
+  CountJointScalar(fieldA + i, fieldB + i, size - i, bins);
+}
+#endif
+
+// adds size voxel pairs to a flat 256x256 histogram; avx512 has no cheaper
+// byte interleave than avx2, so both levels share the avx2 kernel
+template <typename Count>
+void CountJoint(const uint8_t *fieldA, const uint8_t *fieldB, size_t size,
+                Count *bins) {
+#ifdef VOLCORRELATION_X86
+  if (VolCorrelation::activeIsa() != VolCorrelation::Isa::Scalar) {
+    CountJointAVX2(fieldA, fieldB, size, bins);
+    return;
+  }
+#endif
+  CountJointScalar(fieldA, fieldB, size, bins);
+}
+
+template <typename Count>
+void FillJointHistogram(const uint8_t *fieldA, const uint8_t *fieldB,
+                        size_t size, Counts &counts) {
+#ifdef _OPENMP
+  const auto threadNum = static_cast<size_t>(omp_get_max_threads());
+#else
+  const auto threadNum = static_cast<size_t>(1);
+#endif
+  std::vector<JointCounts<Count>> locals(threadNum);
+
+#pragma omp parallel num_threads(static_cast<int>(threadNum))
+  {
+#ifdef _OPENMP
+    const auto thread = static_cast<size_t>(omp_get_thread_num());
+    const auto teamSize = static_cast<size_t>(omp_get_num_threads());
+#else
+    const auto thread = static_cast<size_t>(0);
+    const auto teamSize = static_cast<size_t>(1);
+#endif
+    // one contiguous chunk per thread, as schedule(static) would split it
+    const auto chunk = size / teamSize, extra = size % teamSize;
+    const auto begin = chunk * thread + std::min(thread, extra);
+    const auto end = begin + chunk + (thread < extra ? 1 : 0);
+    CountJoint(fieldA + begin, fieldB + begin, end - begin,
+               locals[thread].bins.data());
+#pragma omp barrier
+
+    // merge, every thread sums a slice of the bins over all copies
+#pragma omp for schedule(static)
+    for (int64_t bin = 0; bin < static_cast<int64_t>(JointBucketNum); bin++) {
+      size_t sum = 0;
+      for (auto &copy : locals) {
+        sum += copy.bins[bin];
+      }
+      counts[bin] = sum;
+    }
+  }
+}
+
+// joint histogram of two fields, flat and indexed by a * 256 + b
+inline Counts CalculateJointHistogram(const uint8_t *fieldA,
+                                      const uint8_t *fieldB, size_t size) {
+  VOLCORRELATION_TRACE_SCOPE("joint histogram");
+  VOLCORRELATION_TRACE_COUNT("joint histogram voxels", size);
+  Counts counts(JointBucketNum, 0);
+  // a thread never counts more than size voxels, so use the narrowest
+  // counter that cannot overflow to keep the private copies in cache
+  if (size <= std::numeric_limits<uint16_t>::max()) {
+    FillJointHistogram<uint16_t>(fieldA, fieldB, size, counts);
+  } else if (size <= std::numeric_limits<uint32_t>::max()) {
+    FillJointHistogram<uint32_t>(fieldA, fieldB, size, counts);
+  } else {
+    FillJointHistogram<size_t>(fieldA, fieldB, size, counts);
+  }
+  return counts;
+}
+
+// mutual information from a flat joint histogram and both marginals
+template <typename Count>
+double CalculateMutationInformation(const Count *joint, const Counts &a,
+                                    const Counts &b, size_t size) {
+  auto mi = 0.0;
 
   for (size_t i = 0; i < BucketNum + 1; i++) {
     for (size_t j = 0; j < BucketNum + 1; j++) {
-      if (counts[i][j] == 0 || a[i] == 0 || b[j] == 0) {
+      const auto bin = joint[i * (BucketNum + 1) + j];
+      if (bin == 0 || a[i] == 0 || b[j] == 0) {
         continue;
       }
-      auto count = static_cast<double>(counts[i][j]);
+      auto count = static_cast<double>(bin);
       auto pmi = count / size * log(count * size / (a[i] * b[j]));
       mi += pmi;
     }
@@ -94,4 +352,14 @@ inline double CalculateMutationInformation(uint8_t *fieldA, uint8_t *fieldB, Cou
 
   return mi;
 }
+
+inline double CalculateMutationInformation(const uint8_t *fieldA,
+                                           const uint8_t *fieldB,
+                                           const Counts &a, const Counts &b,
+                                           size_t size) {
+  assert(size != 0);
+
+  const auto counts = CalculateJointHistogram(fieldA, fieldB, size);
+  return CalculateMutationInformation(counts.data(), a, b, size);
+}
 } // namespace Info
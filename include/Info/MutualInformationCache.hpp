@@ -0,0 +1,122 @@
+#pragma once
+
+#include "../VolCorrelation/ResultCache.hpp"
+#include "MutualInformationMatrix.hpp"
+#include <utility>
+#include <vector>
+
+namespace Info {
+
+using VolCorrelation::CacheKey;
+using VolCorrelation::ResultCache;
+
+inline CacheKey HistogramKey(uint64_t hash, size_t size) {
+  return CacheKey("histogram").add(hash).add(size).add(BucketNum + 1);
+}
+
+inline CacheKey JointHistogramKey(uint64_t hashA, uint64_t hashB,
+                                  size_t size) {
+  return CacheKey("joint").add(hashA).add(hashB).add(size).add(BucketNum + 1);
+}
+
+// histogram of a field, loaded from cache when its content was counted before
+inline Counts CountValue(const uint8_t *data, size_t size,
+                         const ResultCache &cache, uint64_t hash) {
+  const auto key = HistogramKey(hash, size);
+  Counts counts;
+  if (!cache.load(key, counts) || counts.size() != BucketNum + 1) {
+    counts = CountValue(data, size);
+    cache.store(key, counts);
+  }
+  return counts;
+}
+
+inline Counts CountValue(const uint8_t *data, size_t size,
+                         const ResultCache &cache) {
+  return CountValue(data, size, cache,
+                    VolCorrelation::contentHash(data, size));
+}
+
+// CalculateMutualInformationMatrix through the cache. Fields are identified
+// by their content hash; the matrix, every histogram and every pair's joint
+// histogram are stored, so an unchanged set of fields costs only the hashing,
+// and a set with new fields only counts the pairs that were never counted.
+// progress covers the counting pass.
+inline MutualInformationMatrix
+CalculateMutualInformationMatrix(const std::vector<const uint8_t *> &fields,
+                                 size_t size, const ResultCache &cache,
+                                 const Progress &progress = {}) {
+  assert(size != 0);
+  const auto fieldNum = fields.size();
+  std::vector<uint64_t> hashes(fieldNum);
+  for (size_t i = 0; i < fieldNum; i++) {
+    hashes[i] = VolCorrelation::contentHash(fields[i], size);
+  }
+
+  MutualInformationMatrix result;
+  result.histograms.resize(fieldNum);
+  result.entropies.resize(fieldNum);
+  for (size_t i = 0; i < fieldNum; i++) {
+    result.histograms[i] = CountValue(fields[i], size, cache, hashes[i]);
+    result.entropies[i] = CalculateEntropy(result.histograms[i], size);
+  }
+
+  const auto matrixKey = CacheKey("mi-matrix").add(hashes).add(size);
+  if (cache.loadMatrix(matrixKey, result.mi) && result.mi.size() == fieldNum) {
+    return result;
+  }
+
+  result.mi.clear();
+  result.mi.resize(fieldNum, std::vector<double>(fieldNum, 0.0));
+  auto setPair = [&](size_t i, size_t j, const auto *joint) {
+    const auto I = CalculateMutationInformation(joint, result.histograms[i],
+                                                result.histograms[j], size);
+    result.mi[i][j] = I;
+    result.mi[j][i] = I;
+  };
+  for (size_t i = 0; i < fieldNum; i++) {
+    result.mi[i][i] = result.entropies[i];
+  }
+
+  // pairs counted before are loaded one at a time, the rest are collected
+  Counts joint;
+  std::vector<std::pair<size_t, size_t>> missing;
+  for (size_t i = 0; i < fieldNum; i++) {
+    for (size_t j = i + 1; j < fieldNum; j++) {
+      if (cache.load(JointHistogramKey(hashes[i], hashes[j], size), joint) &&
+          joint.size() == JointBucketNum) {
+        setPair(i, j, joint.data());
+      } else {
+        missing.emplace_back(i, j);
+      }
+    }
+  }
+
+  if (!missing.empty()) {
+    // one pass over the voxel blocks for the missing pairs only
+    ProgressTracker tracker(progress, size * missing.size());
+    auto countMissing = [&](auto &counted) {
+      FillJointHistograms(fields, missing, size, MutualInformationBlockSize,
+                          counted, &tracker);
+      tracker.throwIfCancelled();
+      for (size_t m = 0; m < missing.size(); m++) {
+        const auto i = missing[m].first, j = missing[m].second;
+        const auto *block = counted.data() + m * JointBucketNum;
+        setPair(i, j, block);
+        joint.assign(block, block + JointBucketNum);
+        cache.store(JointHistogramKey(hashes[i], hashes[j], size), joint);
+      }
+    };
+    if (size <= std::numeric_limits<uint32_t>::max()) {
+      std::vector<uint32_t> counted;
+      countMissing(counted);
+    } else {
+      std::vector<size_t> counted;
+      countMissing(counted);
+    }
+  }
+  cache.storeMatrix(matrixKey, result.mi);
+  return result;
+}
+
+} // namespace Info
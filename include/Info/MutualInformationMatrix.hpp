@@ -0,0 +1,319 @@
+#pragma once
+
+#include "../VolCorrelation/Progress.hpp"
+#include "MutualInformation.hpp"
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace Info {
+
+struct MutualInformationMatrix {
+  // per field, noise removed as in CountValue
+  std::vector<Counts> histograms;
+  std::vector<double> entropies;
+  // symmetric, the diagonal holds the entropy of each field
+  std::vector<std::vector<double>> mi;
+};
+
+// voxels read per block. Every pair's joint table, 256 KB of counts, is read
+// and written back once per block, so blocks are large against the table;
+// the fields of a tile share a block in cache meanwhile.
+constexpr size_t MutualInformationBlockSize = 1024 * 1024;
+
+// fields per group: the pairs between two groups form a tile and are counted
+// together, each block of the tile's fields (8 MB with the default block
+// size) serving up to 16 pairs
+constexpr size_t MutualInformationTileFields = 4;
+
+using VolCorrelation::OperationCancelled;
+using VolCorrelation::Progress;
+using VolCorrelation::ProgressTracker;
+
+// adds the joint histograms of the given field pairs to joints, one
+// JointBucketNum block per pair in their order, and, if marginals is given,
+// every field's histogram to it; both are sized by the caller, so chunks of
+// the fields can be counted one after the other. Pairs are counted tile by
+// tile and block by block, so neither all fields nor all tables have to fit
+// in cache at once. tracker, if given, advances by one per voxel of every
+// histogram, and once it is cancelled the remaining blocks are skipped; the
+// caller throws.
+template <typename Count>
+void FillHistogramTiles(const std::vector<const uint8_t *> &fields,
+                        const std::vector<std::pair<size_t, size_t>> &pairs,
+                        size_t size, size_t blockSize,
+                        std::vector<Count> &joints,
+                        std::vector<std::vector<Count>> *marginals,
+                        ProgressTracker *tracker) {
+  using std::vector;
+  const auto fieldNum = fields.size();
+  assert(joints.size() == pairs.size() * JointBucketNum);
+  assert(marginals == nullptr || marginals->size() == fieldNum);
+
+  // enough pairs per tile to keep every thread busy
+#ifdef _OPENMP
+  const auto threadNum = static_cast<size_t>(omp_get_max_threads());
+#else
+  const auto threadNum = static_cast<size_t>(1);
+#endif
+  auto groupSize = MutualInformationTileFields;
+  while (groupSize * groupSize < threadNum) {
+    groupSize++;
+  }
+  const auto groupNum = (fieldNum + groupSize - 1) / groupSize;
+  auto tileOf = [&](const std::pair<size_t, size_t> &pair) {
+    const auto a = std::min(pair.first, pair.second) / groupSize;
+    const auto b = std::max(pair.first, pair.second) / groupSize;
+    return a * groupNum + b;
+  };
+
+  // a task is one pair's joint histogram or, in the tile of a group with
+  // itself, one of the group's marginals
+  vector<vector<int64_t>> tiles(groupNum * groupNum);
+  for (size_t p = 0; p < pairs.size(); p++) {
+    tiles[tileOf(pairs[p])].push_back(static_cast<int64_t>(p));
+  }
+  if (marginals != nullptr) {
+    for (size_t i = 0; i < fieldNum; i++) {
+      const auto group = i / groupSize;
+      tiles[group * groupNum + group].push_back(-1 - static_cast<int64_t>(i));
+    }
+  }
+
+#pragma omp parallel
+  for (auto &tasks : tiles) {
+    const auto taskNum = static_cast<int64_t>(tasks.size());
+    for (size_t begin = 0; begin < size && taskNum > 0; begin += blockSize) {
+      VOLCORRELATION_TRACE_SCOPE("joint histogram block");
+      const auto end = std::min(begin + blockSize, size);
+      // the barrier at the end of the loop keeps all threads on this block
+#pragma omp for schedule(dynamic)
+      for (int64_t task = 0; task < taskNum; task++) {
+        // every thread still walks all blocks, so the work sharing stays in
+        // step
+        if (tracker != nullptr && tracker->cancelled()) {
+          continue;
+        }
+        const auto id = tasks[task];
+        if (id < 0) {
+          auto field = fields[-1 - id];
+          auto counts = (*marginals)[-1 - id].data();
+          for (size_t idx = begin; idx < end; idx++) {
+            counts[field[idx]] += 1;
+          }
+        } else {
+          const auto &pair = pairs[id];
+          CountJoint(fields[pair.first] + begin, fields[pair.second] + begin,
+                     end - begin, joints.data() + id * JointBucketNum);
+        }
+        if (tracker != nullptr) {
+          tracker->advance(end - begin);
+        }
+      }
+    }
+  }
+}
+
+// joint histograms of the given field pairs only, flat with one
+// JointBucketNum block per pair in their order; tracker works as in
+// FillHistogramTiles
+template <typename Count>
+void FillJointHistograms(const std::vector<const uint8_t *> &fields,
+                         const std::vector<std::pair<size_t, size_t>> &pairs,
+                         size_t size, size_t blockSize,
+                         std::vector<Count> &joints,
+                         ProgressTracker *tracker = nullptr) {
+  VOLCORRELATION_TRACE_SCOPE("joint histograms");
+  VOLCORRELATION_TRACE_COUNT("joint histogram voxels", size * pairs.size());
+  joints.assign(pairs.size() * JointBucketNum, 0);
+  FillHistogramTiles<Count>(fields, pairs, size, blockSize, joints, nullptr,
+                            tracker);
+}
+
+// every pair i < j of fieldNum fields in row order
+inline std::vector<std::pair<size_t, size_t>> AllPairs(size_t fieldNum) {
+  std::vector<std::pair<size_t, size_t>> pairs;
+  for (size_t i = 0; i < fieldNum; i++) {
+    for (size_t j = i + 1; j < fieldNum; j++) {
+      pairs.emplace_back(i, j);
+    }
+  }
+  return pairs;
+}
+
+// histograms of every field, noise removed, and joint histograms of every
+// pair i < j in row order; tracker works as in FillHistogramTiles
+template <typename Count>
+void FillAllJointHistograms(const std::vector<const uint8_t *> &fields,
+                            size_t size, size_t blockSize,
+                            std::vector<Counts> &histograms,
+                            std::vector<Count> &joints,
+                            ProgressTracker *tracker = nullptr) {
+  VOLCORRELATION_TRACE_SCOPE("joint histograms");
+  const auto fieldNum = fields.size();
+  const auto pairs = AllPairs(fieldNum);
+  VOLCORRELATION_TRACE_COUNT("histogram voxels", size * fieldNum);
+  VOLCORRELATION_TRACE_COUNT("joint histogram voxels", size * pairs.size());
+  joints.assign(pairs.size() * JointBucketNum, 0);
+  std::vector<std::vector<Count>> marginals(
+      fieldNum, std::vector<Count>(BucketNum + 1, 0));
+  FillHistogramTiles<Count>(fields, pairs, size, blockSize, joints,
+                            &marginals, tracker);
+
+  histograms.resize(fieldNum);
+  for (size_t i = 0; i < fieldNum; i++) {
+    histograms[i].assign(marginals[i].begin(), marginals[i].end());
+    RemoveNoise(histograms[i]);
+  }
+}
+
+// entropies and MI of result's histograms and the joint histograms of every
+// pair i < j in row order
+template <typename Count>
+void FillMatrix(MutualInformationMatrix &result,
+                const std::vector<Count> &joints, size_t size) {
+  const auto fieldNum = result.histograms.size();
+  result.entropies.resize(fieldNum);
+  result.mi.resize(fieldNum, std::vector<double>(fieldNum, 0.0));
+  for (size_t i = 0; i < fieldNum; i++) {
+    result.entropies[i] = CalculateEntropy(result.histograms[i], size);
+    result.mi[i][i] = result.entropies[i];
+  }
+
+  size_t pair = 0;
+  for (size_t i = 0; i < fieldNum; i++) {
+    for (size_t j = i + 1; j < fieldNum; j++) {
+      const auto I = CalculateMutationInformation(
+          joints.data() + pair * JointBucketNum, result.histograms[i],
+          result.histograms[j], size);
+      result.mi[i][j] = I;
+      result.mi[j][i] = I;
+      pair++;
+    }
+  }
+}
+
+template <typename Count>
+MutualInformationMatrix
+CalculateMutualInformationMatrix(const std::vector<const uint8_t *> &fields,
+                                 size_t size, size_t blockSize,
+                                 const Progress &progress) {
+  MutualInformationMatrix result;
+  const auto fieldNum = fields.size();
+
+  std::vector<Count> joints;
+  ProgressTracker tracker(progress,
+                          size * (fieldNum + fieldNum * (fieldNum - 1) / 2));
+  FillAllJointHistograms(fields, size, blockSize, result.histograms, joints,
+                         &tracker);
+  tracker.throwIfCancelled();
+  FillMatrix(result, joints, size);
+  return result;
+}
+
+template <typename Count, typename T>
+MutualInformationMatrix
+CountConvertedMutualInformation(const std::vector<const T *> &fields,
+                                size_t size, size_t chunkSize,
+                                const Progress &progress) {
+  VOLCORRELATION_TRACE_SCOPE("joint histograms");
+  const auto fieldNum = fields.size();
+  const auto pairs = AllPairs(fieldNum);
+  VOLCORRELATION_TRACE_COUNT("histogram voxels", size * fieldNum);
+  VOLCORRELATION_TRACE_COUNT("joint histogram voxels", size * pairs.size());
+  // every chunk is bucketed by the range of its whole field
+  std::vector<VolCorrelation::ValueRange<std::remove_const_t<T>>> ranges;
+  for (auto field : fields) {
+    ranges.push_back(VolCorrelation::valueRange(field, size));
+  }
+
+  std::vector<Count> joints(pairs.size() * JointBucketNum, 0);
+  std::vector<std::vector<Count>> marginals(
+      fieldNum, std::vector<Count>(BucketNum + 1, 0));
+  chunkSize = std::max<size_t>(1, std::min(chunkSize, size));
+  std::vector<std::vector<uint8_t>> chunks(fieldNum,
+                                           std::vector<uint8_t>(chunkSize));
+  std::vector<const uint8_t *> chunkFields;
+  for (auto &chunk : chunks) {
+    chunkFields.push_back(chunk.data());
+  }
+  ProgressTracker tracker(progress, size * (fieldNum + pairs.size()));
+  for (size_t begin = 0; begin < size; begin += chunkSize) {
+    const auto count = std::min(chunkSize, size - begin);
+    for (size_t i = 0; i < fieldNum; i++) {
+      ConvertData(fields[i] + begin, count, ranges[i], chunks[i].data());
+    }
+    FillHistogramTiles<Count>(chunkFields, pairs, count,
+                              MutualInformationBlockSize, joints, &marginals,
+                              &tracker);
+    tracker.throwIfCancelled();
+  }
+
+  MutualInformationMatrix result;
+  result.histograms.resize(fieldNum);
+  for (size_t i = 0; i < fieldNum; i++) {
+    result.histograms[i].assign(marginals[i].begin(), marginals[i].end());
+    RemoveNoise(result.histograms[i]);
+  }
+  FillMatrix(result, joints, size);
+  return result;
+}
+
+// MI of every field pair and the entropy of every field, streaming each
+// voxel block of a group of fields once for all pairs of its tiles instead
+// of once per pair. Keeps one joint histogram per pair, 256 KB each for
+// volumes below 4G voxels. Throws OperationCancelled when progress.token is
+// cancelled.
+inline MutualInformationMatrix
+CalculateMutualInformationMatrix(const std::vector<const uint8_t *> &fields,
+                                 size_t size,
+                                 size_t blockSize = MutualInformationBlockSize,
+                                 const Progress &progress = {}) {
+  assert(size != 0);
+  if (size <= std::numeric_limits<uint32_t>::max()) {
+    return CalculateMutualInformationMatrix<uint32_t>(fields, size, blockSize,
+                                                      progress);
+  }
+  return CalculateMutualInformationMatrix<size_t>(fields, size, blockSize,
+                                                  progress);
+}
+
+inline MutualInformationMatrix
+CalculateMutualInformationMatrix(const std::vector<const uint8_t *> &fields,
+                                 size_t size, const Progress &progress) {
+  return CalculateMutualInformationMatrix(fields, size,
+                                          MutualInformationBlockSize, progress);
+}
+
+// bytes CalculateConvertedMutualInformationMatrix holds besides the fields:
+// the joint and marginal tables and a uint8 chunk of every field
+inline size_t EstimateMutualInformationMemory(size_t fieldNum, size_t size,
+                                              size_t chunkSize) {
+  const auto count =
+      size <= std::numeric_limits<uint32_t>::max() ? sizeof(uint32_t)
+                                                   : sizeof(size_t);
+  const auto pairNum = fieldNum * (fieldNum - 1) / 2;
+  return (pairNum * JointBucketNum + fieldNum * (BucketNum + 1)) * count +
+         fieldNum * std::min(chunkSize, size);
+}
+
+// MI of every field pair and the entropy of every field for fields of any
+// type, bucketed as ConvertData buckets each whole field. Fields are
+// converted and counted chunkSize voxels at a time, so the uint8 copies take
+// fieldNum * chunkSize bytes instead of a copy of every field. Throws
+// OperationCancelled when progress.token is cancelled.
+template <typename T>
+MutualInformationMatrix
+CalculateConvertedMutualInformationMatrix(const std::vector<const T *> &fields,
+                                          size_t size, size_t chunkSize,
+                                          const Progress &progress = {}) {
+  assert(size != 0);
+  if (size <= std::numeric_limits<uint32_t>::max()) {
+    return CountConvertedMutualInformation<uint32_t>(fields, size, chunkSize,
+                                                     progress);
+  }
+  return CountConvertedMutualInformation<size_t>(fields, size, chunkSize,
+                                                 progress);
+}
+
+} // namespace Info
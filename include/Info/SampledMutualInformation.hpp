@@ -0,0 +1,320 @@
+#pragma once
+
+#include "MutualInformation.hpp"
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace Info {
+
+struct SampledMutualInformationOptions {
+  // stop once every pair's error bound is at most this, in nats
+  double tolerance = 0.01;
+  // stop after the round that exceeds this many seconds
+  double timeBudget = 0.1;
+  // samples of the first round, every further round doubles the total; far
+  // fewer samples than the 65536 joint bins leave the bias underestimated
+  size_t initialSamples = 64 * 1024;
+  // upper limit of samples, 0 means the voxel count
+  size_t maxSamples = 0;
+  // interleaved sample groups the error bound is estimated from, at least 2
+  size_t replicates = 8;
+  // seed of the stratified jitter, equal seeds give equal estimates
+  uint64_t seed = 0x5EED;
+};
+
+struct ApproximateMutualInformationMatrix {
+  // Miller-Madow corrected estimates, symmetric, the diagonal holds the
+  // entropy of each field
+  std::vector<std::vector<double>> mi;
+  // about 95% bound of |estimate - exact| for every entry
+  std::vector<std::vector<double>> errorBounds;
+  size_t samples = 0;
+  double seconds = 0.0;
+  // every bound reached the tolerance
+  bool converged = false;
+};
+
+struct MutualInformationEstimate {
+  double value = 0.0;
+  double errorBound = 0.0;
+  size_t samples = 0;
+};
+
+inline uint64_t SplitMix64(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ull;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+}
+
+// count voxels of [0, size), one uniformly jittered voxel per equal stratum,
+// so every region of the volume is covered at any sample count
+inline void StratifiedSamples(size_t size, size_t count, uint64_t seed,
+                              std::vector<size_t> &indices) {
+  indices.resize(count);
+  const auto stride = static_cast<double>(size) / count;
+  for (size_t s = 0; s < count; s++) {
+    const auto begin = static_cast<size_t>(s * stride);
+    const auto end = std::min(
+        size, std::max(begin + 1, static_cast<size_t>((s + 1) * stride)));
+    const auto jitter = SplitMix64(seed ^ (s * 0xD6E8FEB86659FD93ull));
+    indices[s] = begin + jitter % (end - begin);
+  }
+}
+
+// values RemoveNoise folds into bucket 0 of a field's histogram
+using NoiseMask = std::array<bool, BucketNum + 1>;
+
+inline NoiseMask NoiseValues(const Counts &histogram) {
+  NoiseMask noise{};
+  for (size_t value = 1; value < noise.size(); value++) {
+    noise[value] = histogram[value] == 0;
+  }
+  return noise;
+}
+
+// plug-in estimates from sample counts with the Miller-Madow bias
+// correction (occupied bins - 1) / 2n per entropy term. Noise values are
+// treated as the exact path treats them: folded into bucket 0 of the
+// marginals, their joint bins left out of the sum.
+struct SampleEstimator {
+  std::vector<uint32_t> joint = std::vector<uint32_t>(JointBucketNum, 0);
+  std::vector<uint32_t> a = std::vector<uint32_t>(BucketNum + 1, 0);
+  std::vector<uint32_t> b = std::vector<uint32_t>(BucketNum + 1, 0);
+  std::vector<uint16_t> touched;
+  size_t n = 0;
+
+  void Add(uint8_t x, uint8_t y, const NoiseMask &noiseA,
+           const NoiseMask &noiseB) {
+    a[noiseA[x] ? 0 : x] += 1;
+    b[noiseB[y] ? 0 : y] += 1;
+    n += 1;
+    if (noiseA[x] || noiseB[y]) {
+      return;
+    }
+    const auto key = static_cast<uint16_t>((x << 8) | y);
+    if (joint[key]++ == 0) {
+      touched.push_back(key);
+    }
+  }
+
+  static size_t Occupied(const std::vector<uint32_t> &counts) {
+    size_t occupied = 0;
+    for (auto count : counts) {
+      occupied += count != 0;
+    }
+    return occupied;
+  }
+
+  double Correction() const {
+    const auto occupied = static_cast<double>(Occupied(a)) + Occupied(b) -
+                          static_cast<double>(touched.size()) - 1.0;
+    return occupied / (2.0 * n);
+  }
+
+  double MutualInformation() const {
+    auto mi = 0.0;
+    for (auto key : touched) {
+      const auto count = static_cast<double>(joint[key]);
+      const auto expected = static_cast<double>(a[key >> 8]) * b[key & 0xff];
+      mi += count / n * log(count * n / expected);
+    }
+    return std::max(mi + Correction(), 0.0);
+  }
+
+  double Entropy() const {
+    auto entropy = 0.0;
+    for (auto count : a) {
+      if (count == 0) {
+        continue;
+      }
+      const auto prob = static_cast<double>(count) / n;
+      entropy -= prob * log(prob);
+    }
+    return entropy + (Occupied(a) - 1.0) / (2.0 * n);
+  }
+
+  void Clear() {
+    for (auto key : touched) {
+      joint[key] = 0;
+    }
+    touched.clear();
+    std::fill(a.begin(), a.end(), 0);
+    std::fill(b.begin(), b.end(), 0);
+    n = 0;
+  }
+};
+
+// estimate and error bound of one pair (or of one field's entropy when a
+// and b are the same) from the first n samples. The bound is 1.96 standard
+// errors from the spread of the replicate groups plus the remaining bias:
+// the bias falls like 1/samples, so the estimate from every other sample
+// differs from the full one by about the bias of the full one
+template <typename Estimate>
+std::pair<double, double>
+EstimateWithBound(const uint8_t *a, const uint8_t *b, const NoiseMask &noiseA,
+                  const NoiseMask &noiseB, size_t n, size_t replicates,
+                  std::vector<SampleEstimator> &estimators, Estimate estimate) {
+  // estimators[0] takes every sample, [1] every other one, [2, replicates + 2)
+  // the interleaved replicate groups
+  for (auto &estimator : estimators) {
+    estimator.Clear();
+  }
+  for (size_t s = 0; s < n; s++) {
+    estimators[0].Add(a[s], b[s], noiseA, noiseB);
+    if (s % 2 == 0) {
+      estimators[1].Add(a[s], b[s], noiseA, noiseB);
+    }
+    estimators[2 + s % replicates].Add(a[s], b[s], noiseA, noiseB);
+  }
+
+  const auto value = estimate(estimators[0]);
+  auto mean = 0.0;
+  std::vector<double> values(replicates);
+  for (size_t r = 0; r < replicates; r++) {
+    values[r] = estimate(estimators[r + 2]);
+    mean += values[r] / replicates;
+  }
+  auto variance = 0.0;
+  for (auto v : values) {
+    variance += (v - mean) * (v - mean);
+  }
+  variance /= static_cast<double>(replicates) * (replicates - 1);
+  const auto bias = std::abs(estimate(estimators[1]) - value);
+  return {value, 1.96 * std::sqrt(variance) + bias};
+}
+
+// approximate MI of every field pair from stratified voxel samples. Rounds
+// double the sample count until every error bound is within the tolerance,
+// the time budget is used up, maxSamples is reached or refined returns
+// false; refined receives the estimate after every round. The spread of the
+// estimate shrinks like 1/sqrt(samples) and its bias like 1/samples; on noisy
+// 8 bit fields the bias dominates at 64K samples (tenths of a nat above the
+// exact value), which the error bound accounts for. histograms are the
+// fields' CountValue histograms, the noise values they removed are removed
+// from the samples too, so the estimate converges to the exact matrix.
+inline ApproximateMutualInformationMatrix
+CalculateApproximateMutualInformationMatrix(
+    const std::vector<const uint8_t *> &fields, size_t size,
+    const std::vector<Counts> &histograms,
+    const SampledMutualInformationOptions &options = {},
+    const std::function<bool(const ApproximateMutualInformationMatrix &)>
+        &refined = {}) {
+  using clock = std::chrono::steady_clock;
+  assert(size != 0 && histograms.size() == fields.size());
+  VOLCORRELATION_TRACE_SCOPE("sampled mutual information");
+  const auto start = clock::now();
+  const auto fieldNum = fields.size();
+  const auto replicates = std::max<size_t>(options.replicates, 2);
+  const auto maxSamples =
+      options.maxSamples == 0 ? size : std::min(options.maxSamples, size);
+
+  ApproximateMutualInformationMatrix result;
+  result.mi.assign(fieldNum, std::vector<double>(fieldNum, 0.0));
+  result.errorBounds.assign(fieldNum, std::vector<double>(fieldNum, 0.0));
+
+  std::vector<NoiseMask> noise(fieldNum);
+  for (size_t i = 0; i < fieldNum; i++) {
+    noise[i] = NoiseValues(histograms[i]);
+  }
+
+  // samples of every field, in the order they were drawn
+  std::vector<std::vector<uint8_t>> samples(fieldNum);
+  std::vector<size_t> indices;
+  std::vector<std::pair<size_t, size_t>> pairs;
+  for (size_t i = 0; i < fieldNum; i++) {
+    for (size_t j = i; j < fieldNum; j++) {
+      pairs.emplace_back(i, j);
+    }
+  }
+
+  auto round = static_cast<uint64_t>(0);
+  auto count = std::min(options.initialSamples, maxSamples);
+  while (true) {
+    StratifiedSamples(size, count, SplitMix64(options.seed + round), indices);
+    for (size_t f = 0; f < fieldNum; f++) {
+      auto field = fields[f];
+      auto &sample = samples[f];
+      for (auto idx : indices) {
+        sample.push_back(field[idx]);
+      }
+    }
+    result.samples += count;
+
+#pragma omp parallel
+    {
+      std::vector<SampleEstimator> estimators(replicates + 2);
+#pragma omp for schedule(dynamic)
+      for (int64_t p = 0; p < static_cast<int64_t>(pairs.size()); p++) {
+        const auto i = pairs[p].first, j = pairs[p].second;
+        const auto a = samples[i].data(), b = samples[j].data();
+        const auto estimate =
+            i == j ? EstimateWithBound(
+                         a, b, noise[i], noise[j], result.samples, replicates,
+                         estimators,
+                         [](const SampleEstimator &e) { return e.Entropy(); })
+                   : EstimateWithBound(a, b, noise[i], noise[j],
+                                       result.samples, replicates, estimators,
+                                       [](const SampleEstimator &e) {
+                                         return e.MutualInformation();
+                                       });
+        result.mi[i][j] = result.mi[j][i] = estimate.first;
+        result.errorBounds[i][j] = result.errorBounds[j][i] = estimate.second;
+      }
+    }
+
+    auto maxBound = 0.0;
+    for (auto &row : result.errorBounds) {
+      for (auto bound : row) {
+        maxBound = std::max(maxBound, bound);
+      }
+    }
+    result.converged = maxBound <= options.tolerance;
+    result.seconds =
+        std::chrono::duration<double>(clock::now() - start).count();
+
+    const auto next = std::min(result.samples, maxSamples - result.samples);
+    if ((refined && !refined(result)) || result.converged ||
+        result.seconds >= options.timeBudget || next == 0) {
+      return result;
+    }
+    count = next;
+    round++;
+  }
+}
+
+// histograms counted here, one pass over every field
+inline ApproximateMutualInformationMatrix
+CalculateApproximateMutualInformationMatrix(
+    const std::vector<const uint8_t *> &fields, size_t size,
+    const SampledMutualInformationOptions &options = {},
+    const std::function<bool(const ApproximateMutualInformationMatrix &)>
+        &refined = {}) {
+  std::vector<Counts> histograms;
+  for (auto field : fields) {
+    histograms.push_back(CountValue(field, size));
+  }
+  return CalculateApproximateMutualInformationMatrix(fields, size, histograms,
+                                                     options, refined);
+}
+
+// approximate MI of one pair, see CalculateApproximateMutualInformationMatrix
+inline MutualInformationEstimate
+EstimateMutualInformation(const uint8_t *fieldA, const uint8_t *fieldB,
+                          size_t size,
+                          const SampledMutualInformationOptions &options = {}) {
+  const auto matrix = CalculateApproximateMutualInformationMatrix(
+      {fieldA, fieldB}, size, options);
+  MutualInformationEstimate estimate;
+  estimate.value = matrix.mi[0][1];
+  estimate.errorBound = matrix.errorBounds[0][1];
+  estimate.samples = matrix.samples;
+  return estimate;
+}
+
+} // namespace Info
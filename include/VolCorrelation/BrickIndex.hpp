@@ -0,0 +1,111 @@
+#pragma once
+#include "Common.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+namespace VolCorrelation {
+
+// edge of a brick in voxels; 8^3 keeps the index at 1/256 of a float field
+constexpr uint32_t BrickSize = 8;
+
+// minimum and maximum value of every brick of a field, read through
+// operator[] like the kernels read it (a pointer or a NormalizedField), so
+// that a box of voxels can be recognized as constant without reading it.
+// A brick holding a NaN is never constant.
+template <typename Value> class BrickIndex {
+public:
+  BrickIndex() = default;
+
+  template <typename Field>
+  BrickIndex(const Field &field, const Vec3<uint32_t> &dimensions)
+      : dimensions(dimensions),
+        bricks((dimensions.x + BrickSize - 1) / BrickSize,
+               (dimensions.y + BrickSize - 1) / BrickSize,
+               (dimensions.z + BrickSize - 1) / BrickSize) {
+    const auto brickNum = static_cast<size_t>(bricks.x) * bricks.y * bricks.z;
+    mins.resize(brickNum);
+    maxs.resize(brickNum);
+    const auto offsetZ = static_cast<size_t>(dimensions.x) * dimensions.y;
+    const auto rowNum = static_cast<int64_t>(bricks.y) * bricks.z;
+
+    // a brick row at a time, which reads whole voxel rows
+#pragma omp parallel for schedule(static)
+    for (int64_t row = 0; row < rowNum; row++) {
+      const auto by = static_cast<uint32_t>(row % bricks.y);
+      const auto bz = static_cast<uint32_t>(row / bricks.y);
+      const auto first = static_cast<size_t>(row) * bricks.x;
+      std::fill_n(mins.begin() + first, bricks.x,
+                  std::numeric_limits<Value>::max());
+      std::fill_n(maxs.begin() + first, bricks.x,
+                  std::numeric_limits<Value>::lowest());
+      const auto zEnd = std::min((bz + 1) * BrickSize, dimensions.z);
+      const auto yEnd = std::min((by + 1) * BrickSize, dimensions.y);
+      for (auto z = bz * BrickSize; z < zEnd; z++) {
+        for (auto y = by * BrickSize; y < yEnd; y++) {
+          const auto line = z * offsetZ + static_cast<size_t>(y) * dimensions.x;
+          for (uint32_t x = 0; x < dimensions.x; x++) {
+            const auto value = static_cast<Value>(field[line + x]);
+            auto &min = mins[first + x / BrickSize];
+            auto &max = maxs[first + x / BrickSize];
+            if (value != value) {
+              min = std::numeric_limits<Value>::lowest();
+              max = std::numeric_limits<Value>::max();
+            }
+            min = value < min ? value : min;
+            max = value > max ? value : max;
+          }
+        }
+      }
+    }
+  }
+
+  // whether every voxel of the box [begin, end) holds value
+  auto constantAt(const Vec3<uint32_t> &begin, const Vec3<uint32_t> &end,
+                  Value value) const -> bool {
+    for (auto bz = begin.z / BrickSize; bz * BrickSize < end.z; bz++) {
+      for (auto by = begin.y / BrickSize; by * BrickSize < end.y; by++) {
+        auto brick = (static_cast<size_t>(bz) * bricks.y + by) * bricks.x +
+                     begin.x / BrickSize;
+        for (auto bx = begin.x / BrickSize; bx * BrickSize < end.x;
+             bx++, brick++) {
+          if (mins[brick] != value || maxs[brick] != value) {
+            return false;
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  // whether every voxel of the box [begin, end) holds the same value
+  auto constant(const Vec3<uint32_t> &begin, const Vec3<uint32_t> &end) const
+      -> bool {
+    const auto first =
+        (static_cast<size_t>(begin.z / BrickSize) * bricks.y +
+         begin.y / BrickSize) *
+            bricks.x +
+        begin.x / BrickSize;
+    return constantAt(begin, end, mins[first]);
+  }
+
+  // the voxels [x0 - halo, x1 + halo) of the rows y - halo .. y + halo of the
+  // slices z - halo .. z + halo, clamped to the volume: what a stencil or
+  // window of radius halo reads for the voxels [x0, x1) of row (y, z)
+  auto neighborhood(uint32_t x0, uint32_t x1, uint32_t y, uint32_t z,
+                    uint32_t halo, Vec3<uint32_t> &begin,
+                    Vec3<uint32_t> &end) const -> void {
+    begin = Vec3<uint32_t>(x0 > halo ? x0 - halo : 0, y > halo ? y - halo : 0,
+                           z > halo ? z - halo : 0);
+    end = Vec3<uint32_t>(std::min(x1 + halo, dimensions.x),
+                         std::min(y + halo + 1, dimensions.y),
+                         std::min(z + halo + 1, dimensions.z));
+  }
+
+private:
+  Vec3<uint32_t> dimensions;
+  Vec3<uint32_t> bricks;
+  std::vector<Value> mins, maxs;
+};
+
+} // namespace VolCorrelation
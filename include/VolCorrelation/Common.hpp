@@ -0,0 +1,175 @@
+#pragma once
+#include "FieldRange.hpp"
+#include "Progress.hpp"
+#include "Trace.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+namespace VolCorrelation {
+
+template <typename T> struct Vec3 {
+  T x, y, z;
+  Vec3() : x(0), y(0), z(0) {}
+  Vec3(T a, T b, T c) : x(a), y(b), z(c) {}
+  auto norm() const -> T { return std::sqrt(x * x + y * y + z * z); }
+};
+
+template <typename T>
+auto fieldMax(const T *field, size_t size) -> std::remove_const_t<T> {
+  return valueRange(field, size).max;
+}
+
+// scale field into [0, 1] by its maximum value
+template <typename T, typename ResultType>
+auto normalizeField(const T *field, size_t size) -> std::vector<ResultType> {
+  VOLCORRELATION_TRACE_SCOPE("normalize");
+  std::vector<ResultType> normalized(size);
+  const auto max = fieldMax(field, size);
+  for (size_t idx = 0; idx < size; idx++) {
+    normalized[idx] = static_cast<ResultType>(field[idx]) / max;
+  }
+  return normalized;
+}
+
+// a raw field read as if it were normalized, each value is divided by the
+// maximum when it is read instead of being stored as a normalized copy
+template <typename T, typename ResultType> struct NormalizedField {
+  const T *data = nullptr;
+  ResultType max = 1;
+
+  auto operator[](size_t idx) const -> ResultType {
+    return static_cast<ResultType>(data[idx]) / max;
+  }
+};
+
+template <typename T, typename ResultType>
+auto normalizedField(const T *field, size_t size)
+    -> NormalizedField<T, ResultType> {
+  VOLCORRELATION_TRACE_SCOPE("normalize");
+  return {field, static_cast<ResultType>(fieldMax(field, size))};
+}
+
+// value type the kernels compute in for a field: a pointer to an already
+// normalized field or a NormalizedField
+template <typename Field> struct FieldValue;
+template <typename ResultType> struct FieldValue<const ResultType *> {
+  using type = ResultType;
+};
+template <typename T, typename ResultType>
+struct FieldValue<NormalizedField<T, ResultType>> {
+  using type = ResultType;
+};
+
+// n normalized values from idx; normalized fields are read in place, others
+// are normalized into scratch
+template <typename ResultType>
+auto fieldRow(const ResultType *field, size_t idx, size_t, ResultType *)
+    -> const ResultType * {
+  return field + idx;
+}
+
+template <typename T, typename ResultType>
+auto fieldRow(const NormalizedField<T, ResultType> &field, size_t idx, size_t n,
+              ResultType *scratch) -> const ResultType * {
+  for (size_t i = 0; i < n; i++) {
+    scratch[i] = field[idx + i];
+  }
+  return scratch;
+}
+
+// range of a result before it is quantized
+struct ResultRange {
+  double min = std::numeric_limits<double>::infinity();
+  double max = -std::numeric_limits<double>::infinity();
+
+  void add(double value) {
+    min = value < min ? value : min;
+    max = value > max ? value : max;
+  }
+  void merge(const ResultRange &other) {
+    min = other.min < min ? other.min : min;
+    max = other.max > max ? other.max : max;
+  }
+};
+
+// both measures lie in [0, 1]; integer outputs map it onto their full scale,
+// floating outputs keep the value
+template <typename Out, typename ResultType>
+auto encodeResult(ResultType value) -> Out {
+  if constexpr (std::is_floating_point<Out>::value) {
+    return static_cast<Out>(value);
+  } else {
+    const auto clamped =
+        std::min(std::max(static_cast<double>(value), 0.0), 1.0);
+    return static_cast<Out>(
+        std::lround(clamped * std::numeric_limits<Out>::max()));
+  }
+}
+
+// inverse of encodeResult, up to the quantization step
+template <typename Out> auto decodeResult(Out value) -> double {
+  if constexpr (std::is_floating_point<Out>::value) {
+    return static_cast<double>(value);
+  } else {
+    return static_cast<double>(value) / std::numeric_limits<Out>::max();
+  }
+}
+
+// a result written straight in its output type, with the range of the
+// values it was computed from
+template <typename Out> struct QuantizedResult {
+  std::vector<Out> values;
+  ResultRange range;
+};
+
+// a result's value in Out, with its range stretched onto the full scale and
+// truncated like Info::ConvertData does for a result computed in double;
+// floating outputs are stretched onto [0, 1]
+template <typename Out>
+auto stretchValue(double value, double min, double width) -> Out {
+  const auto stretched = std::min(std::max((value - min) / width, 0.0), 1.0);
+  if constexpr (std::is_floating_point<Out>::value) {
+    return static_cast<Out>(stretched);
+  } else {
+    return static_cast<Out>(stretched * std::numeric_limits<Out>::max());
+  }
+}
+
+// remaps a quantized result by its tracked range, the stretch Info::ConvertData
+// applies to a double result, in one pass; integer results go through a
+// table of their values. A constant result maps to 0.
+template <typename Out, typename In>
+auto stretchResult(const QuantizedResult<In> &result) -> std::vector<Out> {
+  VOLCORRELATION_TRACE_SCOPE("stretch");
+  const auto size = static_cast<int64_t>(result.values.size());
+  std::vector<Out> stretched(result.values.size(), Out(0));
+  const auto min = result.range.min;
+  const auto width = result.range.max - min;
+  if (!(width > 0)) {
+    return stretched;
+  }
+  if constexpr (std::is_floating_point<In>::value) {
+#pragma omp parallel for schedule(static)
+    for (int64_t idx = 0; idx < size; idx++) {
+      stretched[idx] =
+          stretchValue<Out>(decodeResult(result.values[idx]), min, width);
+    }
+  } else {
+    std::vector<Out> table(static_cast<size_t>(std::numeric_limits<In>::max()) +
+                           1);
+    for (size_t value = 0; value < table.size(); value++) {
+      table[value] =
+          stretchValue<Out>(decodeResult(static_cast<In>(value)), min, width);
+    }
+#pragma omp parallel for schedule(static)
+    for (int64_t idx = 0; idx < size; idx++) {
+      stretched[idx] = table[result.values[idx]];
+    }
+  }
+  return stretched;
+}
+
+} // namespace VolCorrelation
@@ -0,0 +1,108 @@
+#pragma once
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||            \
+    defined(_M_IX86)
+#define VOLCORRELATION_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// kernels for wider instruction sets are compiled with a per-function target,
+// so the library builds with the baseline flags and picks the implementation
+// from cpuid at runtime. MSVC accepts any intrinsic without a target.
+#if defined(__GNUC__) || defined(__clang__)
+#define VOLCORRELATION_TARGET(isa) __attribute__((target(isa)))
+#else
+#define VOLCORRELATION_TARGET(isa)
+#endif
+
+namespace VolCorrelation {
+
+// ordered, every level implies the ones below it
+enum class Isa { Scalar = 0, AVX2 = 1, AVX512 = 2 };
+
+inline auto isaName(Isa isa) -> const char * {
+  switch (isa) {
+  case Isa::AVX2:
+    return "avx2";
+  case Isa::AVX512:
+    return "avx512";
+  default:
+    return "scalar";
+  }
+}
+
+// widest instruction set supported by both the cpu and the os
+inline auto detectIsa() -> Isa {
+#if !defined(VOLCORRELATION_X86)
+  return Isa::Scalar;
+#elif defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return Isa::Scalar;
+  }
+  __cpuid(info, 1);
+  const auto osxsave = (info[2] & (1 << 27)) != 0;
+  const auto avx = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx) {
+    return Isa::Scalar;
+  }
+  // the os must save the ymm (and for avx512 the zmm/opmask) state
+  const auto xcr0 = _xgetbv(0);
+  __cpuidex(info, 7, 0);
+  const auto avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+  const auto avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+  if (avx2 && avx512) {
+    return Isa::AVX512;
+  }
+  return avx2 ? Isa::AVX2 : Isa::Scalar;
+#else
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("avx2")) {
+    return Isa::Scalar;
+  }
+  return __builtin_cpu_supports("avx512f") ? Isa::AVX512 : Isa::AVX2;
+#endif
+}
+
+namespace dispatch {
+inline auto selectedIsa() -> std::atomic<int> & {
+  static std::atomic<int> isa{[] {
+    auto isa = detectIsa();
+    // VOLCORRELATION_ISA=scalar|avx2|avx512 caps the detected level
+    if (auto name = std::getenv("VOLCORRELATION_ISA")) {
+      auto cap = Isa::AVX512;
+      if (std::strcmp(name, "scalar") == 0) {
+        cap = Isa::Scalar;
+      } else if (std::strcmp(name, "avx2") == 0) {
+        cap = Isa::AVX2;
+      }
+      isa = cap < isa ? cap : isa;
+    }
+    return static_cast<int>(isa);
+  }()};
+  return isa;
+}
+} // namespace dispatch
+
+// implementation used by the dispatched kernels
+inline auto activeIsa() -> Isa {
+  return static_cast<Isa>(
+      dispatch::selectedIsa().load(std::memory_order_relaxed));
+}
+
+// forces a level, clamped to what the cpu supports; returns the level set
+inline auto setActiveIsa(Isa isa) -> Isa {
+  const auto detected = detectIsa();
+  isa = isa < detected ? isa : detected;
+  dispatch::selectedIsa().store(static_cast<int>(isa),
+                                std::memory_order_relaxed);
+  return isa;
+}
+
+} // namespace VolCorrelation
@@ -0,0 +1,166 @@
+#pragma once
+#include "CpuDispatch.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+namespace VolCorrelation {
+
+template <typename T> struct ValueRange {
+  T min, max;
+};
+
+template <typename T>
+auto valueRangeScalar(const T *data, size_t size, ValueRange<T> range)
+    -> ValueRange<T> {
+  for (size_t idx = 0; idx < size; idx++) {
+    const auto value = data[idx];
+    range.min = value < range.min ? value : range.min;
+    range.max = value > range.max ? value : range.max;
+  }
+  return range;
+}
+
+#ifdef VOLCORRELATION_X86
+VOLCORRELATION_TARGET("avx2")
+inline auto valueRangeAVX2(const uint8_t *data, size_t size,
+                           ValueRange<uint8_t> range) -> ValueRange<uint8_t> {
+  auto min = _mm256_set1_epi8(static_cast<char>(range.min));
+  auto max = _mm256_set1_epi8(static_cast<char>(range.max));
+  size_t idx = 0;
+  for (; idx + 32 <= size; idx += 32) {
+    const auto v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + idx));
+    min = _mm256_min_epu8(min, v);
+    max = _mm256_max_epu8(max, v);
+  }
+  alignas(32) uint8_t mins[32], maxs[32];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(mins), min);
+  _mm256_store_si256(reinterpret_cast<__m256i *>(maxs), max);
+  range = valueRangeScalar(mins, 32, range);
+  range = valueRangeScalar(maxs, 32, range);
+  return valueRangeScalar(data + idx, size - idx, range);
+}
+
+VOLCORRELATION_TARGET("avx2")
+inline auto valueRangeAVX2(const uint16_t *data, size_t size,
+                           ValueRange<uint16_t> range)
+    -> ValueRange<uint16_t> {
+  auto min = _mm256_set1_epi16(static_cast<short>(range.min));
+  auto max = _mm256_set1_epi16(static_cast<short>(range.max));
+  size_t idx = 0;
+  for (; idx + 16 <= size; idx += 16) {
+    const auto v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + idx));
+    min = _mm256_min_epu16(min, v);
+    max = _mm256_max_epu16(max, v);
+  }
+  alignas(32) uint16_t mins[16], maxs[16];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(mins), min);
+  _mm256_store_si256(reinterpret_cast<__m256i *>(maxs), max);
+  range = valueRangeScalar(mins, 16, range);
+  range = valueRangeScalar(maxs, 16, range);
+  return valueRangeScalar(data + idx, size - idx, range);
+}
+
+// min/max return their second operand when either is NaN, so the running
+// range goes second and NaN voxels are skipped as in valueRangeScalar
+VOLCORRELATION_TARGET("avx2")
+inline auto valueRangeAVX2(const float *data, size_t size,
+                           ValueRange<float> range) -> ValueRange<float> {
+  auto min = _mm256_set1_ps(range.min);
+  auto max = _mm256_set1_ps(range.max);
+  size_t idx = 0;
+  for (; idx + 8 <= size; idx += 8) {
+    const auto v = _mm256_loadu_ps(data + idx);
+    min = _mm256_min_ps(v, min);
+    max = _mm256_max_ps(v, max);
+  }
+  alignas(32) float mins[8], maxs[8];
+  _mm256_store_ps(mins, min);
+  _mm256_store_ps(maxs, max);
+  range = valueRangeScalar(mins, 8, range);
+  range = valueRangeScalar(maxs, 8, range);
+  return valueRangeScalar(data + idx, size - idx, range);
+}
+
+VOLCORRELATION_TARGET("avx2")
+inline auto valueRangeAVX2(const double *data, size_t size,
+                           ValueRange<double> range) -> ValueRange<double> {
+  auto min = _mm256_set1_pd(range.min);
+  auto max = _mm256_set1_pd(range.max);
+  size_t idx = 0;
+  for (; idx + 4 <= size; idx += 4) {
+    const auto v = _mm256_loadu_pd(data + idx);
+    min = _mm256_min_pd(v, min);
+    max = _mm256_max_pd(v, max);
+  }
+  alignas(32) double mins[4], maxs[4];
+  _mm256_store_pd(mins, min);
+  _mm256_store_pd(maxs, max);
+  range = valueRangeScalar(mins, 4, range);
+  range = valueRangeScalar(maxs, 4, range);
+  return valueRangeScalar(data + idx, size - idx, range);
+}
+#endif
+
+// types with a vector kernel, the others use the scalar loop
+template <typename T>
+constexpr bool HasVectorKernel =
+    std::is_same<T, uint8_t>::value || std::is_same<T, uint16_t>::value ||
+    std::is_same<T, float>::value || std::is_same<T, double>::value;
+
+template <typename T>
+auto valueRangeChunk(const T *data, size_t size, ValueRange<T> range)
+    -> ValueRange<T> {
+#ifdef VOLCORRELATION_X86
+  if constexpr (HasVectorKernel<T>) {
+    if (activeIsa() != Isa::Scalar) {
+      return valueRangeAVX2(data, size, range);
+    }
+  }
+#endif
+  return valueRangeScalar(data, size, range);
+}
+
+// smallest and largest value of a non-empty field, every thread reduces one
+// contiguous chunk
+template <typename T>
+auto valueRange(const T *data, size_t size)
+    -> ValueRange<std::remove_const_t<T>> {
+  using Value = std::remove_const_t<T>;
+  ValueRange<Value> range{data[0], data[0]};
+#ifdef _OPENMP
+  const auto threadNum = static_cast<size_t>(omp_get_max_threads());
+#else
+  const auto threadNum = static_cast<size_t>(1);
+#endif
+  std::vector<ValueRange<Value>> locals(threadNum, range);
+
+#pragma omp parallel num_threads(static_cast<int>(threadNum))
+  {
+#ifdef _OPENMP
+    const auto thread = static_cast<size_t>(omp_get_thread_num());
+    const auto teamSize = static_cast<size_t>(omp_get_num_threads());
+#else
+    const auto thread = static_cast<size_t>(0);
+    const auto teamSize = static_cast<size_t>(1);
+#endif
+    const auto chunk = size / teamSize, extra = size % teamSize;
+    const auto begin = chunk * thread + std::min(thread, extra);
+    const auto end = begin + chunk + (thread < extra ? 1 : 0);
+    locals[thread] = valueRangeChunk<Value>(data + begin, end - begin, range);
+  }
+
+  for (auto &local : locals) {
+    range.min = local.min < range.min ? local.min : range.min;
+    range.max = local.max > range.max ? local.max : range.max;
+  }
+  return range;
+}
+
+} // namespace VolCorrelation
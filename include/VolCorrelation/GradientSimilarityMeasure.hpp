@@ -1,43 +1,27 @@
 #pragma once
+#include "BrickIndex.hpp"
+#include "Common.hpp"
+#include "MappedVolume.hpp"
+#include "SobelKernel.hpp"
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
+#include <type_traits>
 #include <utility>
 #include <vector>
 #include <iostream>
 #include <omp.h>
 namespace VolCorrelation {
 
-#ifndef VolCorrelation_Vec3
-#define VolCorrelation_Vec3
-template <typename T> struct Vec3 {
-  T x, y, z;
-  Vec3() : x(0), y(0), z(0) {}
-  Vec3(T a, T b, T c) : x(a), y(b), z(c) {}
-  auto norm() const -> T { return std::sqrt(x * x + y * y + z * z); }
-};
-#endif
-
+// gradient of a single voxel; sobelGradientRow computes the same values, up
+// to rounding, a whole row at a time
 template <typename ResultType>
 auto calculateGradient(const ResultType *field, const Vec3<uint32_t> &pos,
                        const Vec3<uint32_t> dimensions, size_t index,
                        size_t offsetZ) -> Vec3<ResultType> {
-  static int kx[3][3][3] = {
-      {{1, 2, 1}, {2, 4, 2}, {1, 2, 1}},
-      {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}},
-      {{-1, -2, -2}, {-2, -4, -2}, {-1, -2, -1}},
-  };
-
-  static int ky[3][3][3] = {
-      {{1, 2, 1}, {0, 0, 0}, {-1, -2, -1}},
-      {{2, 4, 2}, {0, 0, 0}, {-2, -4, -2}},
-      {{1, 2, 1}, {0, 0, 0}, {-1, -2, -1}},
-  };
-
-  static int kz[3][3][3] = {
-      {{1, 0, -1}, {2, 0, -2}, {1, 0, -1}},
-      {{2, 0, -2}, {4, 0, -4}, {2, 0, -2}},
-      {{1, 0, -1}, {2, 0, -2}, {1, 0, -1}},
-  };
+  const auto &kx = SobelKernelX;
+  const auto &ky = SobelKernelY;
+  const auto &kz = SobelKernelZ;
 
   const auto maxX = dimensions.x;
   const auto maxY = dimensions.y;
@@ -93,8 +77,8 @@ auto calculatePairSimilarity(const Vec3<ResultType> &gi,
     return 0.0;
   }
 
-  if (abs(gi.x - gj.x) < 1e-9 && abs(gi.y - gj.y) < 1e-9 &&
-      abs(gi.z - gj.z) < 1e-9) {
+  if (std::abs(gi.x - gj.x) < 1e-9 && std::abs(gi.y - gj.y) < 1e-9 &&
+      std::abs(gi.z - gj.z) < 1e-9) {
     return 1.0;
   }
 
@@ -107,65 +91,345 @@ auto calculatePairSimilarity(const Vec3<ResultType> &gi,
   return pow(result, sensitivity);
 }
 
-template <typename T, typename ResultType = double>
-auto calculateGradientSimilarity(const std::vector<T *> fields, uint32_t width,
-                                 uint32_t height, uint32_t depth,
-                                 int sensitivity = 2)
-    -> std::vector<ResultType> {
-  using std::vector;
+// gradient of one normalized field, stored per component so that it can be
+// computed once and reused by every pair the field takes part in
+template <typename ResultType> struct GradientVolume {
+  Vec3<uint32_t> dimensions;
+  std::vector<ResultType> x, y, z;
+
+  auto size() const -> size_t { return x.size(); }
+
+  auto at(size_t index) const -> Vec3<ResultType> {
+    return Vec3<ResultType>(x[index], y[index], z[index]);
+  }
 
+  // bytes held by the three gradient components
+  auto memoryUsage() const -> size_t {
+    return (x.capacity() + y.capacity() + z.capacity()) * sizeof(ResultType);
+  }
+};
+
+// bytes a gradient cache for fieldCount fields will take, before building it
+template <typename ResultType>
+auto estimateGradientCacheMemory(size_t fieldCount, uint32_t width,
+                                 uint32_t height, uint32_t depth) -> size_t {
+  return fieldCount * 3 * sizeof(ResultType) * width * height * depth;
+}
+
+template <typename ResultType>
+auto gradientCacheMemoryUsage(
+    const std::vector<GradientVolume<ResultType>> &gradients) -> size_t {
+  size_t bytes = 0;
+  for (auto &gradient : gradients) {
+    bytes += gradient.memoryUsage();
+  }
+  return bytes;
+}
+
+template <typename ResultType>
+auto calculateGradientVolume(const ResultType *normalized, uint32_t width,
+                             uint32_t height, uint32_t depth)
+    -> GradientVolume<ResultType> {
+  VOLCORRELATION_TRACE_SCOPE("gradient");
   Vec3<uint32_t> dimensions(width, height, depth);
-  auto offsetZ = width * height;
-  auto size = depth * offsetZ;
+  const auto offsetZ = static_cast<size_t>(width) * height;
+  const auto size = depth * offsetZ;
 
-  vector<vector<ResultType>> normalizeds;
-  // normalize fields
+  GradientVolume<ResultType> gradient;
+  gradient.dimensions = dimensions;
+  gradient.x.resize(size);
+  gradient.y.resize(size);
+  gradient.z.resize(size);
+
+#pragma omp parallel for schedule(static)
+  for (int64_t row = 0; row < static_cast<int64_t>(depth) * height; row++) {
+    const auto z = static_cast<uint32_t>(row / height);
+    const auto y = static_cast<uint32_t>(row % height);
+    const auto index = static_cast<size_t>(row) * width;
+    sobelGradientRow(normalized, dimensions, y, z, gradient.x.data() + index,
+                     gradient.y.data() + index, gradient.z.data() + index);
+  }
+
+  return gradient;
+}
+
+// normalize and differentiate every field once; only one normalized copy is
+// alive at a time
+template <typename T, typename ResultType = double>
+auto calculateGradientVolumes(const std::vector<T *> &fields, uint32_t width,
+                              uint32_t height, uint32_t depth)
+    -> std::vector<GradientVolume<ResultType>> {
+  const auto size = static_cast<size_t>(width) * height * depth;
+
+  std::vector<GradientVolume<ResultType>> gradients;
+  gradients.reserve(fields.size());
   for (auto &field : fields) {
-    vector<ResultType> normalized(size);
-    T max = field[0];
-    for (size_t idx = 0; idx < size; idx++) {
-      auto value = field[idx];
-      if (value > max) {
-        max = value;
+    auto normalized = normalizeField<T, ResultType>(field, size);
+    gradients.push_back(
+        calculateGradientVolume(normalized.data(), width, height, depth));
+  }
+  return gradients;
+}
+
+// same result as calculateGradientSimilarity on the raw fields, but every
+// pair reads the cached gradients instead of running the stencil again
+template <typename ResultType>
+auto calculateGradientSimilarity(
+    const std::vector<GradientVolume<ResultType>> &gradients,
+    int sensitivity = 2) -> std::vector<ResultType> {
+  using std::vector;
+
+  if (gradients.empty()) {
+    return {};
+  }
+  VOLCORRELATION_TRACE_SCOPE("gradient similarity");
+  const auto size = gradients[0].size();
+  VOLCORRELATION_TRACE_COUNT("gsm voxels", size);
+
+  auto result = vector<ResultType>(size, 1.0);
+
+  for (auto i = 0ul; i < gradients.size(); i++) {
+    for (auto j = i + 1; j < gradients.size(); j++) {
+      auto &gradientA = gradients[i];
+      auto &gradientB = gradients[j];
+      VOLCORRELATION_TRACE_COUNT("gsm pairs evaluated", size);
+#pragma omp parallel for
+      for (int64_t index = 0; index < static_cast<int64_t>(size); index++) {
+        auto similarity = calculatePairSimilarity(
+            gradientA.at(index), gradientB.at(index), sensitivity);
+        const auto exist = result[index];
+        result[index] = fmin(exist, similarity);
       }
     }
-    for (size_t idx = 0; idx < size; idx++) {
-      normalized[idx] = static_cast<ResultType>(field[idx]) / max;
+  }
+
+  return result;
+}
+
+// voxel-outer similarity of the box [begin, end) of normalized fields
+// (pointers or NormalizedField); result receives encodeResult<Out> of the
+// box's voxels, x fastest, and their range is added to range if given.
+// Every pair is evaluated at each voxel, so the stencil of a field runs once
+// per voxel (a row at a time) and a voxel stops as soon as its running
+// minimum reaches 0 (e.g. one field has no gradient). Runs of a row whose
+// stencil reads only zeros of some field are known to be 0 from the bricks
+// and are written without evaluating a pair; a constant nonzero field still
+// has a gradient, as SobelKernelX is not antisymmetric. tracker, if given,
+// advances by one per row, and once it is cancelled the remaining rows are
+// skipped; the caller throws.
+template <typename Field, typename Out>
+void calculateGradientSimilaritySlab(const std::vector<Field> &fields,
+                                     const Vec3<uint32_t> &dimensions,
+                                     const Vec3<uint32_t> &begin,
+                                     const Vec3<uint32_t> &end,
+                                     int sensitivity, Out *result,
+                                     ResultRange *range = nullptr,
+                                     ProgressTracker *tracker = nullptr) {
+  using std::vector;
+  using ResultType = typename FieldValue<Field>::type;
+
+  const auto width = dimensions.x;
+  const auto boxWidth = end.x - begin.x;
+  const auto boxHeight = end.y - begin.y;
+  const auto fieldNum = fields.size();
+  const auto rowNum = static_cast<int64_t>(end.z - begin.z) * boxHeight;
+  VOLCORRELATION_TRACE_SCOPE("gradient similarity");
+
+  vector<BrickIndex<ResultType>> bricks;
+  if (fieldNum > 1) {
+    for (auto &field : fields) {
+      bricks.emplace_back(field, dimensions);
     }
-    normalizeds.push_back(std::move(normalized));
   }
 
-  auto result = vector<ResultType>(size, 1.0);
+#pragma omp parallel
+  {
+    VOLCORRELATION_TRACE_SCOPE("gradient similarity rows");
+    // per-thread scratch: gradient rows of the current row, computed the
+    // first time a pair needs them, and the rows normalized for the stencil
+    vector<ResultType> rows(fieldNum * 3 * width);
+    vector<ResultType> normalizedRows(5 * width);
+    vector<uint8_t> computed(fieldNum);
+    ResultRange localRange;
+    size_t voxels = 0, pairs = 0, skipped = 0;
 
-  for (auto i = 0ul; i < fields.size(); i++) {
-    for (auto j = i + 1; j < fields.size(); j++) {
+#pragma omp for schedule(dynamic, 16)
+    for (int64_t row = 0; row < rowNum; row++) {
+      if (tracker != nullptr && tracker->cancelled()) {
+        continue;
+      }
+      const auto z = begin.z + static_cast<uint32_t>(row / boxHeight);
+      const auto y = begin.y + static_cast<uint32_t>(row % boxHeight);
+      const auto line =
+          result + static_cast<size_t>(row) * boxWidth - begin.x;
+      std::fill(computed.begin(), computed.end(), 0);
+      auto rowOf = [&](size_t field) {
+        auto gradient = rows.data() + field * 3 * width;
+        if (!computed[field]) {
+          sobelGradientRow(fields[field], dimensions, y, z, gradient,
+                           gradient + width, gradient + 2 * width,
+                           normalizedRows.data());
+          computed[field] = 1;
+        }
+        return gradient;
+      };
+      auto gradientOf = [&](size_t field, uint32_t x) {
+        auto gradient = rowOf(field);
+        return Vec3<ResultType>(gradient[x], gradient[width + x],
+                                gradient[2 * width + x]);
+      };
 
-      size_t index = 0;
-      auto fieldA = normalizeds[i].data();
-      auto fieldB = normalizeds[j].data();
-#pragma omp parallel for
-      for (int z = 0; z < depth; z++) {
-        for (int y = 0; y < height; y++) {
-          for (int x = 0; x < width; x++) {
-            // calculate gradients
-            Vec3<uint32_t> pos(x,y,z);
-            auto index = (size_t)z * width * height + y * width + x;
-            auto gi = calculateGradient<ResultType>(fieldA, pos, dimensions,
-                                                    index, offsetZ);
-            auto gj = calculateGradient<ResultType>(fieldB, pos, dimensions,
-                                                    index, offsetZ);
-            // calculate similarity
-            auto similarity = calculatePairSimilarity(gi, gj, sensitivity);
-            const auto exist = result[index];
-            result[index] = fmin(exist, similarity);
-//            index++;
+      // a brick wide run at a time
+      for (uint32_t x0 = begin.x, x1; x0 < end.x; x0 = x1) {
+        x1 = std::min((x0 / BrickSize + 1) * BrickSize, end.x);
+        Vec3<uint32_t> first, last;
+        auto zero = false;
+        for (size_t i = 0; i < bricks.size() && !zero; i++) {
+          bricks[i].neighborhood(x0, x1, y, z, 1, first, last);
+          zero = bricks[i].constantAt(first, last, ResultType(0));
+        }
+        if (zero) {
+          std::fill(line + x0, line + x1, encodeResult<Out>(ResultType(0)));
+          localRange.add(0.0);
+          skipped += x1 - x0;
+          continue;
+        }
+        for (uint32_t x = x0; x < x1; x++) {
+          auto value = ResultType(1.0);
+          for (size_t i = 0; i < fieldNum && value > 0; i++) {
+            for (size_t j = i + 1; j < fieldNum && value > 0; j++) {
+              auto similarity = calculatePairSimilarity(
+                  gradientOf(i, x), gradientOf(j, x), sensitivity);
+              value = fmin(value, similarity);
+              pairs++;
+            }
           }
+          localRange.add(static_cast<double>(value));
+          line[x] = encodeResult<Out>(value);
         }
       }
+      voxels += boxWidth;
+      if (tracker != nullptr) {
+        tracker->advance(1);
+      }
+    }
+    VOLCORRELATION_TRACE_COUNT("gsm voxels", voxels);
+    VOLCORRELATION_TRACE_COUNT("gsm pairs evaluated", pairs);
+    VOLCORRELATION_TRACE_COUNT("gsm voxels skipped", skipped);
+
+    if (range != nullptr) {
+#pragma omp critical
+      range->merge(localRange);
     }
   }
+}
+
+// the slices [zBegin, zEnd); result points at slice zBegin
+template <typename Field, typename Out>
+void calculateGradientSimilaritySlab(const std::vector<Field> &fields,
+                                     const Vec3<uint32_t> &dimensions,
+                                     uint32_t zBegin, uint32_t zEnd,
+                                     int sensitivity, Out *result,
+                                     ResultRange *range = nullptr,
+                                     ProgressTracker *tracker = nullptr) {
+  calculateGradientSimilaritySlab(
+      fields, dimensions, Vec3<uint32_t>(0, 0, zBegin),
+      Vec3<uint32_t>(dimensions.x, dimensions.y, zEnd), sensitivity, result,
+      range, tracker);
+}
+
+// walks the volume once and evaluates every pair at each voxel, see
+// calculateGradientSimilaritySlab. Fields are normalized as they are read.
+template <typename T, typename ResultType = double>
+auto calculateGradientSimilarityVoxelOuter(const std::vector<T *> &fields,
+                                           uint32_t width, uint32_t height,
+                                           uint32_t depth, int sensitivity = 2,
+                                           const Progress &progress = {})
+    -> std::vector<ResultType> {
+  using std::vector;
+
+  Vec3<uint32_t> dimensions(width, height, depth);
+  const auto size = static_cast<size_t>(width) * height * depth;
+
+  vector<NormalizedField<T, ResultType>> normalizeds;
+  for (auto &field : fields) {
+    normalizeds.push_back(normalizedField<T, ResultType>(field, size));
+  }
+
+  auto result = vector<ResultType>(size, 1.0);
+  ProgressTracker tracker(progress, static_cast<size_t>(height) * depth);
+  calculateGradientSimilaritySlab(normalizeds, dimensions, 0, depth,
+                                  sensitivity, result.data(), nullptr,
+                                  &tracker);
+  tracker.throwIfCancelled();
+  return result;
+}
+
+// similarity of every voxel, the minimum over all field pairs; runs the
+// voxel-outer kernel, so each field's stencil is evaluated a row at a time
+template <typename T, typename ResultType = double>
+auto calculateGradientSimilarity(const std::vector<T *> &fields, uint32_t width,
+                                 uint32_t height, uint32_t depth,
+                                 int sensitivity = 2)
+    -> std::vector<ResultType> {
+  return calculateGradientSimilarityVoxelOuter<T, ResultType>(
+      fields, width, height, depth, sensitivity);
+}
+
+// same as above on memory-mapped volumes of any supported type, which must
+// share their type and dimensions
+template <typename ResultType = double>
+auto calculateGradientSimilarity(
+    const std::vector<const MappedVolume *> &volumes, int sensitivity = 2)
+    -> std::vector<ResultType> {
+  return visitVolumes(volumes, [&](const auto &fields) {
+    using Field = typename std::decay_t<decltype(fields)>::value_type;
+    using T = std::remove_pointer_t<Field>;
+    const auto dimensions = volumes[0]->getDimensions();
+    return calculateGradientSimilarity<T, ResultType>(
+        fields, dimensions.x, dimensions.y, dimensions.z, sensitivity);
+  });
+}
+
+// voxel-outer similarity written straight as Out: uint8_t and uint16_t map
+// [0, 1] onto their full scale, float keeps the value. No normalized copy and
+// no ResultType volume are allocated.
+template <typename Out, typename T, typename ResultType = double>
+auto calculateGradientSimilarityQuantized(const std::vector<T *> &fields,
+                                          uint32_t width, uint32_t height,
+                                          uint32_t depth, int sensitivity = 2,
+                                          const Progress &progress = {})
+    -> QuantizedResult<Out> {
+  Vec3<uint32_t> dimensions(width, height, depth);
+  const auto size = static_cast<size_t>(width) * height * depth;
+
+  std::vector<NormalizedField<T, ResultType>> normalizeds;
+  for (auto &field : fields) {
+    normalizeds.push_back(normalizedField<T, ResultType>(field, size));
+  }
 
+  QuantizedResult<Out> result;
+  result.values.resize(size);
+  ProgressTracker tracker(progress, static_cast<size_t>(height) * depth);
+  calculateGradientSimilaritySlab(normalizeds, dimensions, 0, depth,
+                                  sensitivity, result.values.data(),
+                                  &result.range, &tracker);
+  tracker.throwIfCancelled();
   return result;
 }
 
+template <typename Out, typename ResultType = double>
+auto calculateGradientSimilarityQuantized(
+    const std::vector<const MappedVolume *> &volumes, int sensitivity = 2,
+    const Progress &progress = {}) -> QuantizedResult<Out> {
+  return visitVolumes(volumes, [&](const auto &fields) {
+    using Field = typename std::decay_t<decltype(fields)>::value_type;
+    using T = std::remove_pointer_t<Field>;
+    const auto dimensions = volumes[0]->getDimensions();
+    return calculateGradientSimilarityQuantized<Out, T, ResultType>(
+        fields, dimensions.x, dimensions.y, dimensions.z, sensitivity,
+        progress);
+  });
+}
+
 } // namespace VolCorrelation
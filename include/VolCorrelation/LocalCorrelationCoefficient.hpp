@@ -1,22 +1,19 @@
 #pragma once
+#include "BrickIndex.hpp"
+#include "Common.hpp"
+#include "MappedVolume.hpp"
+#include "SummedVolumeTable.hpp"
+#include "WindowKernel.hpp"
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
+#include <type_traits>
 #include <utility>
 #include <vector>
 #include <omp.h>
 namespace VolCorrelation {
 
-#ifndef VolCorrelation_Vec3
-#define VolCorrelation_Vec3
-template <typename T> struct Vec3 {
-  T x, y, z;
-  Vec3() : x(0), y(0), z(0) {}
-  Vec3(T a, T b, T c) : x(a), y(b), z(c) {}
-  auto norm() const -> T { return std::sqrt(x * x + y * y + z * z); }
-};
-#endif
-
-inline auto suma(std::vector<double> a) -> double {
+inline auto suma(const std::vector<double> &a) -> double {
   auto s = 0.0;
   for (auto i : a) {
     s += i;
@@ -41,19 +38,20 @@ inline auto stdev(std::vector<double> &nums) -> double {
   return pow(sqsum(nums) / N - pow(suma(nums) / N, 2), 0.5);
 }
 
-inline auto operator-(std::vector<double> &a, double b) -> std::vector<double> {
-  std::vector<double> result;
-  for (double i : a) {
-    result.push_back(i - b);
+inline auto operator-(const std::vector<double> &a, double b)
+    -> std::vector<double> {
+  std::vector<double> result(a.size());
+  for (size_t i = 0; i < a.size(); i++) {
+    result[i] = a[i] - b;
   }
   return result;
 }
 
-inline auto operator*(std::vector<double> a, std::vector<double> b)
-    -> std::vector<double> {
-  std::vector<double> result;
-  for (int i = 0; i < a.size(); i++) {
-    result.push_back(a[i] * b[i]);
+inline auto operator*(const std::vector<double> &a,
+                      const std::vector<double> &b) -> std::vector<double> {
+  std::vector<double> result(a.size());
+  for (size_t i = 0; i < a.size(); i++) {
+    result[i] = a[i] * b[i];
   }
   return result;
 }
@@ -63,116 +61,485 @@ inline auto pearsoncoeff(std::vector<double> X, std::vector<double> Y)
   return suma((X - mean(X)) * (Y - mean(Y))) / (X.size() * stdev(X) * stdev(Y));
 }
 
+// absolute pearson coefficient of a window from its raw sums, 0 when it is
+// undefined or out of range. The n^2-scaled (co)variances are exact for
+// integer sums, so a constant window gives 0/0 rather than rounding noise.
+template <typename ResultType>
+inline auto windowCorrelation(double n, double sumX, double sumY, double sqsumX,
+                              double sqsumY, double sumXY) -> ResultType {
+  const auto varX = n * sqsumX - sumX * sumX;
+  const auto varY = n * sqsumY - sumY * sumY;
+  const auto cov = n * sumXY - sumX * sumY;
+  auto p = cov / sqrt(varX * varY);
+  if (-1 < p && p < 1) {
+    return static_cast<ResultType>(std::abs(p));
+  }
+  return 0;
+}
+
+// streams the window once through scalar accumulators, so the voxel loop
+// never touches the heap. Samples are shifted by the center value to keep
+// the one-pass (co)variance well conditioned.
 template <typename ResultType>
 inline auto getLLC(const std::vector<ResultType> &fieldA,
                    const std::vector<ResultType> &fieldB,
                    const Vec3<uint32_t> &pos, const Vec3<uint32_t> &dimensions,
                    int offsetXY, int windowSize) -> ResultType {
-  const auto num = static_cast<size_t>(pow(2 * windowSize - 1, 3));
-  std::vector<ResultType> X;
-  std::vector<ResultType> Y;
-  X.reserve(num);
-  Y.reserve(num);
-
   const auto px = static_cast<int>(pos.x);
   const auto py = static_cast<int>(pos.y);
   const auto pz = static_cast<int>(pos.z);
 
-  const auto maxX = static_cast<int>(pos.x);
-  const auto maxY = static_cast<int>(pos.y);
-  const auto maxZ = static_cast<int>(pos.z);
+  const auto maxX = static_cast<int>(dimensions.x);
+  const auto maxY = static_cast<int>(dimensions.y);
+  const auto maxZ = static_cast<int>(dimensions.z);
 
-  for (auto z = pz - windowSize; z <= pz + windowSize; z++) {
-    if (z < 0 || z >= maxZ) {
-      continue;
-    }
-    for (auto y = py - windowSize; y <= py + windowSize; y++) {
-      if (y < 0 || y >= maxY) {
-        continue;
+  const auto beginX = std::max(px - windowSize, 0);
+  const auto endX = std::min(px + windowSize + 1, maxX);
+  const auto beginY = std::max(py - windowSize, 0);
+  const auto endY = std::min(py + windowSize + 1, maxY);
+  const auto beginZ = std::max(pz - windowSize, 0);
+  const auto endZ = std::min(pz + windowSize + 1, maxZ);
+
+  const auto center = static_cast<size_t>(pz) * offsetXY + py * maxX + px;
+  const auto shiftX = static_cast<double>(fieldA[center]);
+  const auto shiftY = static_cast<double>(fieldB[center]);
+
+  const WindowBox box{static_cast<size_t>(endX - beginX),
+                      static_cast<size_t>(endY - beginY),
+                      static_cast<size_t>(endZ - beginZ),
+                      static_cast<size_t>(maxX), static_cast<size_t>(offsetXY)};
+  const auto first = static_cast<size_t>(beginZ) * offsetXY + beginY * maxX +
+                     beginX;
+  WindowMoments moments;
+  accumulateWindow(fieldA.data() + first, fieldB.data() + first, box, shiftX,
+                   shiftY, moments);
+
+  const auto n = static_cast<double>(box.nx) * box.ny * box.nz;
+  return windowCorrelation<ResultType>(n, moments.sumX, moments.sumY,
+                                       moments.sqsumX, moments.sqsumY,
+                                       moments.sumXY);
+}
+
+enum class LCCBackend {
+  // gather the full (2w+1)^3 window of every voxel
+  Direct,
+  // O(1) window statistics from summed-area tables of x, x^2 and x*y
+  SummedArea,
+};
+
+// unsigned inputs of up to 16 bits are summed exactly in 64 bit: a window's
+// sum of squares stays far below 2^64, so differences of the wrapping prefix
+// sums are exact, and pearson is scale invariant so no normalization is
+// needed. Signed and wider inputs would overflow or wrap, so they are summed
+// in double like floating inputs.
+template <typename T>
+constexpr bool exactWindowSums =
+    std::is_unsigned<std::remove_const_t<T>>::value &&
+    sizeof(std::remove_const_t<T>) <= 2;
+
+template <typename T>
+using WindowAccumulator =
+    std::conditional_t<exactWindowSums<T>, uint64_t, double>;
+
+template <typename T, typename ResultType = double>
+auto calcLocalCorrelationCoefficientSummedArea(const std::vector<T *> &fields,
+                                               uint32_t width, uint32_t height,
+                                               uint32_t depth, int windowSize)
+    -> std::vector<ResultType> {
+  using std::vector;
+  using Accumulator = WindowAccumulator<T>;
+  VOLCORRELATION_TRACE_SCOPE("local correlation");
+
+  const auto offsetZ = static_cast<size_t>(width) * height;
+  const auto size = depth * offsetZ;
+  VOLCORRELATION_TRACE_COUNT("lcc voxels", size);
+
+  // fields summed in double are shifted by their mean, which leaves
+  // (co)variance unchanged but keeps the prefix sums small
+  vector<double> shifts(fields.size(), 0.0);
+  if (!exactWindowSums<T>) {
+    for (size_t i = 0; i < fields.size(); i++) {
+      auto sum = 0.0;
+      for (size_t idx = 0; idx < size; idx++) {
+        sum += static_cast<double>(fields[i][idx]);
       }
-      for (auto x = px - windowSize; x <= px + windowSize; x++) {
-        if (x < 0 || x >= maxX) {
-          continue;
+      shifts[i] = sum / size;
+    }
+  }
+  auto sample = [&](size_t i, size_t idx) {
+    return static_cast<Accumulator>(static_cast<double>(fields[i][idx]) -
+                                    shifts[i]);
+  };
+
+  vector<SummedVolumeTable<Accumulator>> sums(fields.size());
+  vector<SummedVolumeTable<Accumulator>> sqsums(fields.size());
+  for (size_t i = 0; i < fields.size(); i++) {
+    sums[i].build(width, height, depth,
+                  [&](size_t idx) { return sample(i, idx); });
+    sqsums[i].build(width, height, depth, [&](size_t idx) {
+      const auto value = sample(i, idx);
+      return value * value;
+    });
+  }
+
+  auto result = vector<ResultType>(size, 1.0);
+  SummedVolumeTable<Accumulator> crossSums;
+
+  for (size_t i = 0; i < fields.size(); i++) {
+    for (size_t j = i + 1; j < fields.size(); j++) {
+      crossSums.build(width, height, depth, [&](size_t idx) {
+        return sample(i, idx) * sample(j, idx);
+      });
+      VOLCORRELATION_TRACE_COUNT("lcc pairs evaluated", size);
+#pragma omp parallel for
+      for (int z = 0; z < static_cast<int>(depth); z++) {
+        Vec3<uint32_t> begin, end;
+        begin.z = std::max(z - windowSize, 0);
+        end.z = std::min(z + windowSize + 1, static_cast<int>(depth));
+        for (int y = 0; y < static_cast<int>(height); y++) {
+          begin.y = std::max(y - windowSize, 0);
+          end.y = std::min(y + windowSize + 1, static_cast<int>(height));
+          for (int x = 0; x < static_cast<int>(width); x++) {
+            begin.x = std::max(x - windowSize, 0);
+            end.x = std::min(x + windowSize + 1, static_cast<int>(width));
+            const auto n = static_cast<double>(
+                static_cast<size_t>(end.x - begin.x) * (end.y - begin.y) *
+                (end.z - begin.z));
+            const auto value = windowCorrelation<ResultType>(
+                n, static_cast<double>(sums[i].boxSum(begin, end)),
+                static_cast<double>(sums[j].boxSum(begin, end)),
+                static_cast<double>(sqsums[i].boxSum(begin, end)),
+                static_cast<double>(sqsums[j].boxSum(begin, end)),
+                static_cast<double>(crossSums.boxSum(begin, end)));
+            auto index = (size_t)z * offsetZ + y * width + x;
+            const auto exist = result[index];
+            result[index] = exist < value ? exist : value;
+          }
         }
-        auto idx = z * offsetXY + y * maxX + x;
-        X.push_back(fieldA[idx]);
-        Y.push_back(fieldB[idx]);
       }
     }
   }
 
-  const auto sumaX = suma(X);
-  const auto sumaY = suma(Y);
-  const auto meanX = sumaX / X.size();
-  const auto meanY = sumaY / Y.size();
-  const auto sqsumX = sqsum(X);
-  const auto sqsumY = sqsum(Y);
-  const auto stdevX = sqrt(sqsumX / X.size() - pow(sumaX / X.size(), 2));
-  const auto stdevY = sqrt(sqsumY / Y.size() - pow(sumaY / Y.size(), 2));
-
-  // auto p = pearsoncoeff(X, Y);
-  auto p = suma((X - meanX) * (Y - meanY)) / (X.size() * stdevX * stdevY);
-  if (-1 < p && p < 1) {
-    return static_cast<ResultType>(abs(p));
-  }
+  return result;
+}
 
-  return 0;
+// bytes held by the summed-area tables of the SummedArea backend
+template <typename T>
+auto estimateSummedAreaMemory(size_t fieldCount, uint32_t width,
+                              uint32_t height, uint32_t depth) -> size_t {
+  const auto tableSize =
+      (width + 1ull) * (height + 1ull) * (depth + 1ull) *
+      sizeof(WindowAccumulator<T>);
+  return (2 * fieldCount + 1) * tableSize;
 }
 
 template <typename T, typename ResultType = double>
 auto calcLocalCorrelationCoefficient(const std::vector<T *> &fields,
                                      uint32_t width, uint32_t height,
-                                     uint32_t depth, int windowSize = 3)
+                                     uint32_t depth, int windowSize = 3,
+                                     LCCBackend backend = LCCBackend::Direct)
     -> std::vector<ResultType> {
   using std::vector;
 
+  if (backend == LCCBackend::SummedArea) {
+    return calcLocalCorrelationCoefficientSummedArea<T, ResultType>(
+        fields, width, height, depth, windowSize);
+  }
+
+  VOLCORRELATION_TRACE_SCOPE("local correlation");
   auto dimensions = Vec3<uint32_t>(width, height, depth);
   auto offsetZ = width * height;
   auto size = depth * offsetZ;
+  VOLCORRELATION_TRACE_COUNT("lcc voxels", size);
 
   // normalize fields
   vector<vector<ResultType>> normalizeds;
   for (auto field : fields) {
-    vector<ResultType> normalized(size);
+    normalizeds.push_back(normalizeField<T, ResultType>(field, size));
+  }
+
+  auto total = dimensions.x * dimensions.y * dimensions.z;
+  auto offsetXY = dimensions.x * dimensions.y;
+
+  auto result = vector<ResultType>(total, 1.0);
 
-    T max = field[0];
-    for (size_t idx = 0; idx < size; idx++) {
-      const auto value = field[idx];
-      if (value > max) {
-        max = value;
+  for (size_t i = 0; i < fields.size(); i++) {
+    for (size_t j = i + 1; j < fields.size(); j++) {
+      VOLCORRELATION_TRACE_COUNT("lcc pairs evaluated", size);
+      // rows are distributed instead of slices so thin volumes still feed
+      // every core
+#pragma omp parallel for schedule(static)
+      for (int64_t row = 0; row < static_cast<int64_t>(depth) * height;
+           row++) {
+        const auto z = static_cast<uint32_t>(row / height);
+        const auto y = static_cast<uint32_t>(row % height);
+        for (uint32_t x = 0; x < width; x++) {
+          auto index = (size_t)row * width + x;
+          const auto value =
+              getLLC(normalizeds[i], normalizeds[j], Vec3<uint32_t>(x, y, z),
+                     dimensions, offsetXY, windowSize);
+          const auto exist = result[index];
+          result[index] = exist < value ? exist : value;
+        }
       }
     }
-    for (size_t idx = 0; idx < size; idx++) {
-      normalized[idx] = static_cast<ResultType>(field[idx]) / max;
+  }
+
+  return result;
+}
+
+// same as above on memory-mapped volumes of any supported type, which must
+// share their type and dimensions
+template <typename ResultType = double>
+auto calcLocalCorrelationCoefficient(
+    const std::vector<const MappedVolume *> &volumes, int windowSize = 3,
+    LCCBackend backend = LCCBackend::Direct) -> std::vector<ResultType> {
+  return visitVolumes(volumes, [&](const auto &fields) {
+    using Field = typename std::decay_t<decltype(fields)>::value_type;
+    using T = std::remove_pointer_t<Field>;
+    const auto dimensions = volumes[0]->getDimensions();
+    return calcLocalCorrelationCoefficient<T, ResultType>(
+        fields, dimensions.x, dimensions.y, dimensions.z, windowSize, backend);
+  });
+}
+
+// voxel-outer coefficient of the box [begin, end) of normalized fields
+// (pointers or NormalizedField); result receives encodeResult<Out> of the
+// box's voxels, x fastest, and their range is added to range if given.
+// Each voxel gathers the window of every field into per-thread scratch, then
+// evaluates the pairs from it and stops as soon as the running minimum
+// reaches 0 (e.g. one field is constant in the window). Brick wide runs of a
+// row where some field is constant over every window are known to be 0 from
+// the bricks and are written without gathering. tracker works as in
+// calculateGradientSimilaritySlab.
+template <typename Field, typename Out>
+void calcLocalCorrelationCoefficientSlab(const std::vector<Field> &normalizeds,
+                                         const Vec3<uint32_t> &dimensions,
+                                         const Vec3<uint32_t> &begin,
+                                         const Vec3<uint32_t> &end,
+                                         int windowSize, Out *result,
+                                         ResultRange *range = nullptr,
+                                         ProgressTracker *tracker = nullptr) {
+  using std::vector;
+  using ResultType = typename FieldValue<Field>::type;
+
+  const auto width = dimensions.x;
+  const auto height = dimensions.y;
+  const auto depth = dimensions.z;
+  const auto offsetZ = static_cast<size_t>(width) * height;
+  const auto boxWidth = end.x - begin.x;
+  const auto boxHeight = end.y - begin.y;
+  const auto fieldNum = normalizeds.size();
+  const auto windowNum = static_cast<size_t>(2 * windowSize + 1) *
+                         (2 * windowSize + 1) * (2 * windowSize + 1);
+  const auto rowNum = static_cast<int64_t>(end.z - begin.z) * boxHeight;
+  VOLCORRELATION_TRACE_SCOPE("local correlation");
+
+  vector<BrickIndex<ResultType>> bricks;
+  if (fieldNum > 1) {
+    for (auto &normalized : normalizeds) {
+      bricks.emplace_back(normalized, dimensions);
     }
-    normalizeds.push_back(std::move(normalized));
   }
 
-  auto total = dimensions.x * dimensions.y * dimensions.z;
-  auto offsetXY = dimensions.x * dimensions.y;
+#pragma omp parallel
+  {
+    VOLCORRELATION_TRACE_SCOPE("local correlation rows");
+    // per-thread scratch: centered window samples and their sums per field
+    vector<double> samples(fieldNum * windowNum);
+    vector<double> sums(fieldNum), sqsums(fieldNum);
+    vector<uint8_t> computed(fieldNum);
+    ResultRange localRange;
+    size_t voxels = 0, pairs = 0, skipped = 0;
 
-  auto result = vector<ResultType>(total, 1.0);
+#pragma omp for schedule(dynamic, 16)
+    for (int64_t row = 0; row < rowNum; row++) {
+      if (tracker != nullptr && tracker->cancelled()) {
+        continue;
+      }
+      const auto pz = static_cast<int>(begin.z + row / boxHeight);
+      const auto py = static_cast<int>(begin.y + row % boxHeight);
+      const auto line =
+          result + static_cast<size_t>(row) * boxWidth - begin.x;
+      const auto beginZ = std::max(pz - windowSize, 0);
+      const auto endZ = std::min(pz + windowSize + 1, static_cast<int>(depth));
+      const auto beginY = std::max(py - windowSize, 0);
+      const auto endY = std::min(py + windowSize + 1, static_cast<int>(height));
+      for (auto px = static_cast<int>(begin.x); px < static_cast<int>(end.x);
+           px++) {
+        if (px % BrickSize == 0 || px == static_cast<int>(begin.x)) {
+          const auto x0 = static_cast<uint32_t>(px);
+          const auto x1 = std::min((x0 / BrickSize + 1) * BrickSize, end.x);
+          Vec3<uint32_t> first, last;
+          auto constant = false;
+          for (size_t i = 0; i < bricks.size() && !constant; i++) {
+            bricks[i].neighborhood(x0, x1, static_cast<uint32_t>(py),
+                                   static_cast<uint32_t>(pz),
+                                   static_cast<uint32_t>(windowSize), first,
+                                   last);
+            constant = bricks[i].constant(first, last);
+          }
+          if (constant) {
+            std::fill(line + x0, line + x1,
+                      encodeResult<Out>(ResultType(0)));
+            localRange.add(0.0);
+            skipped += x1 - x0;
+            px = static_cast<int>(x1) - 1;
+            continue;
+          }
+        }
+        const auto beginX = std::max(px - windowSize, 0);
+        const auto endX =
+            std::min(px + windowSize + 1, static_cast<int>(width));
+        const auto center = static_cast<size_t>(pz) * offsetZ +
+                            static_cast<size_t>(py) * width + px;
+        const auto n = static_cast<size_t>(endX - beginX) * (endY - beginY) *
+                       (endZ - beginZ);
+        std::fill(computed.begin(), computed.end(), 0);
 
-  for (auto i = 0; i < fields.size(); i++) {
-    for (auto j = i + 1; j < fields.size(); j++) {
-//      auto index = 0ULL;
-#pragma omp parallel for
-      for (int z = 0; z < depth; z++) {
-        for (int y = 0; y < height; y++) {
-          for (int x = 0; x < width; x++) {
-            auto index = (size_t)z * width * height + y * width + x;
-            const auto value = getLLC(normalizeds[i], normalizeds[j], Vec3<uint32_t>(x,y,z),
-                                      dimensions, offsetXY, windowSize);
-            const auto exist = result[index];
-            result[index] = exist < value ? exist : value;
-//            index++;
+        // gathers and sums a field's window the first time a pair needs it
+        auto window = [&](size_t field) {
+          auto sample = samples.data() + field * windowNum;
+          if (computed[field]) {
+            return sample;
+          }
+          const auto &normalized = normalizeds[field];
+          const auto shift = static_cast<double>(normalized[center]);
+          auto sum = 0.0, sqsum = 0.0;
+          size_t k = 0;
+          for (auto z = beginZ; z < endZ; z++) {
+            for (auto y = beginY; y < endY; y++) {
+              const auto line = static_cast<size_t>(z) * offsetZ +
+                                static_cast<size_t>(y) * width;
+              for (auto x = beginX; x < endX; x++) {
+                const auto value =
+                    static_cast<double>(normalized[line + x]) - shift;
+                sample[k++] = value;
+                sum += value;
+                sqsum += value * value;
+              }
+            }
+          }
+          sums[field] = sum;
+          sqsums[field] = sqsum;
+          computed[field] = 1;
+          return sample;
+        };
+
+        auto value = ResultType(1.0);
+        for (size_t i = 0; i < fieldNum && value > 0; i++) {
+          for (size_t j = i + 1; j < fieldNum && value > 0; j++) {
+            const auto sampleA = window(i);
+            const auto sampleB = window(j);
+            const auto sumXY = dotProduct(sampleA, sampleB, n);
+            const auto p = windowCorrelation<ResultType>(
+                static_cast<double>(n), sums[i], sums[j], sqsums[i],
+                sqsums[j], sumXY);
+            value = value < p ? value : p;
+            pairs++;
           }
         }
+        localRange.add(static_cast<double>(value));
+        line[px] = encodeResult<Out>(value);
+      }
+      voxels += boxWidth;
+      if (tracker != nullptr) {
+        tracker->advance(1);
       }
     }
+    VOLCORRELATION_TRACE_COUNT("lcc voxels", voxels);
+    VOLCORRELATION_TRACE_COUNT("lcc pairs evaluated", pairs);
+    VOLCORRELATION_TRACE_COUNT("lcc voxels skipped", skipped);
+
+    if (range != nullptr) {
+#pragma omp critical
+      range->merge(localRange);
+    }
+  }
+}
+
+// the slices [zBegin, zEnd); result points at slice zBegin
+template <typename Field, typename Out>
+void calcLocalCorrelationCoefficientSlab(const std::vector<Field> &normalizeds,
+                                         const Vec3<uint32_t> &dimensions,
+                                         uint32_t zBegin, uint32_t zEnd,
+                                         int windowSize, Out *result,
+                                         ResultRange *range = nullptr,
+                                         ProgressTracker *tracker = nullptr) {
+  calcLocalCorrelationCoefficientSlab(
+      normalizeds, dimensions, Vec3<uint32_t>(0, 0, zBegin),
+      Vec3<uint32_t>(dimensions.x, dimensions.y, zEnd), windowSize, result,
+      range, tracker);
+}
+
+// walks the volume once and evaluates every pair at each voxel, see
+// calcLocalCorrelationCoefficientSlab. Fields are normalized as they are read.
+template <typename T, typename ResultType = double>
+auto calcLocalCorrelationCoefficientVoxelOuter(const std::vector<T *> &fields,
+                                               uint32_t width, uint32_t height,
+                                               uint32_t depth,
+                                               int windowSize = 3,
+                                               const Progress &progress = {})
+    -> std::vector<ResultType> {
+  using std::vector;
+
+  Vec3<uint32_t> dimensions(width, height, depth);
+  const auto size = static_cast<size_t>(width) * height * depth;
+
+  vector<NormalizedField<T, ResultType>> normalizeds;
+  for (auto field : fields) {
+    normalizeds.push_back(normalizedField<T, ResultType>(field, size));
+  }
+
+  auto result = vector<ResultType>(size, 1.0);
+  ProgressTracker tracker(progress, static_cast<size_t>(height) * depth);
+  calcLocalCorrelationCoefficientSlab(normalizeds, dimensions, 0, depth,
+                                      windowSize, result.data(), nullptr,
+                                      &tracker);
+  tracker.throwIfCancelled();
+  return result;
+}
+
+// voxel-outer coefficient written straight as Out: uint8_t and uint16_t map
+// [0, 1] onto their full scale, float keeps the value. No normalized copy and
+// no ResultType volume are allocated.
+template <typename Out, typename T, typename ResultType = double>
+auto calcLocalCorrelationCoefficientQuantized(const std::vector<T *> &fields,
+                                              uint32_t width, uint32_t height,
+                                              uint32_t depth,
+                                              int windowSize = 3,
+                                              const Progress &progress = {})
+    -> QuantizedResult<Out> {
+  Vec3<uint32_t> dimensions(width, height, depth);
+  const auto size = static_cast<size_t>(width) * height * depth;
+
+  std::vector<NormalizedField<T, ResultType>> normalizeds;
+  for (auto field : fields) {
+    normalizeds.push_back(normalizedField<T, ResultType>(field, size));
   }
 
+  QuantizedResult<Out> result;
+  result.values.resize(size);
+  ProgressTracker tracker(progress, static_cast<size_t>(height) * depth);
+  calcLocalCorrelationCoefficientSlab(normalizeds, dimensions, 0, depth,
+                                      windowSize, result.values.data(),
+                                      &result.range, &tracker);
+  tracker.throwIfCancelled();
   return result;
 }
 
+template <typename Out, typename ResultType = double>
+auto calcLocalCorrelationCoefficientQuantized(
+    const std::vector<const MappedVolume *> &volumes, int windowSize = 3,
+    const Progress &progress = {}) -> QuantizedResult<Out> {
+  return visitVolumes(volumes, [&](const auto &fields) {
+    using Field = typename std::decay_t<decltype(fields)>::value_type;
+    using T = std::remove_pointer_t<Field>;
+    const auto dimensions = volumes[0]->getDimensions();
+    return calcLocalCorrelationCoefficientQuantized<Out, T, ResultType>(
+        fields, dimensions.x, dimensions.y, dimensions.z, windowSize,
+        progress);
+  });
+}
+
 } // namespace VolCorrelation
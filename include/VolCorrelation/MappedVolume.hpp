@@ -0,0 +1,240 @@
+#pragma once
+#include "Common.hpp"
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+namespace VolCorrelation {
+
+enum class DataType { UInt8, UInt16, Float32, Float64 };
+
+inline auto dataTypeSize(DataType type) -> size_t {
+  switch (type) {
+  case DataType::UInt8:
+    return 1;
+  case DataType::UInt16:
+    return 2;
+  case DataType::Float32:
+    return 4;
+  case DataType::Float64:
+    return 8;
+  }
+  return 0;
+}
+
+// accepts the names used by the raw volume tools: uint8, uint16, float, double
+inline auto parseDataType(const std::string &name) -> DataType {
+  if (name == "uint8") {
+    return DataType::UInt8;
+  }
+  if (name == "uint16") {
+    return DataType::UInt16;
+  }
+  if (name == "float" || name == "float32") {
+    return DataType::Float32;
+  }
+  if (name == "double" || name == "float64") {
+    return DataType::Float64;
+  }
+  throw std::invalid_argument("unknown data type " + name);
+}
+
+template <typename T> struct DataTypeOf;
+template <> struct DataTypeOf<uint8_t> {
+  static constexpr auto value = DataType::UInt8;
+};
+template <> struct DataTypeOf<uint16_t> {
+  static constexpr auto value = DataType::UInt16;
+};
+template <> struct DataTypeOf<float> {
+  static constexpr auto value = DataType::Float32;
+};
+template <> struct DataTypeOf<double> {
+  static constexpr auto value = DataType::Float64;
+};
+
+// read-only memory mapping of a raw volume file, stored x fastest. Pages are
+// loaded by the OS on first touch, so opening a volume costs no reads and no
+// heap copy of the data.
+class MappedVolume {
+public:
+  MappedVolume() = default;
+
+  MappedVolume(const std::string &path, uint32_t width, uint32_t height,
+               uint32_t depth, DataType type)
+      : dimensions(width, height, depth), dataType(type) {
+    VOLCORRELATION_TRACE_SCOPE("load");
+    const auto bytes = voxelCount() * dataTypeSize(type);
+    map(path, bytes);
+  }
+
+  MappedVolume(const MappedVolume &) = delete;
+  auto operator=(const MappedVolume &) -> MappedVolume & = delete;
+
+  MappedVolume(MappedVolume &&other) noexcept { swap(other); }
+  auto operator=(MappedVolume &&other) noexcept -> MappedVolume & {
+    swap(other);
+    return *this;
+  }
+
+  ~MappedVolume() { unmap(); }
+
+  template <typename T> auto data() const -> const T * {
+    if (DataTypeOf<T>::value != dataType) {
+      throw std::invalid_argument("volume is not of the requested type");
+    }
+    return static_cast<const T *>(view);
+  }
+
+  auto bytes() const -> const void * { return view; }
+  auto type() const -> DataType { return dataType; }
+  auto getDimensions() const -> Vec3<uint32_t> { return dimensions; }
+  auto voxelCount() const -> size_t {
+    return static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z;
+  }
+
+private:
+  void swap(MappedVolume &other) noexcept {
+    std::swap(dimensions, other.dimensions);
+    std::swap(dataType, other.dataType);
+    std::swap(view, other.view);
+    std::swap(mappedBytes, other.mappedBytes);
+#ifdef _WIN32
+    std::swap(file, other.file);
+    std::swap(mapping, other.mapping);
+#endif
+  }
+
+#ifdef _WIN32
+  void map(const std::string &path, size_t bytes) {
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                       OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      throw std::runtime_error("failed to open " + path);
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) ||
+        static_cast<size_t>(size.QuadPart) < bytes) {
+      unmap();
+      throw std::runtime_error(path + " is smaller than the volume");
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+      unmap();
+      throw std::runtime_error("failed to map " + path);
+    }
+    view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, bytes);
+    if (view == nullptr) {
+      unmap();
+      throw std::runtime_error("failed to map " + path);
+    }
+    mappedBytes = bytes;
+  }
+
+  void unmap() {
+    if (view != nullptr) {
+      UnmapViewOfFile(view);
+      view = nullptr;
+    }
+    if (mapping != nullptr) {
+      CloseHandle(mapping);
+      mapping = nullptr;
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+      CloseHandle(file);
+      file = INVALID_HANDLE_VALUE;
+    }
+  }
+
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+#else
+  void map(const std::string &path, size_t bytes) {
+    const auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("failed to open " + path);
+    }
+    struct stat status {};
+    if (fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < bytes) {
+      close(fd);
+      throw std::runtime_error(path + " is smaller than the volume");
+    }
+    // the mapping keeps its own reference to the file
+    auto address = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+      throw std::runtime_error("failed to map " + path);
+    }
+    madvise(address, bytes, MADV_SEQUENTIAL);
+    view = address;
+    mappedBytes = bytes;
+  }
+
+  void unmap() {
+    if (view != nullptr) {
+      munmap(const_cast<void *>(view), mappedBytes);
+      view = nullptr;
+    }
+  }
+#endif
+
+  Vec3<uint32_t> dimensions;
+  DataType dataType = DataType::UInt8;
+  const void *view = nullptr;
+  size_t mappedBytes = 0;
+};
+
+// calls func with the typed pointers of all volumes, which must share one
+// data type and one set of dimensions
+template <typename Func>
+auto visitVolumes(const std::vector<const MappedVolume *> &volumes, Func func)
+    -> decltype(func(std::vector<const uint8_t *>())) {
+  if (volumes.empty()) {
+    throw std::invalid_argument("no volumes given");
+  }
+  const auto type = volumes[0]->type();
+  const auto dimensions = volumes[0]->getDimensions();
+  for (auto volume : volumes) {
+    const auto other = volume->getDimensions();
+    if (volume->type() != type || other.x != dimensions.x ||
+        other.y != dimensions.y || other.z != dimensions.z) {
+      throw std::invalid_argument("volumes differ in type or dimensions");
+    }
+  }
+
+  auto typed = [&](auto tag) {
+    using T = decltype(tag);
+    std::vector<const T *> fields;
+    for (auto volume : volumes) {
+      fields.push_back(volume->data<T>());
+    }
+    return func(fields);
+  };
+  switch (type) {
+  case DataType::UInt16:
+    return typed(uint16_t());
+  case DataType::Float32:
+    return typed(float());
+  case DataType::Float64:
+    return typed(double());
+  default:
+    return typed(uint8_t());
+  }
+}
+
+} // namespace VolCorrelation
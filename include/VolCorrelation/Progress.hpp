@@ -0,0 +1,80 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+namespace VolCorrelation {
+
+// set from any thread to stop a running computation; kernels poll it once per
+// row or block and stop with OperationCancelled
+class CancellationToken {
+public:
+  void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+  void reset() { cancelled.store(false, std::memory_order_relaxed); }
+  auto isCancelled() const -> bool {
+    return cancelled.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<bool> cancelled{false};
+};
+
+class OperationCancelled : public std::runtime_error {
+public:
+  OperationCancelled() : std::runtime_error("computation cancelled") {}
+};
+
+// what a long computation reports to: callback receives the finished fraction
+// in [0, 1], at most once per permille and never concurrently, from whichever
+// thread completes the work
+struct Progress {
+  std::function<void(double)> callback;
+  const CancellationToken *token = nullptr;
+};
+
+// shared by the threads of one computation of total work units
+class ProgressTracker {
+public:
+  ProgressTracker(const Progress &progress, size_t total)
+      : progress(progress), total(total == 0 ? 1 : total) {}
+
+  auto cancelled() const -> bool {
+    return progress.token != nullptr && progress.token->isCancelled();
+  }
+
+  void advance(size_t units) {
+    const auto done = completed.fetch_add(units, std::memory_order_relaxed) +
+                      units;
+    if (!progress.callback) {
+      return;
+    }
+    const auto step = std::min(done, total) * 1000 / total;
+    if (step <= reported.load(std::memory_order_relaxed)) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (step <= reported.load(std::memory_order_relaxed)) {
+      return;
+    }
+    reported.store(step, std::memory_order_relaxed);
+    progress.callback(static_cast<double>(step) / 1000);
+  }
+
+  // called outside parallel regions, where throwing is safe
+  void throwIfCancelled() const {
+    if (cancelled()) {
+      throw OperationCancelled();
+    }
+  }
+
+private:
+  const Progress &progress;
+  size_t total;
+  std::atomic<size_t> completed{0};
+  std::atomic<size_t> reported{0};
+  std::mutex mutex;
+};
+
+} // namespace VolCorrelation
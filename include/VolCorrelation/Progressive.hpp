@@ -0,0 +1,426 @@
+#pragma once
+#include "BrickIndex.hpp"
+#include "Common.hpp"
+#include "MappedVolume.hpp"
+#include "Region.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <vector>
+namespace VolCorrelation {
+
+struct ProgressiveOptions {
+  // levels coarser than full resolution, each halving every dimension; fewer
+  // are built once a dimension drops below two bricks
+  uint32_t levels = 2;
+  // a finer level recomputes only the bricks whose coarser result varies more
+  // than this (around the brick) and upsamples the others; negative
+  // recomputes every brick, so the last level is exact
+  double varianceThreshold = -1;
+};
+
+// one level of a progressive result, values x fastest over dimensions
+template <typename Out> struct ProgressiveLevel {
+  // 0 is full resolution
+  uint32_t level = 0;
+  Vec3<uint32_t> dimensions;
+  std::vector<Out> values;
+  ResultRange range;
+  size_t bricks = 0;
+  size_t refinedBricks = 0;
+};
+
+template <typename Out>
+using ProgressiveCallback = std::function<void(const ProgressiveLevel<Out> &)>;
+
+inline auto coarserDimensions(const Vec3<uint32_t> &dimensions)
+    -> Vec3<uint32_t> {
+  return {(dimensions.x + 1) / 2, (dimensions.y + 1) / 2,
+          (dimensions.z + 1) / 2};
+}
+
+// mean of every 2x2x2 block, fewer voxels at odd edges; integers are rounded
+template <typename T>
+auto downsampleField(const T *field, const Vec3<uint32_t> &dimensions)
+    -> std::vector<std::remove_const_t<T>> {
+  using Value = std::remove_const_t<T>;
+  const auto coarse = coarserDimensions(dimensions);
+  const auto offsetZ = static_cast<size_t>(dimensions.x) * dimensions.y;
+  std::vector<Value> result(static_cast<size_t>(coarse.x) * coarse.y *
+                            coarse.z);
+  const auto rowNum = static_cast<int64_t>(coarse.y) * coarse.z;
+
+#pragma omp parallel for schedule(static)
+  for (int64_t row = 0; row < rowNum; row++) {
+    const auto y = static_cast<uint32_t>(row % coarse.y) * 2;
+    const auto z = static_cast<uint32_t>(row / coarse.y) * 2;
+    const auto yEnd = std::min(y + 2, dimensions.y);
+    const auto zEnd = std::min(z + 2, dimensions.z);
+    for (uint32_t x = 0; x < dimensions.x; x += 2) {
+      const auto xEnd = std::min(x + 2, dimensions.x);
+      double sum = 0;
+      for (auto k = z; k < zEnd; k++) {
+        for (auto j = y; j < yEnd; j++) {
+          for (auto i = x; i < xEnd; i++) {
+            sum += static_cast<double>(
+                field[k * offsetZ + static_cast<size_t>(j) * dimensions.x +
+                      i]);
+          }
+        }
+      }
+      const auto mean = sum / ((xEnd - x) * (yEnd - y) * (zEnd - z));
+      result[static_cast<size_t>(row) * coarse.x + x / 2] =
+          std::is_integral<Value>::value
+              ? static_cast<Value>(std::lround(mean))
+              : static_cast<Value>(mean);
+    }
+  }
+  return result;
+}
+
+// computes the measure at the coarsest level of a mipmap pyramid of the
+// fields, then refines level by level, handing every level to callback as
+// soon as it is done. measure(fields, dimensions, region, maxima, progress)
+// returns the RegionResult<Out> of one level's fields; each level is
+// normalized by its own maxima. Returns the full-resolution level.
+template <typename Out, typename T, typename Measure>
+auto progressiveResult(const std::vector<T *> &fields,
+                       const Vec3<uint32_t> &dimensions,
+                       const ProgressiveOptions &options, Measure measure,
+                       const ProgressiveCallback<Out> &callback,
+                       const Progress &progress) -> ProgressiveLevel<Out> {
+  using std::vector;
+  using Value = std::remove_const_t<T>;
+
+  // level 0 reads the fields in place, coarser levels own their data
+  vector<vector<vector<Value>>> data(1);
+  vector<vector<const Value *>> levels(1);
+  vector<Vec3<uint32_t>> levelDimensions{dimensions};
+  for (auto field : fields) {
+    levels[0].push_back(field);
+  }
+  while (levels.size() <= options.levels &&
+         std::min({levelDimensions.back().x, levelDimensions.back().y,
+                   levelDimensions.back().z}) >= 4 * BrickSize) {
+    const auto &finer = levels.back();
+    const auto finerDimensions = levelDimensions.back();
+    vector<vector<Value>> coarse;
+    for (auto field : finer) {
+      coarse.push_back(downsampleField(field, finerDimensions));
+    }
+    data.push_back(std::move(coarse));
+    levelDimensions.push_back(coarserDimensions(finerDimensions));
+    levels.emplace_back();
+    for (auto &field : data.back()) {
+      levels.back().push_back(field.data());
+    }
+  }
+
+  // kernels only see the token, progress is reported per level
+  size_t total = 0;
+  for (auto &d : levelDimensions) {
+    total += static_cast<size_t>(d.x) * d.y * d.z;
+  }
+  ProgressTracker tracker(progress, total);
+  Progress inner;
+  inner.token = progress.token;
+
+  auto maxima = [&](size_t level) {
+    const auto d = levelDimensions[level];
+    vector<double> result;
+    for (auto field : levels[level]) {
+      result.push_back(static_cast<double>(
+          fieldMax(field, static_cast<size_t>(d.x) * d.y * d.z)));
+    }
+    return result;
+  };
+
+  auto level = static_cast<uint32_t>(levels.size() - 1);
+  ProgressiveLevel<Out> current;
+  {
+    const auto d = levelDimensions[level];
+    auto result = measure(levels[level], d, Region{{0, 0, 0}, d},
+                          maxima(level), inner);
+    current.level = level;
+    current.dimensions = d;
+    current.values = std::move(result.values);
+    current.range = result.range;
+    current.bricks = current.refinedBricks =
+        static_cast<size_t>((d.x + BrickSize - 1) / BrickSize) *
+        ((d.y + BrickSize - 1) / BrickSize) *
+        ((d.z + BrickSize - 1) / BrickSize);
+    tracker.advance(current.values.size());
+    if (callback) {
+      callback(current);
+    }
+  }
+
+  while (level > 0) {
+    level--;
+    const auto coarse = current.dimensions;
+    const auto d = levelDimensions[level];
+    const auto levelMaxima = maxima(level);
+    const Vec3<uint32_t> bricks((d.x + BrickSize - 1) / BrickSize,
+                                (d.y + BrickSize - 1) / BrickSize,
+                                (d.z + BrickSize - 1) / BrickSize);
+
+    ProgressiveLevel<Out> next;
+    next.level = level;
+    next.dimensions = d;
+    next.values.resize(static_cast<size_t>(d.x) * d.y * d.z);
+    next.bricks = static_cast<size_t>(bricks.x) * bricks.y * bricks.z;
+
+    // whether a brick varies in the coarser result, over the coarse voxels
+    // it covers and their neighbors
+    auto varies = [&](uint32_t bx, uint32_t by, uint32_t bz) {
+      if (options.varianceThreshold < 0) {
+        return true;
+      }
+      const auto half = BrickSize / 2;
+      auto begin = [half](uint32_t b) {
+        return b * half > 0 ? b * half - 1 : 0;
+      };
+      auto end = [half](uint32_t b, uint32_t n) {
+        return std::min((b + 1) * half + 1, n);
+      };
+      double sum = 0, sqsum = 0, n = 0;
+      for (auto z = begin(bz); z < end(bz, coarse.z); z++) {
+        for (auto y = begin(by); y < end(by, coarse.y); y++) {
+          for (auto x = begin(bx); x < end(bx, coarse.x); x++) {
+            const auto value = decodeResult(
+                current.values[(static_cast<size_t>(z) * coarse.y + y) *
+                                   coarse.x +
+                               x]);
+            sum += value;
+            sqsum += value * value;
+            n++;
+          }
+        }
+      }
+      const auto mean = sum / n;
+      return sqsum / n - mean * mean > options.varianceThreshold;
+    };
+
+    vector<uint8_t> refines(next.bricks);
+    for (uint32_t bz = 0; bz < bricks.z; bz++) {
+      for (uint32_t by = 0; by < bricks.y; by++) {
+        for (uint32_t bx = 0; bx < bricks.x; bx++) {
+          refines[(static_cast<size_t>(bz) * bricks.y + by) * bricks.x + bx] =
+              varies(bx, by, bz);
+        }
+      }
+    }
+    auto rowRefined = [&](uint32_t by, uint32_t bz) {
+      const auto row = refines.begin() +
+                       (static_cast<size_t>(bz) * bricks.y + by) * bricks.x;
+      return std::all_of(row, row + bricks.x, [](uint8_t r) { return r; });
+    };
+    auto layerRefined = [&](uint32_t bz) {
+      for (uint32_t by = 0; by < bricks.y; by++) {
+        if (!rowRefined(by, bz)) {
+          return false;
+        }
+      }
+      return true;
+    };
+
+    // the bricks [b0, b1) as a region of the level
+    auto bricksRegion = [&](const Vec3<uint32_t> &b0,
+                            const Vec3<uint32_t> &b1) {
+      return Region{{b0.x * BrickSize, b0.y * BrickSize, b0.z * BrickSize},
+                    {std::min(b1.x * BrickSize, d.x),
+                     std::min(b1.y * BrickSize, d.y),
+                     std::min(b1.z * BrickSize, d.z)}};
+    };
+    auto refine = [&](const Vec3<uint32_t> &b0, const Vec3<uint32_t> &b1) {
+      const auto region = bricksRegion(b0, b1);
+      const auto size = region.dimensions();
+      auto result = measure(levels[level], d, region, levelMaxima, inner);
+      next.range.merge(result.range);
+      next.refinedBricks +=
+          static_cast<size_t>(b1.x - b0.x) * (b1.y - b0.y) * (b1.z - b0.z);
+      tracker.advance(region.size());
+      if (result.values.size() == next.values.size()) {
+        next.values = std::move(result.values);
+        return;
+      }
+      auto value = result.values.begin();
+      for (auto z = region.begin.z; z < region.end.z; z++) {
+        for (auto y = region.begin.y; y < region.end.y; y++) {
+          std::copy_n(value, size.x,
+                      next.values.begin() +
+                          (static_cast<size_t>(z) * d.y + y) * d.x +
+                          region.begin.x);
+          value += size.x;
+        }
+      }
+    };
+    auto upsample = [&](const Vec3<uint32_t> &b0, const Vec3<uint32_t> &b1) {
+      const auto region = bricksRegion(b0, b1);
+      for (auto z = region.begin.z; z < region.end.z; z++) {
+        for (auto y = region.begin.y; y < region.end.y; y++) {
+          const auto row = (static_cast<size_t>(z) * d.y + y) * d.x;
+          const auto coarseRow =
+              (static_cast<size_t>(z / 2) * coarse.y + y / 2) * coarse.x;
+          for (auto x = region.begin.x; x < region.end.x; x++) {
+            const auto value = current.values[coarseRow + x / 2];
+            next.range.add(decodeResult(value));
+            next.values[row + x] = value;
+          }
+        }
+      }
+      tracker.advance(region.size());
+    };
+
+    // refined bricks are merged into as few regions as possible, as each
+    // region reads its halo again: runs of whole brick layers, then runs of
+    // whole brick rows, then runs along x
+    for (uint32_t bz = 0; bz < bricks.z && !tracker.cancelled();) {
+      auto lastZ = bz;
+      while (lastZ < bricks.z && layerRefined(lastZ)) {
+        lastZ++;
+      }
+      if (lastZ > bz) {
+        refine({0, 0, bz}, {bricks.x, bricks.y, lastZ});
+        bz = lastZ;
+        continue;
+      }
+      for (uint32_t by = 0; by < bricks.y && !tracker.cancelled();) {
+        auto lastY = by;
+        while (lastY < bricks.y && rowRefined(lastY, bz)) {
+          lastY++;
+        }
+        if (lastY > by) {
+          refine({0, by, bz}, {bricks.x, lastY, bz + 1});
+          by = lastY;
+          continue;
+        }
+        const auto row = (static_cast<size_t>(bz) * bricks.y + by) * bricks.x;
+        for (uint32_t bx = 0; bx < bricks.x;) {
+          auto lastX = bx + 1;
+          while (lastX < bricks.x &&
+                 refines[row + lastX] == refines[row + bx]) {
+            lastX++;
+          }
+          if (refines[row + bx]) {
+            refine({bx, by, bz}, {lastX, by + 1, bz + 1});
+          } else {
+            upsample({bx, by, bz}, {lastX, by + 1, bz + 1});
+          }
+          bx = lastX;
+        }
+        by++;
+      }
+      bz++;
+    }
+    tracker.throwIfCancelled();
+    current = std::move(next);
+    if (callback) {
+      callback(current);
+    }
+  }
+  return current;
+}
+
+// progressive calculateGradientSimilarity, see progressiveResult. Coarser
+// levels use the same stencil, which spans more of the volume.
+template <typename Out, typename T, typename ResultType = double>
+auto calculateGradientSimilarityProgressive(
+    const std::vector<T *> &fields, const Vec3<uint32_t> &dimensions,
+    int sensitivity = 2, const ProgressiveOptions &options = {},
+    const ProgressiveCallback<Out> &callback = {},
+    const Progress &progress = {}) -> ProgressiveLevel<Out> {
+  using Value = std::remove_const_t<T>;
+  return progressiveResult<Out>(
+      fields, dimensions, options,
+      [sensitivity](const std::vector<const Value *> &levelFields,
+                    const Vec3<uint32_t> &levelDimensions,
+                    const Region &region, const std::vector<double> &maxima,
+                    const Progress &progress) {
+        return calculateGradientSimilarity<const Value, ResultType, Out>(
+            levelFields, levelDimensions, region, sensitivity, maxima,
+            progress);
+      },
+      callback, progress);
+}
+
+// progressive calcLocalCorrelationCoefficient, see progressiveResult.
+// Coarser levels use the same windowSize, which spans more of the volume.
+template <typename Out, typename T, typename ResultType = double>
+auto calcLocalCorrelationCoefficientProgressive(
+    const std::vector<T *> &fields, const Vec3<uint32_t> &dimensions,
+    int windowSize = 3, const ProgressiveOptions &options = {},
+    const ProgressiveCallback<Out> &callback = {},
+    const Progress &progress = {}) -> ProgressiveLevel<Out> {
+  using Value = std::remove_const_t<T>;
+  return progressiveResult<Out>(
+      fields, dimensions, options,
+      [windowSize](const std::vector<const Value *> &levelFields,
+                   const Vec3<uint32_t> &levelDimensions,
+                   const Region &region, const std::vector<double> &maxima,
+                   const Progress &progress) {
+        return calcLocalCorrelationCoefficient<const Value, ResultType, Out>(
+            levelFields, levelDimensions, region, windowSize, maxima,
+            progress);
+      },
+      callback, progress);
+}
+
+template <typename Out, typename ResultType = double>
+auto calculateGradientSimilarityProgressive(
+    const std::vector<const MappedVolume *> &volumes, int sensitivity = 2,
+    const ProgressiveOptions &options = {},
+    const ProgressiveCallback<Out> &callback = {},
+    const Progress &progress = {}) -> ProgressiveLevel<Out> {
+  return visitVolumes(volumes, [&](const auto &fields) {
+    using Field = typename std::decay_t<decltype(fields)>::value_type;
+    using T = std::remove_pointer_t<Field>;
+    return calculateGradientSimilarityProgressive<Out, T, ResultType>(
+        fields, volumes[0]->getDimensions(), sensitivity, options, callback,
+        progress);
+  });
+}
+
+template <typename Out, typename ResultType = double>
+auto calcLocalCorrelationCoefficientProgressive(
+    const std::vector<const MappedVolume *> &volumes, int windowSize = 3,
+    const ProgressiveOptions &options = {},
+    const ProgressiveCallback<Out> &callback = {},
+    const Progress &progress = {}) -> ProgressiveLevel<Out> {
+  return visitVolumes(volumes, [&](const auto &fields) {
+    using Field = typename std::decay_t<decltype(fields)>::value_type;
+    using T = std::remove_pointer_t<Field>;
+    return calcLocalCorrelationCoefficientProgressive<Out, T, ResultType>(
+        fields, volumes[0]->getDimensions(), windowSize, options, callback,
+        progress);
+  });
+}
+
+// nearest-neighbor upsampling of a level to the full-resolution dimensions,
+// e.g. to show a preview where the full volume is expected
+template <typename Out>
+auto upsampleLevel(const ProgressiveLevel<Out> &level,
+                   const Vec3<uint32_t> &dimensions) -> std::vector<Out> {
+  if (level.level == 0) {
+    return level.values;
+  }
+  const auto shift = level.level;
+  const auto d = level.dimensions;
+  std::vector<Out> result(static_cast<size_t>(dimensions.x) * dimensions.y *
+                          dimensions.z);
+  auto out = result.begin();
+  for (uint32_t z = 0; z < dimensions.z; z++) {
+    for (uint32_t y = 0; y < dimensions.y; y++) {
+      const auto row =
+          level.values.data() +
+          (static_cast<size_t>(z >> shift) * d.y + (y >> shift)) * d.x;
+      for (uint32_t x = 0; x < dimensions.x; x++) {
+        *out++ = row[x >> shift];
+      }
+    }
+  }
+  return result;
+}
+
+} // namespace VolCorrelation
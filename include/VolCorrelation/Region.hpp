@@ -0,0 +1,398 @@
+#pragma once
+#include "Common.hpp"
+#include "GradientSimilarityMeasure.hpp"
+#include "LocalCorrelationCoefficient.hpp"
+#include "MappedVolume.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+namespace VolCorrelation {
+
+// box of voxels [begin, end) of a volume
+struct Region {
+  Vec3<uint32_t> begin;
+  Vec3<uint32_t> end;
+
+  auto dimensions() const -> Vec3<uint32_t> {
+    return {end.x - begin.x, end.y - begin.y, end.z - begin.z};
+  }
+  auto size() const -> size_t {
+    const auto d = dimensions();
+    return static_cast<size_t>(d.x) * d.y * d.z;
+  }
+};
+
+// a measure computed on a region only: values holds dimensions voxels, x
+// fastest, and its voxel (x, y, z) is voxel offset + (x, y, z) of the volume
+template <typename Out> struct RegionResult {
+  std::vector<Out> values;
+  Vec3<uint32_t> offset;
+  Vec3<uint32_t> dimensions;
+  ResultRange range;
+};
+
+inline void checkRegion(const Region &region,
+                        const Vec3<uint32_t> &dimensions) {
+  if (region.begin.x >= region.end.x || region.begin.y >= region.end.y ||
+      region.begin.z >= region.end.z || region.end.x > dimensions.x ||
+      region.end.y > dimensions.y || region.end.z > dimensions.z) {
+    throw std::invalid_argument("region is empty or exceeds the volume");
+  }
+}
+
+// region grown by halo on every side, clamped to the volume
+inline auto growRegion(const Region &region, uint32_t halo,
+                       const Vec3<uint32_t> &dimensions) -> Region {
+  auto grow = [halo](uint32_t begin) {
+    return begin > halo ? begin - halo : 0;
+  };
+  return {{grow(region.begin.x), grow(region.begin.y), grow(region.begin.z)},
+          {std::min(region.end.x + halo, dimensions.x),
+           std::min(region.end.y + halo, dimensions.y),
+           std::min(region.end.z + halo, dimensions.z)}};
+}
+
+// the voxels of region copied out of field, x fastest
+template <typename T>
+auto copyRegion(const T *field, const Vec3<uint32_t> &dimensions,
+                const Region &region) -> std::vector<std::remove_const_t<T>> {
+  const auto size = region.dimensions();
+  std::vector<std::remove_const_t<T>> copy(region.size());
+  auto out = copy.begin();
+  for (auto z = region.begin.z; z < region.end.z; z++) {
+    for (auto y = region.begin.y; y < region.end.y; y++) {
+      const auto row = field + (static_cast<size_t>(z) * dimensions.y + y) *
+                                   dimensions.x +
+                       region.begin.x;
+      out = std::copy(row, row + size.x, out);
+    }
+  }
+  return copy;
+}
+
+// what each field is normalized by: the given maxima, or the maximum of each
+// field, which reads the whole field
+template <typename T, typename ResultType>
+auto regionMaxima(const std::vector<T *> &fields, size_t size,
+                  const std::vector<double> &maxima)
+    -> std::vector<ResultType> {
+  if (!maxima.empty() && maxima.size() != fields.size()) {
+    throw std::invalid_argument("one maximum per field expected");
+  }
+  std::vector<ResultType> result;
+  for (size_t i = 0; i < fields.size(); i++) {
+    result.push_back(maxima.empty()
+                         ? static_cast<ResultType>(fieldMax(fields[i], size))
+                         : static_cast<ResultType>(maxima[i]));
+  }
+  return result;
+}
+
+// runs kernel, a slab kernel over a box, with every field normalized by its
+// global maximum, so each voxel of region sees the neighborhood it has in a
+// full-volume pass and gets the same value. When region grown by halo spans
+// whole slices the kernel reads the fields in place, otherwise a copy of the
+// grown region. Only region's voxels are evaluated, the halo is only read;
+// values receives them as Result (ResultType or an encoded Out), their range
+// is added to range if given and tracker advances by region's rows.
+template <typename T, typename ResultType, typename Result, typename Kernel>
+void computeRegion(const std::vector<T *> &fields,
+                   const Vec3<uint32_t> &dimensions, const Region &region,
+                   const std::vector<ResultType> &maxima, uint32_t halo,
+                   Kernel kernel, Result *values, ResultRange *range,
+                   ProgressTracker *tracker) {
+  using Value = std::remove_const_t<T>;
+
+  const auto grown = growRegion(region, halo, dimensions);
+  const auto size = region.dimensions();
+  // region inside the grown region
+  const Vec3<uint32_t> begin(region.begin.x - grown.begin.x,
+                             region.begin.y - grown.begin.y,
+                             region.begin.z - grown.begin.z);
+  const Vec3<uint32_t> end(begin.x + size.x, begin.y + size.y,
+                           begin.z + size.z);
+
+  std::vector<NormalizedField<Value, ResultType>> normalizeds;
+  if (grown.begin.x == 0 && grown.begin.y == 0 &&
+      grown.end.x == dimensions.x && grown.end.y == dimensions.y) {
+    const auto offset =
+        static_cast<size_t>(grown.begin.z) * dimensions.x * dimensions.y;
+    for (size_t i = 0; i < fields.size(); i++) {
+      normalizeds.push_back({fields[i] + offset, maxima[i]});
+    }
+    kernel(normalizeds, grown.dimensions(), begin, end, values, range,
+           tracker);
+    return;
+  }
+
+  std::vector<std::vector<Value>> copies;
+  for (size_t i = 0; i < fields.size(); i++) {
+    copies.push_back(copyRegion(fields[i], dimensions, grown));
+    normalizeds.push_back({copies.back().data(), maxima[i]});
+  }
+  kernel(normalizeds, grown.dimensions(), begin, end, values, range, tracker);
+}
+
+template <typename T, typename ResultType, typename Out, typename Kernel>
+auto regionResult(const std::vector<T *> &fields,
+                  const Vec3<uint32_t> &dimensions, const Region &region,
+                  const std::vector<double> &maxima, uint32_t halo,
+                  Kernel kernel, const Progress &progress)
+    -> RegionResult<Out> {
+  checkRegion(region, dimensions);
+  const auto size = static_cast<size_t>(dimensions.x) * dimensions.y *
+                    dimensions.z;
+  const auto fieldMaxima = regionMaxima<T, ResultType>(fields, size, maxima);
+
+  ProgressTracker tracker(progress, static_cast<size_t>(region.end.y -
+                                                        region.begin.y) *
+                                        (region.end.z - region.begin.z));
+  RegionResult<Out> result;
+  result.offset = region.begin;
+  result.dimensions = region.dimensions();
+  result.values.resize(region.size());
+  computeRegion(fields, dimensions, region, fieldMaxima, halo, kernel,
+                result.values.data(), &result.range, &tracker);
+  tracker.throwIfCancelled();
+  return result;
+}
+
+// voxels are grouped by brick and each group is computed as the region it
+// spans, so a spatially coherent mask costs about its own size plus halos;
+// the values follow the order of voxels
+template <typename T, typename ResultType, typename Out, typename Kernel>
+auto maskedResult(const std::vector<T *> &fields,
+                  const Vec3<uint32_t> &dimensions,
+                  const std::vector<Vec3<uint32_t>> &voxels,
+                  const std::vector<double> &maxima, uint32_t halo,
+                  Kernel kernel, const Progress &progress)
+    -> QuantizedResult<Out> {
+  using std::vector;
+
+  const auto bricksX = (dimensions.x + BrickSize - 1) / BrickSize;
+  const auto bricksY = (dimensions.y + BrickSize - 1) / BrickSize;
+  auto brickOf = [&](const Vec3<uint32_t> &voxel) {
+    return (static_cast<size_t>(voxel.z / BrickSize) * bricksY +
+            voxel.y / BrickSize) *
+               bricksX +
+           voxel.x / BrickSize;
+  };
+  for (auto &voxel : voxels) {
+    if (voxel.x >= dimensions.x || voxel.y >= dimensions.y ||
+        voxel.z >= dimensions.z) {
+      throw std::invalid_argument("voxel exceeds the volume");
+    }
+  }
+  const auto size = static_cast<size_t>(dimensions.x) * dimensions.y *
+                    dimensions.z;
+  const auto fieldMaxima = regionMaxima<T, ResultType>(fields, size, maxima);
+
+  vector<size_t> order(voxels.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return brickOf(voxels[a]) < brickOf(voxels[b]);
+  });
+
+  // the region spanned by each brick's voxels, as ends into order
+  vector<Region> regions;
+  vector<size_t> ends;
+  size_t rows = 0;
+  for (size_t first = 0; first < order.size();) {
+    const auto brick = brickOf(voxels[order[first]]);
+    Region region{voxels[order[first]], voxels[order[first]]};
+    auto last = first;
+    for (; last < order.size() && brickOf(voxels[order[last]]) == brick;
+         last++) {
+      const auto &voxel = voxels[order[last]];
+      region.begin = {std::min(region.begin.x, voxel.x),
+                      std::min(region.begin.y, voxel.y),
+                      std::min(region.begin.z, voxel.z)};
+      region.end = {std::max(region.end.x, voxel.x),
+                    std::max(region.end.y, voxel.y),
+                    std::max(region.end.z, voxel.z)};
+    }
+    region.end = {region.end.x + 1, region.end.y + 1, region.end.z + 1};
+    rows += static_cast<size_t>(region.end.y - region.begin.y) *
+            (region.end.z - region.begin.z);
+    regions.push_back(region);
+    ends.push_back(last);
+    first = last;
+  }
+
+  QuantizedResult<Out> result;
+  result.values.resize(voxels.size());
+  ProgressTracker tracker(progress, rows);
+  vector<ResultType> values;
+  size_t first = 0;
+  for (size_t r = 0; r < regions.size() && !tracker.cancelled(); r++) {
+    const auto &region = regions[r];
+    const auto size = region.dimensions();
+    values.resize(region.size());
+    computeRegion(fields, dimensions, region, fieldMaxima, halo, kernel,
+                  values.data(), nullptr, &tracker);
+    for (; first < ends[r]; first++) {
+      const auto &voxel = voxels[order[first]];
+      const auto value =
+          values[(static_cast<size_t>(voxel.z - region.begin.z) * size.y +
+                  voxel.y - region.begin.y) *
+                     size.x +
+                 voxel.x - region.begin.x];
+      result.range.add(static_cast<double>(value));
+      result.values[order[first]] = encodeResult<Out>(value);
+    }
+  }
+  tracker.throwIfCancelled();
+  return result;
+}
+
+// calculateGradientSimilarity of the voxels of region only: the fields are
+// read over region plus the one voxel halo of the stencil, normalized by
+// their global maxima (read from the whole fields unless given), and the
+// values equal those of a full-volume pass
+template <typename T, typename ResultType = double, typename Out = ResultType>
+auto calculateGradientSimilarity(const std::vector<T *> &fields,
+                                 const Vec3<uint32_t> &dimensions,
+                                 const Region &region, int sensitivity = 2,
+                                 const std::vector<double> &maxima = {},
+                                 const Progress &progress = {})
+    -> RegionResult<Out> {
+  return regionResult<T, ResultType, Out>(
+      fields, dimensions, region, maxima, 1,
+      [sensitivity](const auto &normalizeds, const Vec3<uint32_t> &dimensions,
+                    const Vec3<uint32_t> &begin, const Vec3<uint32_t> &end,
+                    auto *result, ResultRange *range,
+                    ProgressTracker *tracker) {
+        calculateGradientSimilaritySlab(normalizeds, dimensions, begin, end,
+                                        sensitivity, result, range, tracker);
+      },
+      progress);
+}
+
+// calculateGradientSimilarity of the given voxels only, in their order
+template <typename T, typename ResultType = double, typename Out = ResultType>
+auto calculateGradientSimilarity(const std::vector<T *> &fields,
+                                 const Vec3<uint32_t> &dimensions,
+                                 const std::vector<Vec3<uint32_t>> &voxels,
+                                 int sensitivity = 2,
+                                 const std::vector<double> &maxima = {},
+                                 const Progress &progress = {})
+    -> QuantizedResult<Out> {
+  return maskedResult<T, ResultType, Out>(
+      fields, dimensions, voxels, maxima, 1,
+      [sensitivity](const auto &normalizeds, const Vec3<uint32_t> &dimensions,
+                    const Vec3<uint32_t> &begin, const Vec3<uint32_t> &end,
+                    auto *result, ResultRange *range,
+                    ProgressTracker *tracker) {
+        calculateGradientSimilaritySlab(normalizeds, dimensions, begin, end,
+                                        sensitivity, result, range, tracker);
+      },
+      progress);
+}
+
+// calcLocalCorrelationCoefficient of the voxels of region only, read over
+// region plus the windowSize halo, see calculateGradientSimilarity
+template <typename T, typename ResultType = double, typename Out = ResultType>
+auto calcLocalCorrelationCoefficient(const std::vector<T *> &fields,
+                                     const Vec3<uint32_t> &dimensions,
+                                     const Region &region, int windowSize = 3,
+                                     const std::vector<double> &maxima = {},
+                                     const Progress &progress = {})
+    -> RegionResult<Out> {
+  return regionResult<T, ResultType, Out>(
+      fields, dimensions, region, maxima, static_cast<uint32_t>(windowSize),
+      [windowSize](const auto &normalizeds, const Vec3<uint32_t> &dimensions,
+                   const Vec3<uint32_t> &begin, const Vec3<uint32_t> &end,
+                   auto *result, ResultRange *range, ProgressTracker *tracker) {
+        calcLocalCorrelationCoefficientSlab(normalizeds, dimensions, begin,
+                                            end, windowSize, result, range,
+                                            tracker);
+      },
+      progress);
+}
+
+// calcLocalCorrelationCoefficient of the given voxels only, in their order
+template <typename T, typename ResultType = double, typename Out = ResultType>
+auto calcLocalCorrelationCoefficient(const std::vector<T *> &fields,
+                                     const Vec3<uint32_t> &dimensions,
+                                     const std::vector<Vec3<uint32_t>> &voxels,
+                                     int windowSize = 3,
+                                     const std::vector<double> &maxima = {},
+                                     const Progress &progress = {})
+    -> QuantizedResult<Out> {
+  return maskedResult<T, ResultType, Out>(
+      fields, dimensions, voxels, maxima, static_cast<uint32_t>(windowSize),
+      [windowSize](const auto &normalizeds, const Vec3<uint32_t> &dimensions,
+                   const Vec3<uint32_t> &begin, const Vec3<uint32_t> &end,
+                   auto *result, ResultRange *range, ProgressTracker *tracker) {
+        calcLocalCorrelationCoefficientSlab(normalizeds, dimensions, begin,
+                                            end, windowSize, result, range,
+                                            tracker);
+      },
+      progress);
+}
+
+// mapped volumes only fault in the pages of the grown region, unless the
+// maxima are left to be read from the whole fields
+template <typename ResultType = double, typename Out = ResultType>
+auto calculateGradientSimilarity(
+    const std::vector<const MappedVolume *> &volumes, const Region &region,
+    int sensitivity = 2, const std::vector<double> &maxima = {},
+    const Progress &progress = {}) -> RegionResult<Out> {
+  return visitVolumes(volumes, [&](const auto &fields) {
+    using Field = typename std::decay_t<decltype(fields)>::value_type;
+    using T = std::remove_pointer_t<Field>;
+    return calculateGradientSimilarity<T, ResultType, Out>(
+        fields, volumes[0]->getDimensions(), region, sensitivity, maxima,
+        progress);
+  });
+}
+
+template <typename ResultType = double, typename Out = ResultType>
+auto calculateGradientSimilarity(
+    const std::vector<const MappedVolume *> &volumes,
+    const std::vector<Vec3<uint32_t>> &voxels, int sensitivity = 2,
+    const std::vector<double> &maxima = {}, const Progress &progress = {})
+    -> QuantizedResult<Out> {
+  return visitVolumes(volumes, [&](const auto &fields) {
+    using Field = typename std::decay_t<decltype(fields)>::value_type;
+    using T = std::remove_pointer_t<Field>;
+    return calculateGradientSimilarity<T, ResultType, Out>(
+        fields, volumes[0]->getDimensions(), voxels, sensitivity, maxima,
+        progress);
+  });
+}
+
+template <typename ResultType = double, typename Out = ResultType>
+auto calcLocalCorrelationCoefficient(
+    const std::vector<const MappedVolume *> &volumes, const Region &region,
+    int windowSize = 3, const std::vector<double> &maxima = {},
+    const Progress &progress = {}) -> RegionResult<Out> {
+  return visitVolumes(volumes, [&](const auto &fields) {
+    using Field = typename std::decay_t<decltype(fields)>::value_type;
+    using T = std::remove_pointer_t<Field>;
+    return calcLocalCorrelationCoefficient<T, ResultType, Out>(
+        fields, volumes[0]->getDimensions(), region, windowSize, maxima,
+        progress);
+  });
+}
+
+template <typename ResultType = double, typename Out = ResultType>
+auto calcLocalCorrelationCoefficient(
+    const std::vector<const MappedVolume *> &volumes,
+    const std::vector<Vec3<uint32_t>> &voxels, int windowSize = 3,
+    const std::vector<double> &maxima = {}, const Progress &progress = {})
+    -> QuantizedResult<Out> {
+  return visitVolumes(volumes, [&](const auto &fields) {
+    using Field = typename std::decay_t<decltype(fields)>::value_type;
+    using T = std::remove_pointer_t<Field>;
+    return calcLocalCorrelationCoefficient<T, ResultType, Out>(
+        fields, volumes[0]->getDimensions(), voxels, windowSize, maxima,
+        progress);
+  });
+}
+
+} // namespace VolCorrelation
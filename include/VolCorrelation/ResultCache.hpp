@@ -0,0 +1,273 @@
+#pragma once
+#include "Common.hpp"
+#include "MappedVolume.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+namespace VolCorrelation {
+
+// bytes hashed as one unit, chunks are hashed in parallel and combined in
+// order, so the hash does not depend on the thread count
+constexpr size_t HashChunkSize = 1024 * 1024;
+
+inline auto mixHash(uint64_t x) -> uint64_t {
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+}
+
+// FNV-1a over 8 byte words, with a multiply-rotate step per word so that
+// every input bit reaches every hash bit
+inline auto hashChunk(const uint8_t *data, size_t bytes) -> uint64_t {
+  auto hash = static_cast<uint64_t>(0xCBF29CE484222325ull);
+  size_t idx = 0;
+  for (; idx + 8 <= bytes; idx += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + idx, sizeof(word));
+    word *= 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ (word << 31 | word >> 33)) * 0x100000001B3ull;
+  }
+  for (; idx < bytes; idx++) {
+    hash = (hash ^ data[idx]) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+// 64 bit hash of the content of a buffer
+inline auto contentHash(const void *data, size_t bytes) -> uint64_t {
+  const auto bytePtr = static_cast<const uint8_t *>(data);
+  const auto chunkNum = (bytes + HashChunkSize - 1) / HashChunkSize;
+  std::vector<uint64_t> chunks(chunkNum);
+
+#pragma omp parallel for schedule(static)
+  for (int64_t chunk = 0; chunk < static_cast<int64_t>(chunkNum); chunk++) {
+    const auto begin = static_cast<size_t>(chunk) * HashChunkSize;
+    const auto size = std::min(HashChunkSize, bytes - begin);
+    chunks[chunk] = hashChunk(bytePtr + begin, size);
+  }
+
+  auto hash = mixHash(bytes);
+  for (auto chunk : chunks) {
+    hash = mixHash(hash ^ chunk);
+  }
+  return hash;
+}
+
+template <typename T>
+auto contentHash(const T *field, size_t size) -> uint64_t {
+  return contentHash(static_cast<const void *>(field), size * sizeof(T));
+}
+
+// a mapped volume's data together with its type and dimensions
+inline auto contentHash(const MappedVolume &volume) -> uint64_t {
+  const auto dimensions = volume.getDimensions();
+  auto hash = contentHash(volume.bytes(),
+                          volume.voxelCount() * dataTypeSize(volume.type()));
+  hash = mixHash(hash ^ static_cast<uint64_t>(volume.type()));
+  hash = mixHash(hash ^ dimensions.x);
+  hash = mixHash(hash ^ (static_cast<uint64_t>(dimensions.y) << 32 |
+                         dimensions.z));
+  return hash;
+}
+
+// name of a cache entry: what was computed, from which content hashes and
+// with which parameters
+class CacheKey {
+public:
+  explicit CacheKey(std::string kind) : kind(std::move(kind)) {}
+
+  template <typename T> auto add(const T &value) -> CacheKey & {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "cache key parts are hashed by their bytes");
+    hash = mixHash(hash ^ hashChunk(reinterpret_cast<const uint8_t *>(&value),
+                                    sizeof(T)));
+    return *this;
+  }
+
+  template <typename T> auto add(const std::vector<T> &values) -> CacheKey & {
+    add(values.size());
+    for (const auto &value : values) {
+      add(value);
+    }
+    return *this;
+  }
+
+  auto name() const -> std::string {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(16, '0');
+    for (int i = 0; i < 16; i++) {
+      hex[15 - i] = digits[(hash >> (4 * i)) & 0xF];
+    }
+    return kind + "-" + hex;
+  }
+
+private:
+  std::string kind;
+  uint64_t hash = 0;
+};
+
+// VOLCORRELATION_CACHE if set, else volcorrelation_cache in the working
+// directory
+inline auto defaultCacheDirectory() -> std::string {
+  if (auto directory = std::getenv("VOLCORRELATION_CACHE")) {
+    return directory;
+  }
+  return "volcorrelation_cache";
+}
+
+// results stored on disk under their CacheKey, one file per entry. A missing,
+// truncated or mismatched entry is a miss, and failing to store one is not an
+// error, so the cache never changes a result, only whether it is recomputed.
+class ResultCache {
+public:
+  explicit ResultCache(std::string directory = defaultCacheDirectory())
+      : directory(std::move(directory)) {}
+
+  auto path(const CacheKey &key) const -> std::string {
+    return (std::filesystem::path(directory) / (key.name() + ".bin")).string();
+  }
+
+  template <typename T>
+  auto load(const CacheKey &key, std::vector<T> &values) const -> bool {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "cached values are stored by their bytes");
+    std::ifstream in(path(key), std::ios::binary);
+    Header header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        header.magic != Magic || header.elementSize != sizeof(T)) {
+      return false;
+    }
+    // the count must match the file before anything is allocated for it
+    in.seekg(0, std::ios::end);
+    const auto bytes = static_cast<uint64_t>(in.tellg()) - sizeof(header);
+    if (!in || bytes % sizeof(T) != 0 || bytes / sizeof(T) != header.count) {
+      return false;
+    }
+    in.seekg(sizeof(header));
+    std::vector<T> loaded(static_cast<size_t>(header.count));
+    if (!in.read(reinterpret_cast<char *>(loaded.data()),
+                 static_cast<std::streamsize>(loaded.size() * sizeof(T)))) {
+      return false;
+    }
+    values = std::move(loaded);
+    return true;
+  }
+
+  // written to a temporary file of its own that is then renamed over the
+  // entry, so a concurrent or interrupted run never sees half an entry
+  template <typename T>
+  auto store(const CacheKey &key, const std::vector<T> &values) const -> bool {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "cached values are stored by their bytes");
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    const auto target = path(key);
+    const auto temporary = target + "." + temporarySuffix() + ".tmp";
+    {
+      std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+      Header header;
+      header.elementSize = sizeof(T);
+      header.count = values.size();
+      out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      out.write(reinterpret_cast<const char *>(values.data()),
+                static_cast<std::streamsize>(values.size() * sizeof(T)));
+      if (!out) {
+        out.close();
+        std::filesystem::remove(temporary, error);
+        return false;
+      }
+    }
+    std::filesystem::rename(temporary, target, error);
+    return !error;
+  }
+
+  // square matrices, stored row by row
+  auto loadMatrix(const CacheKey &key,
+                  std::vector<std::vector<double>> &matrix) const -> bool {
+    std::vector<double> values;
+    if (!load(key, values) || values.empty()) {
+      return false;
+    }
+    const auto n = static_cast<size_t>(values[0]);
+    if (values.size() != 1 + n * n) {
+      return false;
+    }
+    matrix.assign(n, std::vector<double>(n));
+    for (size_t i = 0; i < n; i++) {
+      std::copy_n(values.begin() + 1 + i * n, n, matrix[i].begin());
+    }
+    return true;
+  }
+
+  auto storeMatrix(const CacheKey &key,
+                   const std::vector<std::vector<double>> &matrix) const
+      -> bool {
+    std::vector<double> values{static_cast<double>(matrix.size())};
+    for (auto &row : matrix) {
+      values.insert(values.end(), row.begin(), row.end());
+    }
+    return store(key, values);
+  }
+
+  // a result volume and its range, kept as two entries
+  template <typename Out>
+  auto loadResult(const CacheKey &key, QuantizedResult<Out> &result) const
+      -> bool {
+    std::vector<double> range;
+    if (!load(CacheKey(key).add(RangeTag), range) || range.size() != 2 ||
+        !load(key, result.values)) {
+      return false;
+    }
+    result.range.min = range[0];
+    result.range.max = range[1];
+    return true;
+  }
+
+  template <typename Out>
+  auto storeResult(const CacheKey &key,
+                   const QuantizedResult<Out> &result) const -> bool {
+    const std::vector<double> range{result.range.min, result.range.max};
+    return store(key, result.values) &&
+           store(CacheKey(key).add(RangeTag), range);
+  }
+
+private:
+  static constexpr uint32_t Magic = 0x43524356; // "VCRC"
+  static constexpr uint32_t RangeTag = 0x52414E47;
+
+  // differs between processes, threads and calls
+  static auto temporarySuffix() -> std::string {
+    static std::atomic<uint64_t> calls{0};
+    const auto seed =
+        mixHash(std::random_device()()) ^
+        mixHash(std::hash<std::thread::id>()(std::this_thread::get_id())) ^
+        mixHash(static_cast<uint64_t>(
+            std::chrono::steady_clock::now().time_since_epoch().count())) ^
+        mixHash(calls++);
+    return CacheKey("").add(seed).name().substr(1);
+  }
+
+  struct Header {
+    uint32_t magic = Magic;
+    uint32_t elementSize = 0;
+    uint64_t count = 0;
+  };
+
+  std::string directory;
+};
+
+} // namespace VolCorrelation
@@ -0,0 +1,198 @@
+#pragma once
+#include "Common.hpp"
+#include "GradientSimilarityMeasure.hpp"
+#include "LocalCorrelationCoefficient.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+namespace VolCorrelation {
+
+// reads z-slabs of a raw volume file of T, stored x fastest
+template <typename T> class RawSlabReader {
+public:
+  RawSlabReader(const std::string &path, uint32_t width, uint32_t height,
+                uint32_t depth)
+      : in(path, std::ios::binary), path(path),
+        offsetZ(static_cast<size_t>(width) * height), depth(depth) {
+    if (!in.is_open()) {
+      throw std::runtime_error("failed to open " + path);
+    }
+  }
+
+  // reads slices [zBegin, zEnd) into out
+  void read(uint32_t zBegin, uint32_t zEnd, T *out) {
+    VOLCORRELATION_TRACE_SCOPE("load");
+    const auto bytes = (zEnd - zBegin) * offsetZ * sizeof(T);
+    in.seekg(static_cast<std::streamoff>(zBegin * offsetZ * sizeof(T)));
+    in.read(reinterpret_cast<char *>(out), static_cast<std::streamsize>(bytes));
+    if (static_cast<size_t>(in.gcount()) != bytes) {
+      throw std::runtime_error("failed to read slices " +
+                               std::to_string(zBegin) + "-" +
+                               std::to_string(zEnd) + " of " + path);
+    }
+  }
+
+  // maximum over the whole file, read slab by slab
+  auto max(uint32_t slabDepth) -> T {
+    std::vector<T> slab(slabDepth * offsetZ);
+    T max = 0;
+    for (uint32_t z = 0; z < depth; z += slabDepth) {
+      const auto zEnd = std::min(z + slabDepth, depth);
+      read(z, zEnd, slab.data());
+      const auto slabMax = valueRange(slab.data(), (zEnd - z) * offsetZ).max;
+      if (z == 0 || slabMax > max) {
+        max = slabMax;
+      }
+    }
+    return max;
+  }
+
+private:
+  std::ifstream in;
+  std::string path;
+  size_t offsetZ;
+  uint32_t depth;
+};
+
+// peak bytes held by a streaming run: the raw input slab of every field with
+// its halo plus one output slab; fields are normalized as they are read
+template <typename T, typename Out>
+auto estimateSlabStreamingMemory(size_t fieldCount, uint32_t width,
+                                 uint32_t height, uint32_t slabDepth,
+                                 uint32_t halo) -> size_t {
+  const auto offsetZ = static_cast<size_t>(width) * height;
+  const auto inputDepth = static_cast<size_t>(slabDepth) + 2 * halo;
+  return offsetZ *
+         (inputDepth * fieldCount * sizeof(T) + slabDepth * sizeof(Out));
+}
+
+// deepest slab whose streaming run stays within memoryLimit bytes, at least 1
+template <typename T, typename Out>
+auto slabDepthForMemory(size_t fieldCount, uint32_t width, uint32_t height,
+                        uint32_t depth, uint32_t halo, size_t memoryLimit)
+    -> uint32_t {
+  uint32_t slabDepth = depth;
+  while (slabDepth > 1 &&
+         estimateSlabStreamingMemory<T, Out>(fieldCount, width, height,
+                                             slabDepth, halo) > memoryLimit) {
+    slabDepth /= 2;
+  }
+  return slabDepth;
+}
+
+// runs kernel over the volume slab by slab: every field is read from disk
+// for [zBegin - halo, zEnd + halo) and normalized on the fly by its global
+// maximum, and kernel(fields, slabDimensions, localBegin, localEnd, result,
+// range, tracker) writes the slab's result as Out, which is appended to
+// outputPath. Returns the range of the result before encoding. A cancelled
+// run stops after the current slab and removes the partial output.
+template <typename T, typename ResultType, typename Out, typename Kernel>
+auto streamSlabs(const std::vector<std::string> &inputPaths,
+                 const std::string &outputPath, uint32_t width,
+                 uint32_t height, uint32_t depth, uint32_t slabDepth,
+                 uint32_t halo, Kernel kernel, const Progress &progress = {})
+    -> ResultRange {
+  using std::vector;
+
+  const auto offsetZ = static_cast<size_t>(width) * height;
+  slabDepth = std::max(1u, std::min(slabDepth, depth));
+
+  vector<RawSlabReader<T>> readers;
+  vector<T> maxima;
+  for (auto &path : inputPaths) {
+    readers.emplace_back(path, width, height, depth);
+    maxima.push_back(readers.back().max(slabDepth));
+  }
+
+  std::ofstream out(outputPath, std::ios::binary);
+  if (!out.is_open()) {
+    throw std::runtime_error("failed to open " + outputPath);
+  }
+
+  const auto inputDepth = static_cast<size_t>(slabDepth) + 2 * halo;
+  vector<vector<T>> raws(readers.size(), vector<T>(inputDepth * offsetZ));
+  vector<NormalizedField<T, ResultType>> fields(readers.size());
+  for (size_t i = 0; i < readers.size(); i++) {
+    fields[i] = {raws[i].data(), static_cast<ResultType>(maxima[i])};
+  }
+  vector<Out> result(slabDepth * offsetZ);
+  ResultRange range;
+  ProgressTracker tracker(progress, static_cast<size_t>(height) * depth);
+
+  for (uint32_t zBegin = 0; zBegin < depth; zBegin += slabDepth) {
+    const auto zEnd = std::min(zBegin + slabDepth, depth);
+    const auto inputBegin = zBegin > halo ? zBegin - halo : 0u;
+    const auto inputEnd = std::min(zEnd + halo, depth);
+
+    for (size_t i = 0; i < readers.size(); i++) {
+      readers[i].read(inputBegin, inputEnd, raws[i].data());
+    }
+
+    Vec3<uint32_t> slabDimensions(width, height, inputEnd - inputBegin);
+    kernel(fields, slabDimensions, zBegin - inputBegin, zEnd - inputBegin,
+           result.data(), &range, &tracker);
+    if (tracker.cancelled()) {
+      out.close();
+      std::remove(outputPath.c_str());
+      throw OperationCancelled();
+    }
+    out.write(reinterpret_cast<const char *>(result.data()),
+              static_cast<std::streamsize>((zEnd - zBegin) * offsetZ *
+                                           sizeof(Out)));
+  }
+  if (!out) {
+    throw std::runtime_error("failed to write " + outputPath);
+  }
+  return range;
+}
+
+// calculateGradientSimilarity over raw files of T without holding the
+// volume in memory; the result is written to outputPath as raw Out, see
+// encodeResult
+template <typename T, typename ResultType = double, typename Out = ResultType>
+auto streamGradientSimilarity(const std::vector<std::string> &inputPaths,
+                              const std::string &outputPath, uint32_t width,
+                              uint32_t height, uint32_t depth,
+                              int sensitivity = 2, uint32_t slabDepth = 16,
+                              const Progress &progress = {}) -> ResultRange {
+  using Field = NormalizedField<T, ResultType>;
+  return streamSlabs<T, ResultType, Out>(
+      inputPaths, outputPath, width, height, depth, slabDepth, 1,
+      [sensitivity](const std::vector<Field> &fields,
+                    const Vec3<uint32_t> &dimensions, uint32_t zBegin,
+                    uint32_t zEnd, Out *result, ResultRange *range,
+                    ProgressTracker *tracker) {
+        calculateGradientSimilaritySlab(fields, dimensions, zBegin, zEnd,
+                                        sensitivity, result, range, tracker);
+      },
+      progress);
+}
+
+// calcLocalCorrelationCoefficient over raw files of T without holding the
+// volume in memory; the result is written to outputPath as raw Out, see
+// encodeResult
+template <typename T, typename ResultType = double, typename Out = ResultType>
+auto streamLocalCorrelationCoefficient(
+    const std::vector<std::string> &inputPaths, const std::string &outputPath,
+    uint32_t width, uint32_t height, uint32_t depth, int windowSize = 3,
+    uint32_t slabDepth = 16, const Progress &progress = {}) -> ResultRange {
+  using Field = NormalizedField<T, ResultType>;
+  return streamSlabs<T, ResultType, Out>(
+      inputPaths, outputPath, width, height, depth, slabDepth,
+      static_cast<uint32_t>(windowSize),
+      [windowSize](const std::vector<Field> &fields,
+                   const Vec3<uint32_t> &dimensions, uint32_t zBegin,
+                   uint32_t zEnd, Out *result, ResultRange *range,
+                   ProgressTracker *tracker) {
+        calcLocalCorrelationCoefficientSlab(fields, dimensions, zBegin, zEnd,
+                                            windowSize, result, range,
+                                            tracker);
+      },
+      progress);
+}
+
+} // namespace VolCorrelation
@@ -0,0 +1,222 @@
+#pragma once
+#include "Common.hpp"
+#include "CpuDispatch.hpp"
+#include <array>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+namespace VolCorrelation {
+
+constexpr int SobelKernelX[3][3][3] = {
+    {{1, 2, 1}, {2, 4, 2}, {1, 2, 1}},
+    {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}},
+    {{-1, -2, -2}, {-2, -4, -2}, {-1, -2, -1}},
+};
+
+constexpr int SobelKernelY[3][3][3] = {
+    {{1, 2, 1}, {0, 0, 0}, {-1, -2, -1}},
+    {{2, 4, 2}, {0, 0, 0}, {-2, -4, -2}},
+    {{1, 2, 1}, {0, 0, 0}, {-1, -2, -1}},
+};
+
+constexpr int SobelKernelZ[3][3][3] = {
+    {{1, 0, -1}, {2, 0, -2}, {1, 0, -1}},
+    {{2, 0, -2}, {4, 0, -4}, {2, 0, -2}},
+    {{1, 0, -1}, {2, 0, -2}, {1, 0, -1}},
+};
+
+// calculateGradient only offsets each component along its own axis, so the
+// smoothing taps of the other two axes sum up and every component is a
+// separable 1D 3-tap derivative; axis 0, 1, 2 is the kernel index used for
+// the offset of that component
+constexpr auto collapseSobelKernel(const int (&kernel)[3][3][3], int axis)
+    -> std::array<int, 3> {
+  std::array<int, 3> taps{0, 0, 0};
+  for (int a = 0; a < 3; a++) {
+    for (int b = 0; b < 3; b++) {
+      for (int c = 0; c < 3; c++) {
+        const auto tap = axis == 0 ? a : (axis == 1 ? b : c);
+        taps[tap] += kernel[a][b][c];
+      }
+    }
+  }
+  return taps;
+}
+
+constexpr auto SobelTapsX = collapseSobelKernel(SobelKernelX, 0);
+constexpr auto SobelTapsY = collapseSobelKernel(SobelKernelY, 1);
+constexpr auto SobelTapsZ = collapseSobelKernel(SobelKernelZ, 2);
+
+// out[i] = (wa * a[i] + wb * b[i] + wc * c[i]) / 16, branch free
+template <typename ResultType>
+void stencilRowScalar(ResultType *out, const ResultType *a,
+                      const ResultType *b, const ResultType *c, size_t n,
+                      ResultType wa, ResultType wb, ResultType wc) {
+  const auto scale = ResultType(1) / 16;
+  for (size_t i = 0; i < n; i++) {
+    out[i] = (wa * a[i] + wb * b[i] + wc * c[i]) * scale;
+  }
+}
+
+#ifdef VOLCORRELATION_X86
+VOLCORRELATION_TARGET("avx2")
+inline void stencilRowAVX2(double *out, const double *a, const double *b,
+                           const double *c, size_t n, double wa, double wb,
+                           double wc) {
+  const auto va = _mm256_set1_pd(wa), vb = _mm256_set1_pd(wb),
+             vc = _mm256_set1_pd(wc), scale = _mm256_set1_pd(1.0 / 16);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    auto r = _mm256_add_pd(_mm256_mul_pd(va, _mm256_loadu_pd(a + i)),
+                           _mm256_mul_pd(vb, _mm256_loadu_pd(b + i)));
+    r = _mm256_add_pd(r, _mm256_mul_pd(vc, _mm256_loadu_pd(c + i)));
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(r, scale));
+  }
+  stencilRowScalar<double>(out + i, a + i, b + i, c + i, n - i, wa, wb, wc);
+}
+
+VOLCORRELATION_TARGET("avx2")
+inline void stencilRowAVX2(float *out, const float *a, const float *b,
+                           const float *c, size_t n, float wa, float wb,
+                           float wc) {
+  const auto va = _mm256_set1_ps(wa), vb = _mm256_set1_ps(wb),
+             vc = _mm256_set1_ps(wc), scale = _mm256_set1_ps(1.0f / 16);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    auto r = _mm256_add_ps(_mm256_mul_ps(va, _mm256_loadu_ps(a + i)),
+                           _mm256_mul_ps(vb, _mm256_loadu_ps(b + i)));
+    r = _mm256_add_ps(r, _mm256_mul_ps(vc, _mm256_loadu_ps(c + i)));
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(r, scale));
+  }
+  stencilRowScalar<float>(out + i, a + i, b + i, c + i, n - i, wa, wb, wc);
+}
+
+VOLCORRELATION_TARGET("avx512f")
+inline void stencilRowAVX512(double *out, const double *a, const double *b,
+                             const double *c, size_t n, double wa, double wb,
+                             double wc) {
+  const auto va = _mm512_set1_pd(wa), vb = _mm512_set1_pd(wb),
+             vc = _mm512_set1_pd(wc), scale = _mm512_set1_pd(1.0 / 16);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    auto r = _mm512_add_pd(_mm512_mul_pd(va, _mm512_loadu_pd(a + i)),
+                           _mm512_mul_pd(vb, _mm512_loadu_pd(b + i)));
+    r = _mm512_add_pd(r, _mm512_mul_pd(vc, _mm512_loadu_pd(c + i)));
+    _mm512_storeu_pd(out + i, _mm512_mul_pd(r, scale));
+  }
+  // masked tail: a scalar tail would be contracted to fma in this function,
+  // and a voxel's value would depend on its position in the row
+  if (i < n) {
+    const auto mask = static_cast<__mmask8>((1u << (n - i)) - 1);
+    auto r = _mm512_add_pd(
+        _mm512_mul_pd(va, _mm512_maskz_loadu_pd(mask, a + i)),
+        _mm512_mul_pd(vb, _mm512_maskz_loadu_pd(mask, b + i)));
+    r = _mm512_add_pd(r,
+                      _mm512_mul_pd(vc, _mm512_maskz_loadu_pd(mask, c + i)));
+    _mm512_mask_storeu_pd(out + i, mask, _mm512_mul_pd(r, scale));
+  }
+}
+
+VOLCORRELATION_TARGET("avx512f")
+inline void stencilRowAVX512(float *out, const float *a, const float *b,
+                             const float *c, size_t n, float wa, float wb,
+                             float wc) {
+  const auto va = _mm512_set1_ps(wa), vb = _mm512_set1_ps(wb),
+             vc = _mm512_set1_ps(wc), scale = _mm512_set1_ps(1.0f / 16);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    auto r = _mm512_add_ps(_mm512_mul_ps(va, _mm512_loadu_ps(a + i)),
+                           _mm512_mul_ps(vb, _mm512_loadu_ps(b + i)));
+    r = _mm512_add_ps(r, _mm512_mul_ps(vc, _mm512_loadu_ps(c + i)));
+    _mm512_storeu_ps(out + i, _mm512_mul_ps(r, scale));
+  }
+  if (i < n) {
+    const auto mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+    auto r = _mm512_add_ps(
+        _mm512_mul_ps(va, _mm512_maskz_loadu_ps(mask, a + i)),
+        _mm512_mul_ps(vb, _mm512_maskz_loadu_ps(mask, b + i)));
+    r = _mm512_add_ps(r,
+                      _mm512_mul_ps(vc, _mm512_maskz_loadu_ps(mask, c + i)));
+    _mm512_mask_storeu_ps(out + i, mask, _mm512_mul_ps(r, scale));
+  }
+}
+#endif
+
+// picks the widest implementation the cpu runs, other types stay scalar
+template <typename ResultType>
+void stencilRow(ResultType *out, const ResultType *a, const ResultType *b,
+                const ResultType *c, size_t n, ResultType wa, ResultType wb,
+                ResultType wc) {
+#ifdef VOLCORRELATION_X86
+  if constexpr (std::is_same<ResultType, double>::value ||
+                std::is_same<ResultType, float>::value) {
+    switch (activeIsa()) {
+    case Isa::AVX512:
+      return stencilRowAVX512(out, a, b, c, n, wa, wb, wc);
+    case Isa::AVX2:
+      return stencilRowAVX2(out, a, b, c, n, wa, wb, wc);
+    default:
+      break;
+    }
+  }
+#endif
+  stencilRowScalar(out, a, b, c, n, wa, wb, wc);
+}
+
+// gradient of the row (y, z) of a normalized field, same values as
+// calculateGradient. The y and z faces only change which neighbour rows are
+// read, the two x ends are the only voxels handled one by one. Fields that
+// are not stored normalized need 5 rows of scratch.
+template <typename Field, typename ResultType>
+void sobelGradientRow(const Field &field, const Vec3<uint32_t> &dimensions,
+                      uint32_t y, uint32_t z, ResultType *gx, ResultType *gy,
+                      ResultType *gz, ResultType *scratch) {
+  const auto width = static_cast<size_t>(dimensions.x);
+  const auto offsetZ = width * dimensions.y;
+  const auto index = z * offsetZ + y * width;
+  const auto row = fieldRow(field, index, width, scratch);
+  const auto rowY0 =
+      y == 0 ? row : fieldRow(field, index - width, width, scratch + width);
+  const auto rowY1 = y + 1 == dimensions.y
+                         ? row
+                         : fieldRow(field, index + width, width,
+                                    scratch + 2 * width);
+  const auto rowZ0 =
+      z == 0 ? row
+             : fieldRow(field, index - offsetZ, width, scratch + 3 * width);
+  const auto rowZ1 = z + 1 == dimensions.z
+                         ? row
+                         : fieldRow(field, index + offsetZ, width,
+                                    scratch + 4 * width);
+
+  const auto wx = std::array<ResultType, 3>{ResultType(SobelTapsX[0]),
+                                            ResultType(SobelTapsX[1]),
+                                            ResultType(SobelTapsX[2])};
+  stencilRow(gy, rowY0, row, rowY1, width, ResultType(SobelTapsY[0]),
+             ResultType(SobelTapsY[1]), ResultType(SobelTapsY[2]));
+  stencilRow(gz, rowZ0, row, rowZ1, width, ResultType(SobelTapsZ[0]),
+             ResultType(SobelTapsZ[1]), ResultType(SobelTapsZ[2]));
+
+  const auto scale = ResultType(1) / 16;
+  if (width == 1) {
+    gx[0] = (wx[0] * row[0] + wx[1] * row[0] + wx[2] * row[0]) * scale;
+    return;
+  }
+  if (width > 2) {
+    stencilRow(gx + 1, row, row + 1, row + 2, width - 2, wx[0], wx[1], wx[2]);
+  }
+  gx[0] = (wx[0] * row[0] + wx[1] * row[0] + wx[2] * row[1]) * scale;
+  const auto last = width - 1;
+  gx[last] =
+      (wx[0] * row[last - 1] + wx[1] * row[last] + wx[2] * row[last]) * scale;
+}
+
+template <typename ResultType>
+void sobelGradientRow(const ResultType *field, const Vec3<uint32_t> &dimensions,
+                      uint32_t y, uint32_t z, ResultType *gx, ResultType *gy,
+                      ResultType *gz) {
+  sobelGradientRow(field, dimensions, y, z, gx, gy, gz,
+                   static_cast<ResultType *>(nullptr));
+}
+
+} // namespace VolCorrelation
@@ -0,0 +1,81 @@
+#pragma once
+#include "Common.hpp"
+#include <cstdint>
+#include <vector>
+namespace VolCorrelation {
+
+// 3D summed-area table: entry (x, y, z) holds the sum of all values in
+// [0, x) * [0, y) * [0, z), so any box sum costs eight lookups.
+// Accumulator should be an integer type for integer inputs so that sums are
+// exact; unsigned wraparound cancels out in boxSum.
+template <typename Accumulator> class SummedVolumeTable {
+public:
+  SummedVolumeTable() = default;
+
+  // value(index) returns the sample at linear voxel index of the volume
+  template <typename ValueFunc>
+  void build(uint32_t width, uint32_t height, uint32_t depth,
+             ValueFunc value) {
+    stride = Vec3<size_t>(1, width + 1ull, (width + 1ull) * (height + 1ull));
+    table.assign(stride.z * (depth + 1ull), Accumulator(0));
+
+    const auto offsetZ = static_cast<size_t>(width) * height;
+    // prefix along x
+#pragma omp parallel for
+    for (int z = 0; z < static_cast<int>(depth); z++) {
+      for (size_t y = 0; y < height; y++) {
+        auto row = table.data() + (z + 1) * stride.z + (y + 1) * stride.y;
+        auto index = z * offsetZ + y * width;
+        auto sum = Accumulator(0);
+        for (size_t x = 0; x < width; x++) {
+          sum += static_cast<Accumulator>(value(index + x));
+          row[x + 1] = sum;
+        }
+      }
+    }
+    // prefix along y
+#pragma omp parallel for
+    for (int z = 1; z <= static_cast<int>(depth); z++) {
+      for (size_t y = 2; y <= height; y++) {
+        auto row = table.data() + z * stride.z + y * stride.y;
+        auto previous = row - stride.y;
+        for (size_t x = 1; x <= width; x++) {
+          row[x] += previous[x];
+        }
+      }
+    }
+    // prefix along z
+#pragma omp parallel for
+    for (int y = 1; y <= static_cast<int>(height); y++) {
+      for (size_t z = 2; z <= depth; z++) {
+        auto row = table.data() + z * stride.z + y * stride.y;
+        auto previous = row - stride.z;
+        for (size_t x = 1; x <= width; x++) {
+          row[x] += previous[x];
+        }
+      }
+    }
+  }
+
+  // sum over the half-open box [begin, end)
+  auto boxSum(const Vec3<uint32_t> &begin, const Vec3<uint32_t> &end) const
+      -> Accumulator {
+    const auto x0 = begin.x, x1 = end.x;
+    const auto y0 = begin.y * stride.y, y1 = end.y * stride.y;
+    const auto z0 = begin.z * stride.z, z1 = end.z * stride.z;
+    const auto t = table.data();
+    return t[z1 + y1 + x1] - t[z1 + y1 + x0] - t[z1 + y0 + x1] -
+           t[z0 + y1 + x1] + t[z1 + y0 + x0] + t[z0 + y1 + x0] +
+           t[z0 + y0 + x1] - t[z0 + y0 + x0];
+  }
+
+  auto memoryUsage() const -> size_t {
+    return table.capacity() * sizeof(Accumulator);
+  }
+
+private:
+  Vec3<size_t> stride;
+  std::vector<Accumulator> table;
+};
+
+} // namespace VolCorrelation
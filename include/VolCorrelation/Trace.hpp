@@ -0,0 +1,263 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+namespace VolCorrelation {
+
+// timed spans and counters of the hot paths, recorded per thread. Recording
+// is off until Tracer::instance().enable(), so a disabled scope costs one
+// relaxed load; defining VOLCORRELATION_NO_TRACE compiles the macros out.
+// Names are stored by pointer and must be string literals.
+
+struct TraceSpan {
+  const char *name;
+  // nanoseconds since the tracer was created
+  int64_t begin;
+  int64_t duration;
+};
+
+struct TraceCounter {
+  const char *name;
+  double value;
+};
+
+class Tracer {
+public:
+  static auto instance() -> Tracer & {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  void enable(bool on = true) {
+    recording.store(on, std::memory_order_relaxed);
+  }
+  auto enabled() const -> bool {
+    return recording.load(std::memory_order_relaxed);
+  }
+
+  auto now() const -> int64_t {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - epoch)
+        .count();
+  }
+
+  void span(const char *name, int64_t begin, int64_t end) {
+    buffer().spans.push_back({name, begin, end - begin});
+  }
+
+  void count(const char *name, double value) {
+    auto &counters = buffer().counters;
+    for (auto &counter : counters) {
+      if (counter.name == name) {
+        counter.value += value;
+        return;
+      }
+    }
+    counters.push_back({name, value});
+  }
+
+  // clearing and exporting read every thread's buffer, so they must not run
+  // while traced work does
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &buffer : buffers) {
+      buffer->spans.clear();
+      buffer->counters.clear();
+    }
+  }
+
+  // counters summed over all threads, in the order they were first seen
+  auto counters() const -> std::vector<TraceCounter> {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<TraceCounter> total;
+    for (auto &buffer : buffers) {
+      for (auto &counter : buffer->counters) {
+        auto it = std::find_if(total.begin(), total.end(), [&](auto &c) {
+          return std::string(c.name) == counter.name;
+        });
+        if (it == total.end()) {
+          total.push_back(counter);
+        } else {
+          it->value += counter.value;
+        }
+      }
+    }
+    return total;
+  }
+
+  // Trace Event Format, loadable in chrome://tracing or Perfetto: one
+  // complete event per span on its thread's track and one counter event per
+  // counter at the end of the trace
+  void writeChromeTrace(std::ostream &out) const {
+    int64_t last = 0;
+    out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+    auto separator = "\n";
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto &buffer : buffers) {
+        for (auto &span : buffer->spans) {
+          out << separator << "{\"name\":\"" << span.name
+              << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->id
+              << ",\"ts\":" << span.begin / 1000.0
+              << ",\"dur\":" << span.duration / 1000.0 << "}";
+          separator = ",\n";
+          last = std::max(last, span.begin + span.duration);
+        }
+      }
+    }
+    for (auto &counter : counters()) {
+      out << separator << "{\"name\":\"" << counter.name
+          << "\",\"ph\":\"C\",\"pid\":0,\"tid\":0,\"ts\":" << last / 1000.0
+          << ",\"args\":{\"value\":" << counter.value << "}}";
+      separator = ",\n";
+    }
+    out << "\n]}\n";
+  }
+
+  void writeChromeTrace(const std::string &path) const {
+    std::ofstream out(path);
+    writeChromeTrace(out);
+    if (!out) {
+      throw std::runtime_error("failed to write " + path);
+    }
+  }
+
+  // calls, total, mean and longest time and thread count per span name,
+  // longest total first, followed by the counters
+  void writeSummary(std::ostream &out) const {
+    struct Row {
+      std::string name;
+      size_t calls = 0;
+      int64_t total = 0;
+      int64_t max = 0;
+      std::vector<uint32_t> threads;
+    };
+    std::vector<Row> rows;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto &buffer : buffers) {
+        for (auto &span : buffer->spans) {
+          auto it = std::find_if(rows.begin(), rows.end(), [&](auto &row) {
+            return row.name == span.name;
+          });
+          if (it == rows.end()) {
+            rows.emplace_back();
+            rows.back().name = span.name;
+            it = rows.end() - 1;
+          }
+          it->calls++;
+          it->total += span.duration;
+          it->max = std::max(it->max, span.duration);
+          if (std::find(it->threads.begin(), it->threads.end(), buffer->id) ==
+              it->threads.end()) {
+            it->threads.push_back(buffer->id);
+          }
+        }
+      }
+    }
+    std::sort(rows.begin(), rows.end(),
+              [](auto &a, auto &b) { return a.total > b.total; });
+
+    out << std::left << std::setw(32) << "span" << std::right << std::setw(10)
+        << "calls" << std::setw(14) << "total ms" << std::setw(12)
+        << "mean ms" << std::setw(12) << "max ms" << std::setw(9)
+        << "threads" << "\n";
+    out << std::fixed << std::setprecision(3);
+    for (auto &row : rows) {
+      out << std::left << std::setw(32) << row.name << std::right
+          << std::setw(10) << row.calls << std::setw(14) << row.total / 1e6
+          << std::setw(12) << row.total / 1e6 / row.calls << std::setw(12)
+          << row.max / 1e6 << std::setw(9) << row.threads.size() << "\n";
+    }
+    const auto total = counters();
+    if (!total.empty()) {
+      out << "\n" << std::left << std::setw(32) << "counter" << std::right
+          << std::setw(20) << "value" << "\n";
+      out << std::setprecision(0);
+      for (auto &counter : total) {
+        out << std::left << std::setw(32) << counter.name << std::right
+            << std::setw(20) << counter.value << "\n";
+      }
+    }
+    out.unsetf(std::ios::floatfield);
+  }
+
+private:
+  struct ThreadBuffer {
+    uint32_t id = 0;
+    std::vector<TraceSpan> spans;
+    std::vector<TraceCounter> counters;
+  };
+
+  Tracer() : epoch(std::chrono::steady_clock::now()) {}
+
+  // buffers are shared with the tracer, so spans of threads that have exited
+  // are still exported
+  auto buffer() -> ThreadBuffer & {
+    thread_local std::shared_ptr<ThreadBuffer> local;
+    if (!local) {
+      local = std::make_shared<ThreadBuffer>();
+      std::lock_guard<std::mutex> lock(mutex);
+      local->id = static_cast<uint32_t>(buffers.size());
+      buffers.push_back(local);
+    }
+    return *local;
+  }
+
+  std::chrono::steady_clock::time_point epoch;
+  std::atomic<bool> recording{false};
+  mutable std::mutex mutex;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+};
+
+// records the time from construction to destruction as a span, if tracing
+// was enabled at construction
+class TraceScope {
+public:
+  explicit TraceScope(const char *name)
+      : name(Tracer::instance().enabled() ? name : nullptr),
+        begin(this->name != nullptr ? Tracer::instance().now() : 0) {}
+  TraceScope(const TraceScope &) = delete;
+  auto operator=(const TraceScope &) -> TraceScope & = delete;
+  ~TraceScope() {
+    if (name != nullptr) {
+      auto &tracer = Tracer::instance();
+      tracer.span(name, begin, tracer.now());
+    }
+  }
+
+private:
+  const char *name;
+  int64_t begin;
+};
+
+inline void traceCount(const char *name, double value) {
+  auto &tracer = Tracer::instance();
+  if (tracer.enabled()) {
+    tracer.count(name, value);
+  }
+}
+
+} // namespace VolCorrelation
+
+#ifndef VOLCORRELATION_NO_TRACE
+#define VOLCORRELATION_TRACE_JOIN2(a, b) a##b
+#define VOLCORRELATION_TRACE_JOIN(a, b) VOLCORRELATION_TRACE_JOIN2(a, b)
+#define VOLCORRELATION_TRACE_SCOPE(name)                                      \
+  ::VolCorrelation::TraceScope VOLCORRELATION_TRACE_JOIN(traceScope,          \
+                                                         __LINE__)(name)
+#define VOLCORRELATION_TRACE_COUNT(name, value)                               \
+  ::VolCorrelation::traceCount(name, static_cast<double>(value))
+#else
+#define VOLCORRELATION_TRACE_SCOPE(name) ((void)0)
+#define VOLCORRELATION_TRACE_COUNT(name, value) ((void)(value))
+#endif
@@ -0,0 +1,224 @@
+#pragma once
+#include "CpuDispatch.hpp"
+#include <cstdint>
+#include <type_traits>
+namespace VolCorrelation {
+
+// running sums of a window of two fields, both shifted by a constant
+struct WindowMoments {
+  double sumX = 0.0;
+  double sumY = 0.0;
+  double sqsumX = 0.0;
+  double sqsumY = 0.0;
+  double sumXY = 0.0;
+};
+
+// a box of nx * ny * nz voxels starting at the first voxel of a and b, rows
+// are width apart and slices offsetZ apart
+struct WindowBox {
+  size_t nx, ny, nz;
+  size_t width, offsetZ;
+};
+
+// adds the voxels of the box in memory order
+template <typename T>
+void accumulateWindowScalar(const T *a, const T *b, const WindowBox &box,
+                            double shiftA, double shiftB,
+                            WindowMoments &moments) {
+  for (size_t z = 0; z < box.nz; z++) {
+    for (size_t y = 0; y < box.ny; y++) {
+      const auto row = z * box.offsetZ + y * box.width;
+      for (size_t i = row; i < row + box.nx; i++) {
+        const auto x = static_cast<double>(a[i]) - shiftA;
+        const auto v = static_cast<double>(b[i]) - shiftB;
+        moments.sumX += x;
+        moments.sumY += v;
+        moments.sqsumX += x * x;
+        moments.sqsumY += v * v;
+        moments.sumXY += x * v;
+      }
+    }
+  }
+}
+
+inline auto dotProductScalar(const double *a, const double *b, size_t n)
+    -> double {
+  auto sum = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+#ifdef VOLCORRELATION_X86
+// the first count of 4 lanes, as a load mask
+VOLCORRELATION_TARGET("avx2")
+inline auto laneMaskAVX2(size_t count) -> __m256i {
+  const auto lanes = _mm256_set_epi64x(3, 2, 1, 0);
+  return _mm256_cmpgt_epi64(_mm256_set1_epi64x(static_cast<int64_t>(count)),
+                            lanes);
+}
+
+VOLCORRELATION_TARGET("avx2")
+inline auto loadLanesAVX2(const double *p, __m256i mask) -> __m256d {
+  return _mm256_maskload_pd(p, mask);
+}
+
+VOLCORRELATION_TARGET("avx2")
+inline auto loadLanesAVX2(const float *p, __m256i mask) -> __m256d {
+  // the low 32 bits of every 64 bit mask lane select the float
+  const auto narrow = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+      mask, _mm256_set_epi32(7, 5, 3, 1, 6, 4, 2, 0)));
+  return _mm256_cvtps_pd(_mm_maskload_ps(p, narrow));
+}
+
+VOLCORRELATION_TARGET("avx2")
+inline auto horizontalSumAVX2(__m256d v) -> double {
+  const auto pair = _mm_add_pd(_mm256_castpd256_pd128(v),
+                               _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+}
+
+// the sums stay in vector registers for the whole box and are reduced once
+template <typename T>
+VOLCORRELATION_TARGET("avx2")
+void accumulateWindowAVX2(const T *a, const T *b, const WindowBox &box,
+                          double shiftA, double shiftB,
+                          WindowMoments &moments) {
+  const auto va = _mm256_set1_pd(shiftA), vb = _mm256_set1_pd(shiftB);
+  auto sumX = _mm256_setzero_pd(), sumY = _mm256_setzero_pd(),
+       sqsumX = _mm256_setzero_pd(), sqsumY = _mm256_setzero_pd(),
+       sumXY = _mm256_setzero_pd();
+  for (size_t z = 0; z < box.nz; z++) {
+    for (size_t y = 0; y < box.ny; y++) {
+      const auto row = z * box.offsetZ + y * box.width;
+      for (size_t i = 0; i < box.nx; i += 4) {
+        // masked lanes are zeroed after the shift so they add nothing
+        const auto mask = laneMaskAVX2(box.nx - i);
+        const auto x =
+            _mm256_and_pd(_mm256_sub_pd(loadLanesAVX2(a + row + i, mask), va),
+                          _mm256_castsi256_pd(mask));
+        const auto v =
+            _mm256_and_pd(_mm256_sub_pd(loadLanesAVX2(b + row + i, mask), vb),
+                          _mm256_castsi256_pd(mask));
+        sumX = _mm256_add_pd(sumX, x);
+        sumY = _mm256_add_pd(sumY, v);
+        sqsumX = _mm256_add_pd(sqsumX, _mm256_mul_pd(x, x));
+        sqsumY = _mm256_add_pd(sqsumY, _mm256_mul_pd(v, v));
+        sumXY = _mm256_add_pd(sumXY, _mm256_mul_pd(x, v));
+      }
+    }
+  }
+  moments.sumX += horizontalSumAVX2(sumX);
+  moments.sumY += horizontalSumAVX2(sumY);
+  moments.sqsumX += horizontalSumAVX2(sqsumX);
+  moments.sqsumY += horizontalSumAVX2(sqsumY);
+  moments.sumXY += horizontalSumAVX2(sumXY);
+}
+
+VOLCORRELATION_TARGET("avx2")
+inline auto dotProductAVX2(const double *a, const double *b, size_t n)
+    -> double {
+  auto sum = _mm256_setzero_pd();
+  for (size_t i = 0; i < n; i += 4) {
+    const auto mask = laneMaskAVX2(n - i);
+    sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_maskload_pd(a + i, mask),
+                                           _mm256_maskload_pd(b + i, mask)));
+  }
+  return horizontalSumAVX2(sum);
+}
+
+VOLCORRELATION_TARGET("avx512f")
+inline auto loadLanesAVX512(const double *p, __mmask8 mask) -> __m512d {
+  return _mm512_maskz_loadu_pd(mask, p);
+}
+
+VOLCORRELATION_TARGET("avx512f")
+inline auto loadLanesAVX512(const float *p, __mmask8 mask) -> __m512d {
+  return _mm512_cvtps_pd(_mm512_castps512_ps256(
+      _mm512_maskz_loadu_ps(static_cast<__mmask16>(mask), p)));
+}
+
+template <typename T>
+VOLCORRELATION_TARGET("avx512f")
+void accumulateWindowAVX512(const T *a, const T *b, const WindowBox &box,
+                            double shiftA, double shiftB,
+                            WindowMoments &moments) {
+  const auto va = _mm512_set1_pd(shiftA), vb = _mm512_set1_pd(shiftB);
+  auto sumX = _mm512_setzero_pd(), sumY = _mm512_setzero_pd(),
+       sqsumX = _mm512_setzero_pd(), sqsumY = _mm512_setzero_pd(),
+       sumXY = _mm512_setzero_pd();
+  for (size_t z = 0; z < box.nz; z++) {
+    for (size_t y = 0; y < box.ny; y++) {
+      const auto row = z * box.offsetZ + y * box.width;
+      for (size_t i = 0; i < box.nx; i += 8) {
+        const auto count = box.nx - i < 8 ? box.nx - i : 8;
+        const auto mask = static_cast<__mmask8>((1u << count) - 1);
+        const auto x =
+            _mm512_maskz_sub_pd(mask, loadLanesAVX512(a + row + i, mask), va);
+        const auto v =
+            _mm512_maskz_sub_pd(mask, loadLanesAVX512(b + row + i, mask), vb);
+        sumX = _mm512_add_pd(sumX, x);
+        sumY = _mm512_add_pd(sumY, v);
+        sqsumX = _mm512_fmadd_pd(x, x, sqsumX);
+        sqsumY = _mm512_fmadd_pd(v, v, sqsumY);
+        sumXY = _mm512_fmadd_pd(x, v, sumXY);
+      }
+    }
+  }
+  moments.sumX += _mm512_reduce_add_pd(sumX);
+  moments.sumY += _mm512_reduce_add_pd(sumY);
+  moments.sqsumX += _mm512_reduce_add_pd(sqsumX);
+  moments.sqsumY += _mm512_reduce_add_pd(sqsumY);
+  moments.sumXY += _mm512_reduce_add_pd(sumXY);
+}
+
+VOLCORRELATION_TARGET("avx512f")
+inline auto dotProductAVX512(const double *a, const double *b, size_t n)
+    -> double {
+  auto sum = _mm512_setzero_pd();
+  for (size_t i = 0; i < n; i += 8) {
+    const auto count = n - i < 8 ? n - i : 8;
+    const auto mask = static_cast<__mmask8>((1u << count) - 1);
+    sum = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, a + i),
+                          _mm512_maskz_loadu_pd(mask, b + i), sum);
+  }
+  return _mm512_reduce_add_pd(sum);
+}
+#endif
+
+// window statistics of a box, vectorized for double and float fields
+template <typename T>
+void accumulateWindow(const T *a, const T *b, const WindowBox &box,
+                      double shiftA, double shiftB, WindowMoments &moments) {
+#ifdef VOLCORRELATION_X86
+  if constexpr (std::is_same<T, double>::value ||
+                std::is_same<T, float>::value) {
+    switch (activeIsa()) {
+    case Isa::AVX512:
+      return accumulateWindowAVX512(a, b, box, shiftA, shiftB, moments);
+    case Isa::AVX2:
+      return accumulateWindowAVX2(a, b, box, shiftA, shiftB, moments);
+    default:
+      break;
+    }
+  }
+#endif
+  accumulateWindowScalar(a, b, box, shiftA, shiftB, moments);
+}
+
+inline auto dotProduct(const double *a, const double *b, size_t n) -> double {
+#ifdef VOLCORRELATION_X86
+  switch (activeIsa()) {
+  case Isa::AVX512:
+    return dotProductAVX512(a, b, n);
+  case Isa::AVX2:
+    return dotProductAVX2(a, b, n);
+  default:
+    break;
+  }
+#endif
+  return dotProductScalar(a, b, n);
+}
+
+} // namespace VolCorrelation
@@ -3,21 +3,34 @@
 //
 #include "Info/ClusteringDendrogramWidget.hpp"
 #include "Info/ForceDirectedLayoutWidget.hpp"
-#include "Info/MutualInformation.hpp"
+#include "Info/AnalysisSession.hpp"
+#include "Info/SampledMutualInformation.hpp"
 #include "Info/ForceDirected.hpp"
+#include "VolCorrelation/MappedVolume.hpp"
 #include <QApplication>
 #include <fstream>
 #include <QListWidget>
 #include <QPushButton>
 #include <QFileDialog>
+#include <QProgressBar>
+#include <QThreadPool>
+#include <functional>
+#include <memory>
 
 using namespace::std;
 struct VolumeData {
-  std::vector<uint8_t> data;
+  VolCorrelation::MappedVolume data;
   std::string name;
   std::vector<size_t> histogram;
   double entropy = 0.0;
 };
+// what display shows, computed off the UI thread
+struct Drawing {
+  vector<vector<double>> distances;
+  unique_ptr<Info::HierarchicalCluster> cluster;
+  vector<array<double,2>> particles;
+  size_t k = 0;
+};
 class Widget: public QWidget{
 public:
   Widget(){
@@ -27,64 +40,183 @@ public:
     load_volume_pb->setGeometry(50,400,100,20);
     compute_pb = new QPushButton("compute",this);
     compute_pb->setGeometry(250,400,100,20);
+    exact_pb = new QPushButton("exact",this);
+    exact_pb->setGeometry(250,430,100,20);
+    remove_volume_pb = new QPushButton("remove",this);
+    remove_volume_pb->setGeometry(50,430,100,20);
+    cancel_pb = new QPushButton("cancel",this);
+    cancel_pb->setGeometry(160,400,80,20);
+    cancel_pb->setEnabled(false);
+    progress_bar = new QProgressBar(this);
+    progress_bar->setGeometry(50,460,300,20);
+    progress_bar->setRange(0,1000);
     connect(load_volume_pb,&QPushButton::clicked,this,[this](){
       auto path = QFileDialog::getOpenFileNames(this,
                                                QStringLiteral("Load Volume"),
                                                QStringLiteral("E:/Volume/"),
                                                QStringLiteral("(*.*)"));
+      auto loaded = make_shared<vector<VolumeData>>();
       for(auto& p:path){
         if(!p.isEmpty()){
-          loadVolume(p.toStdString());
+          loaded->push_back(loadVolume(p.toStdString()));
         }
       }
+      // only the pairs of the new volumes are counted, in the background
+      run([this,loaded](const Info::Progress& progress){
+        for(auto& volume:*loaded){
+          session.AddField(volume.data.data<uint8_t>(),progress);
+        }
+      },[this,loaded](){
+        // volumes added before a cancel are kept
+        const auto added = session.FieldNum() - volumes.size();
+        for(size_t i = 0; i < added; i++){
+          auto& volume = (*loaded)[i];
+          volume.histogram = session.Histogram(volumes.size());
+          volume.entropy = session.Entropy(volumes.size());
+          volume_list->addItem(QString(volume.name.c_str()));
+          volumes.push_back(std::move(volume));
+        }
+      });
     });
+    connect(cancel_pb,&QPushButton::clicked,this,[this](){
+      token.cancel();
+    });
+    // sampled estimate for a quick look, the exact pass on demand
     connect(compute_pb,&QPushButton::clicked,this,[this](){
-      draw();
+      if(volumes.size() < 2){
+        return;
+      }
+      vector<Info::Counts> histograms;
+      for(auto& volume:volumes){
+        histograms.push_back(volume.histogram);
+      }
+      auto drawing = make_shared<Drawing>();
+      run([this,histograms,drawing](const Info::Progress& progress){
+        // a cancel stops the refinement after the current round
+        auto approximate = Info::CalculateApproximateMutualInformationMatrix(
+            fields(), total, histograms, {},
+            [&progress](const Info::ApproximateMutualInformationMatrix&){
+              return !progress.token->isCancelled();
+            });
+        if(progress.token->isCancelled()){
+          throw Info::OperationCancelled();
+        }
+        *drawing = arrange(approximate.mi);
+      },[this,drawing](){
+        present(*drawing);
+      });
+    });
+    // the session already holds every pair, only clustering and layout run
+    connect(exact_pb,&QPushButton::clicked,this,[this](){
+      if(session.FieldNum() < 2){
+        return;
+      }
+      auto drawing = make_shared<Drawing>();
+      run([this,drawing](const Info::Progress&){
+        drawing->k = session.FieldNum() - 1;
+        drawing->distances = session.Distances();
+        drawing->cluster = session.Cluster(drawing->k);
+        drawing->particles = session.Layout(400, 600);
+      },[this,drawing](){
+        present(*drawing);
+      });
+    });
+    connect(remove_volume_pb,&QPushButton::clicked,this,[this](){
+      const auto row = volume_list->currentRow();
+      if(row < 0){
+        return;
+      }
+      session.RemoveField(row);
+      volumes.erase(volumes.begin() + row);
+      delete volume_list->takeItem(row);
     });
     dendrogram = new Info::ClusteringDendrogram();
     force_directed_layout = new Info::ForceDirectedLayout();
 
   }
-  void loadVolume(const std::string& path){
-    std::ifstream in(path,std::ios::binary);
-    if(!in.is_open()){
-      std::cerr<<"failed to open"<<std::endl;
-      exit(1);
-    }
+  ~Widget(){
+    token.cancel();
+    QThreadPool::globalInstance()->waitForDone();
+  }
+  // runs work on the global thread pool so the UI stays responsive, shows its
+  // progress and calls done on the UI thread, also after a cancel
+  void run(std::function<void(const Info::Progress&)> work,
+           std::function<void()> done){
+    setBusy(true);
+    token.reset();
+    progress_bar->setValue(0);
+    QThreadPool::globalInstance()->start([this,work,done](){
+      Info::Progress progress;
+      progress.token = &token;
+      progress.callback = [this](double fraction){
+        QMetaObject::invokeMethod(progress_bar,[this,fraction](){
+          progress_bar->setValue(static_cast<int>(fraction * 1000));
+        },Qt::QueuedConnection);
+      };
+      try{
+        work(progress);
+      }
+      catch(const Info::OperationCancelled&){
+        // a cancel keeps what was done before it
+      }
+      catch(const std::exception& e){
+        std::cerr<<e.what()<<std::endl;
+      }
+      QMetaObject::invokeMethod(this,[this,done](){
+        setBusy(false);
+        done();
+      },Qt::QueuedConnection);
+    });
+  }
+  void setBusy(bool busy){
+    load_volume_pb->setEnabled(!busy);
+    remove_volume_pb->setEnabled(!busy);
+    compute_pb->setEnabled(!busy);
+    exact_pb->setEnabled(!busy);
+    cancel_pb->setEnabled(busy);
+  }
+  VolumeData loadVolume(const std::string& path){
     auto p = path.find_last_of("/");
     auto volume_name = path.substr(p+1);
-    volume_list->addItem(QString(volume_name.c_str()));
-    volumes.emplace_back();
-    auto& volume = volumes.back();
-    volume.data.resize(total);
-    volume.name = volume_name.substr(0,volume_name.length() - 4);
-
+    VolumeData volume;
     //if not uint8 should call Info::ConvertData to convert
-    in.read(reinterpret_cast<char*>(volume.data.data()),total);
-
-    volume.histogram = Info::CountValue(volume.data);
-    volume.entropy = Info::CalculateEntropy(volume.histogram,total);
+    try{
+      volume.data = VolCorrelation::MappedVolume(path,volume_x,volume_y,volume_z,
+                                                 VolCorrelation::DataType::UInt8);
+    }
+    catch(const std::exception& e){
+      std::cerr<<e.what()<<std::endl;
+      exit(1);
+    }
+    volume.name = volume_name.substr(0,volume_name.length() - 4);
+    return volume;
   }
   void clear(){
+    while(session.FieldNum() != 0){
+      session.RemoveField(session.FieldNum() - 1);
+    }
     volumes.clear();
     volume_list->clear();
   }
-  void draw(){
-    // prepare container to hold mutual informations and distance
-    vector<vector<double>> MI(volumes.size()), distances(volumes.size());
+  vector<const uint8_t*> fields() const{
+    vector<const uint8_t*> fields;
+    for (auto &volume : volumes) {
+      fields.push_back(volume.data.data<uint8_t>());
+    }
+    return fields;
+  }
+  // distances, clusters and layout of an MI matrix, safe to call from the
+  // pool while the buttons that change the volumes are disabled
+  Drawing arrange(const vector<vector<double>>& MI) const{
+    // prepare container to hold distance
+    vector<vector<double>> distances(volumes.size());
     for (size_t i = 0; i < volumes.size(); i++) {
-      MI[i].resize(volumes.size(), 0);
       distances[i].resize(volumes.size(), 0);
     }
-    // calculate mutual information
     auto min = FLT_MAX;
     for (size_t i = 0; i < volumes.size(); i++) {
-      auto &first = volumes[i];
       for (size_t j = i + 1; j < volumes.size(); j++) {
-        auto &second = volumes[j];
-        auto I = Info::CalculateMutationInformation(
-            first.data.data(), second.data.data(), first.histogram, second.histogram, total);
-        MI[i][j] = I;
+        auto I = MI[i][j];
         if (I < min && (0 != min)) {
           min = I;
         }
@@ -102,9 +234,29 @@ public:
       }
     }
 
-    const auto k = static_cast<size_t>(volumes.size()-1);
-    auto cluster = make_unique<Info::HierarchicalCluster>();
-    cluster->process(distances, k);
+    Drawing drawing;
+    drawing.k = static_cast<size_t>(volumes.size()-1);
+    drawing.cluster = make_unique<Info::HierarchicalCluster>();
+    drawing.cluster->process(distances, drawing.k);
+
+    // calculate particles in force directed layout
+    const auto width = 400;
+    const auto height = 600;
+    drawing.particles = Info::CalculateForceDirected(distances, width, height);
+    drawing.distances = std::move(distances);
+    return drawing;
+  }
+  // shows a drawing on the UI thread, unless its work stopped before it
+  void present(Drawing& drawing){
+    if(!drawing.cluster){
+      return;
+    }
+    display(drawing.distances, std::move(drawing.cluster), drawing.particles,
+            drawing.k);
+  }
+  void display(const vector<vector<double>>& distances,
+               unique_ptr<Info::HierarchicalCluster> cluster,
+               const vector<array<double,2>>& particles, size_t k){
     auto leaves = cluster->getLeaves();
 
     // prepare colors
@@ -123,11 +275,6 @@ public:
       entropys.push_back(volume.entropy);
     }
 
-    // calculate particles in force directed layout
-    const auto width = 400;
-    const auto height = 600;
-    auto particles = Info::CalculateForceDirected(distances, width, height);
-
     // display
     force_directed_layout->init(particles, entropys, leaves, distances, colors,k);
     force_directed_layout->update();
@@ -142,11 +289,18 @@ private:
   QListWidget* volume_list;
   QPushButton* load_volume_pb;
   QPushButton* compute_pb;
+  QPushButton* exact_pb;
+  QPushButton* remove_volume_pb;
+  QPushButton* cancel_pb;
+  QProgressBar* progress_bar;
+  VolCorrelation::CancellationToken token;
   Info::ClusteringDendrogram* dendrogram;
   Info::ForceDirectedLayout* force_directed_layout;
   std::vector<VolumeData> volumes;
+  Info::ResultCache cache;
   const int volume_x = 500, volume_y = 500, volume_z = 100;
   const size_t total = (size_t)volume_x * volume_y * volume_z;
+  Info::AnalysisSession session{total, &cache};
 };
 
 int main(int argc,char** argv){
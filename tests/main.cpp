@@ -1,6 +1,8 @@
 #include "VolCorrelation/GradientSimilarityMeasure.hpp"
 #include "VolCorrelation/LocalCorrelationCoefficient.hpp"
-#include "Info/MutualInformation.hpp"
+#include "VolCorrelation/MappedVolume.hpp"
+#include "VolCorrelation/Progressive.hpp"
+#include "VolCorrelation/ResultCache.hpp"
 #include <iostream>
 #include <vector>
 #include <QApplication>
@@ -10,6 +12,10 @@
 #include <QLabel>
 #include <QProcess>
 #include <QFileDialog>
+#include <QProgressBar>
+#include <QThreadPool>
+#include <functional>
+#include <memory>
 #include <iostream>
 #include <fstream>
 using namespace std;
@@ -27,6 +33,12 @@ public:
     compute_pb1->setGeometry(250,400,80,20);
     compute_pb2 = new QPushButton("相关性系数",this);
     compute_pb2->setGeometry(250,430,80,20);
+    cancel_pb = new QPushButton("cancel",this);
+    cancel_pb->setGeometry(150,430,80,20);
+    cancel_pb->setEnabled(false);
+    progress_bar = new QProgressBar(this);
+    progress_bar->setGeometry(50,460,280,20);
+    progress_bar->setRange(0,1000);
     connect(load_volume_pb,&QPushButton::clicked,this,[this](){
       auto path = QFileDialog::getOpenFileNames(this,
                                                 QStringLiteral("Load Volume"),
@@ -43,53 +55,144 @@ public:
       volumes.clear();
     });
     connect(compute_pb1,&QPushButton::clicked,this,[this](){
-      compute1();
-      draw();
+      run([this](const Progress& progress){ compute1(progress); });
     });
     connect(compute_pb2,&QPushButton::clicked,this,[this](){
-      compute2();
-      draw();
+      run([this](const Progress& progress){ compute2(progress); });
+    });
+    connect(cancel_pb,&QPushButton::clicked,this,[this](){
+      token.cancel();
+    });
+  }
+  ~Widget(){
+    token.cancel();
+    QThreadPool::globalInstance()->waitForDone();
+  }
+  // runs work on the global thread pool so the UI stays responsive, shows its
+  // progress and draws the result unless it was cancelled
+  void run(std::function<void(const Progress&)> work){
+    setBusy(true);
+    token.reset();
+    progress_bar->setValue(0);
+    QThreadPool::globalInstance()->start([this,work](){
+      Progress progress;
+      progress.token = &token;
+      progress.callback = [this](double fraction){
+        QMetaObject::invokeMethod(progress_bar,[this,fraction](){
+          progress_bar->setValue(static_cast<int>(fraction * 1000));
+        },Qt::QueuedConnection);
+      };
+      auto finished = false;
+      try{
+        work(progress);
+        finished = true;
+      }
+      catch(const OperationCancelled&){
+        // nothing to draw, the bar is reset below
+      }
+      catch(const std::exception& e){
+        std::cerr<<e.what()<<std::endl;
+      }
+      QMetaObject::invokeMethod(this,[this,finished](){
+        setBusy(false);
+        if(finished){
+          draw();
+        }
+        else{
+          progress_bar->setValue(0);
+        }
+      },Qt::QueuedConnection);
     });
   }
+  void setBusy(bool busy){
+    load_volume_pb->setEnabled(!busy);
+    clear_volume_pb->setEnabled(!busy);
+    compute_pb1->setEnabled(!busy);
+    compute_pb2->setEnabled(!busy);
+    cancel_pb->setEnabled(busy);
+  }
   void loadVolume(const std::string& path){
-    std::ifstream in(path,std::ios::binary);
-    if(!in.is_open()){
-      std::cerr<<"failed to open"<<std::endl;
-      exit(1);
-    }
     auto p = path.find_last_of("/");
     auto volume_name = path.substr(p+1);
+    try{
+      volumes.emplace_back(path,volume_x,volume_y,volume_z,DataType::UInt8);
+    }
+    catch(const std::exception& e){
+      std::cerr<<e.what()<<std::endl;
+      exit(1);
+    }
     volume_list->addItem(QString(volume_name.c_str()));
-    volumes.emplace_back();
-    auto& volume = volumes.back();
-    volume.resize(total,0);
-    in.read(reinterpret_cast<char*>(volume.data()),volume.size());
-    in.close();
   }
-  void compute1(){
-    vector<uint8_t*> fields;
+  vector<const MappedVolume*> fields() const{
+    vector<const MappedVolume*> fields;
     for(auto& volume:volumes){
-      fields.emplace_back(volume.data());
+      fields.emplace_back(&volume);
     }
-    const auto res = calculateGradientSimilarity(fields,volume_x,volume_y,volume_z);
-    auto ret = Info::ConvertData(res);
-    ofstream out("tmp.raw",std::ios::binary);
-    out.write(reinterpret_cast<char*>(ret.data()),ret.size());
-    out.close();
+    return fields;
   }
-  void compute2(){
-    vector<uint8_t*> fields;
+  // key of a result over the loaded volumes: their dimensions, data type and
+  // content, and the parameter
+  CacheKey resultKey(const std::string& kind,int parameter) const{
+    CacheKey key(kind);
+    key.add(volume_x).add(volume_y).add(volume_z);
     for(auto& volume:volumes){
-      fields.emplace_back(volume.data());
+      key.add(static_cast<int>(volume.type())).add(contentHash(volume));
+    }
+    return key.add(parameter);
+  }
+  // results are computed in uint16 and stretched by their range into the
+  // uint8 volumes the renderer reads, as ConvertData did with double results
+  void compute1(const Progress& progress){
+    const auto sensitivity = 2;
+    const auto key = resultKey("gsm-uint16",sensitivity);
+    QuantizedResult<uint16_t> res;
+    if(!cache.loadResult(key,res)){
+      auto level = calculateGradientSimilarityProgressive<uint16_t>(
+          fields(),sensitivity,ProgressiveOptions(),preview(),progress);
+      res.values = std::move(level.values);
+      res.range = level.range;
+      cache.storeResult(key,res);
     }
-    const auto res = calcLocalCorrelationCoefficient(fields,volume_x,volume_y,volume_z);
-    auto ret = Info::ConvertData(res);
-    ofstream out("tmp.raw",std::ios::binary);
-    out.write(reinterpret_cast<char*>(ret.data()),ret.size());
+    writeResult(stretchResult<uint8_t>(res));
+  }
+  void compute2(const Progress& progress){
+    const auto windowSize = 3;
+    const auto key = resultKey("lcc-uint16",windowSize);
+    QuantizedResult<uint16_t> res;
+    if(!cache.loadResult(key,res)){
+      auto level = calcLocalCorrelationCoefficientProgressive<uint16_t>(
+          fields(),windowSize,ProgressiveOptions(),preview(),progress);
+      res.values = std::move(level.values);
+      res.range = level.range;
+      cache.storeResult(key,res);
+    }
+    writeResult(stretchResult<uint8_t>(res));
+  }
+  // draws the first coarser level as soon as it is done, so an approximation
+  // shows while the finer levels compute. It goes to its own file, which the
+  // finer levels and the final result never overwrite.
+  ProgressiveCallback<uint16_t> preview(){
+    auto shown = std::make_shared<bool>(false);
+    return [this,shown](const ProgressiveLevel<uint16_t>& level){
+      if(level.level == 0 || *shown){
+        return;
+      }
+      *shown = true;
+      const auto path = "tmp_level"+std::to_string(level.level)+".raw";
+      QuantizedResult<uint16_t> upsampled;
+      upsampled.values = upsampleLevel(level,Vec3<uint32_t>(volume_x,volume_y,volume_z));
+      upsampled.range = level.range;
+      writeResult(stretchResult<uint8_t>(upsampled),path);
+      QMetaObject::invokeMethod(this,[this,path](){ draw(path); },Qt::QueuedConnection);
+    };
+  }
+  void writeResult(const vector<uint8_t>& values,const std::string& path = "tmp.raw"){
+    ofstream out(path,std::ios::binary);
+    out.write(reinterpret_cast<const char*>(values.data()),values.size());
     out.close();
   }
-  void draw(){
-    bool e = QProcess::startDetached("VolumeRender.exe",{"--raw_file=tmp.raw","--raw_x=500","--raw_y=500","--raw_z=100","--raw_data_type=uint8","--tf_file=tf.json"});
+  void draw(const std::string& path = "tmp.raw"){
+    bool e = QProcess::startDetached("VolumeRender.exe",{QString::fromStdString("--raw_file="+path),"--raw_x=500","--raw_y=500","--raw_z=100","--raw_data_type=uint8","--tf_file=tf.json"});
     if(!e){
       std::cerr<<"start VolumeRender.exe failed"<<std::endl;
       exit(1);
@@ -101,7 +204,11 @@ private:
   QPushButton* clear_volume_pb;
   QPushButton* compute_pb1;
   QPushButton* compute_pb2;
-  vector<vector<uint8_t>> volumes;
+  QPushButton* cancel_pb;
+  QProgressBar* progress_bar;
+  CancellationToken token;
+  vector<MappedVolume> volumes;
+  ResultCache cache;
   const int volume_x = 500, volume_y = 500, volume_z = 100;
   const size_t total = (size_t)volume_x * volume_y * volume_z;
 };
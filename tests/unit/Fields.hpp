@@ -0,0 +1,101 @@
+#pragma once
+#include "VolCorrelation/Common.hpp"
+#include "VolCorrelation/CpuDispatch.hpp"
+#include "VolCorrelation/Trace.hpp"
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+namespace VolCorrelation {
+namespace test {
+
+// volumes in the tests are small with odd, unequal sides, so that row tails,
+// faces and partial bricks are all exercised
+inline auto testDimensions() -> Vec3<uint32_t> { return {37, 29, 23}; }
+
+inline auto volumeSize(const Vec3<uint32_t> &dimensions) -> size_t {
+  return static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z;
+}
+
+// uniform values in [low, high], a fraction zeros of them set to 0
+template <typename T>
+auto randomField(size_t size, uint32_t seed, double low = 0, double high = 255,
+                 double zeros = 0) -> std::vector<T> {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> value(low, high);
+  std::uniform_real_distribution<double> unit(0, 1);
+  std::vector<T> field(size);
+  for (auto &voxel : field) {
+    voxel = static_cast<T>(value(rng));
+    if (unit(rng) < zeros) {
+      voxel = T(0);
+    }
+  }
+  return field;
+}
+
+// random values inside a ball and 0 around it, like a cloud or a storm cell
+// that covers a small part of the volume
+template <typename T>
+auto cloudField(const Vec3<uint32_t> &dimensions, double cx, double cy,
+                double cz, double radius, uint32_t seed) -> std::vector<T> {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> value(1, 255);
+  std::vector<T> field(volumeSize(dimensions), T(0));
+  size_t idx = 0;
+  for (uint32_t z = 0; z < dimensions.z; z++) {
+    for (uint32_t y = 0; y < dimensions.y; y++) {
+      for (uint32_t x = 0; x < dimensions.x; x++, idx++) {
+        const auto dx = x - cx, dy = y - cy, dz = z - cz;
+        if (dx * dx + dy * dy + dz * dz < radius * radius) {
+          field[idx] = static_cast<T>(value(rng));
+        }
+      }
+    }
+  }
+  return field;
+}
+
+template <typename T>
+auto pointers(const std::vector<std::vector<T>> &fields)
+    -> std::vector<const T *> {
+  std::vector<const T *> result;
+  for (auto &field : fields) {
+    result.push_back(field.data());
+  }
+  return result;
+}
+
+// every level the cpu runs, scalar first
+inline auto supportedIsas() -> std::vector<Isa> {
+  std::vector<Isa> isas;
+  for (auto isa : {Isa::Scalar, Isa::AVX2, Isa::AVX512}) {
+    if (isa <= detectIsa()) {
+      isas.push_back(isa);
+    }
+  }
+  return isas;
+}
+
+// forces an isa for its lifetime, then restores the detected one
+class IsaScope {
+public:
+  explicit IsaScope(Isa isa) { setActiveIsa(isa); }
+  IsaScope(const IsaScope &) = delete;
+  auto operator=(const IsaScope &) -> IsaScope & = delete;
+  ~IsaScope() { setActiveIsa(detectIsa()); }
+};
+
+// value of a trace counter over the work run since the last clear
+inline auto traceCounter(const std::string &name) -> double {
+  for (auto &counter : Tracer::instance().counters()) {
+    if (name == counter.name) {
+      return counter.value;
+    }
+  }
+  return 0;
+}
+
+} // namespace test
+} // namespace VolCorrelation
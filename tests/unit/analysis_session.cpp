@@ -0,0 +1,89 @@
+#include "Fields.hpp"
+#include "Info/AnalysisSession.hpp"
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace VolCorrelation;
+using namespace VolCorrelation::test;
+
+namespace {
+
+// fields that share a common part, so every pair has some information
+auto sharedFields(size_t size, uint32_t count)
+    -> std::vector<std::vector<uint8_t>> {
+  const auto base = randomField<uint8_t>(size, 100, 0, 127);
+  std::vector<std::vector<uint8_t>> fields;
+  for (uint32_t seed = 1; seed <= count; seed++) {
+    auto field = randomField<uint8_t>(size, seed, 0, 32.0 * seed);
+    for (size_t idx = 0; idx < size; idx++) {
+      field[idx] = static_cast<uint8_t>(field[idx] / 2 + base[idx]);
+    }
+    fields.push_back(std::move(field));
+  }
+  return fields;
+}
+
+void expectNear(const std::vector<std::vector<double>> &actual,
+                const std::vector<std::vector<double>> &expected) {
+  ASSERT_EQ(actual.size(), expected.size());
+  for (size_t i = 0; i < actual.size(); i++) {
+    ASSERT_EQ(actual[i].size(), expected[i].size());
+    for (size_t j = 0; j < actual[i].size(); j++) {
+      EXPECT_NEAR(actual[i][j], expected[i][j], 1e-12) << i << " " << j;
+    }
+  }
+}
+
+} // namespace
+
+// adding fields one by one and removing one gives the matrix of the fields
+// that are left
+TEST(AnalysisSession, MatchesMatrixAfterAddAndRemove) {
+  const size_t size = 30000;
+  auto fields = sharedFields(size, 6);
+  Info::AnalysisSession session(size);
+  for (auto &field : fields) {
+    session.AddField(field.data());
+  }
+  session.RemoveField(2);
+  fields.erase(fields.begin() + 2);
+  ASSERT_EQ(session.FieldNum(), fields.size());
+
+  const auto expected =
+      Info::CalculateMutualInformationMatrix(pointers(fields), size);
+  expectNear(session.MutualInformation(), expected.mi);
+  for (size_t i = 0; i < fields.size(); i++) {
+    EXPECT_EQ(session.Histogram(i), expected.histograms[i]);
+    EXPECT_NEAR(session.Entropy(i), expected.entropies[i], 1e-12);
+  }
+}
+
+// a cancelled add throws and leaves the session as it was
+TEST(AnalysisSession, CancelledAddLeavesSessionUnchanged) {
+  const size_t size = 30000;
+  const auto fields = sharedFields(size, 4);
+  Info::AnalysisSession session(size);
+  for (size_t i = 0; i < 3; i++) {
+    session.AddField(fields[i].data());
+  }
+  Info::ForceDirectedOptions options;
+  options.maxIterations = 10;
+  session.Layout(200, 200, options);
+  const auto mi = session.MutualInformation();
+  const auto positions = session.Positions();
+
+  // cancelled from the first progress report, in the middle of the counting
+  CancellationToken token;
+  Progress progress;
+  progress.token = &token;
+  progress.callback = [&token](double) { token.cancel(); };
+  EXPECT_THROW(session.AddField(fields[3].data(), progress),
+               OperationCancelled);
+  EXPECT_EQ(session.FieldNum(), 3u);
+  EXPECT_EQ(session.MutualInformation(), mi);
+  EXPECT_EQ(session.Positions(), positions);
+
+  // and the same field can still be added afterwards
+  EXPECT_EQ(session.AddField(fields[3].data()), 3u);
+  EXPECT_EQ(session.FieldNum(), 4u);
+}
@@ -0,0 +1,96 @@
+#include "Fields.hpp"
+#include "Info/BinnedMutualInformation.hpp"
+#include <gtest/gtest.h>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using namespace VolCorrelation;
+using namespace VolCorrelation::test;
+
+namespace {
+
+const size_t size = 50000;
+
+// b follows a with noise, so the pair shares information in every bin count
+template <typename T>
+auto fieldPair(double high) -> std::pair<std::vector<T>, std::vector<T>> {
+  auto a = randomField<T>(size, 1, 0, high);
+  const auto noise = randomField<double>(size, 2, 0, high / 4);
+  std::vector<T> b(size);
+  for (size_t idx = 0; idx < size; idx++) {
+    b[idx] = static_cast<T>(0.75 * a[idx] + noise[idx]);
+  }
+  return {std::move(a), std::move(b)};
+}
+
+template <typename T> void expectMatchesConvertData(double high) {
+  const auto fields = fieldPair<T>(high);
+  const auto a = Info::ConvertData(fields.first);
+  const auto b = Info::ConvertData(fields.second);
+  auto countsA = Info::CountValue(a.data(), size);
+  const auto countsB = Info::CountValue(b.data(), size);
+  EXPECT_NEAR(Info::CalculateBinnedMutualInformation(
+                  fields.first.data(), fields.second.data(), size, 256),
+              Info::CalculateMutationInformation(a.data(), b.data(), countsA,
+                                                 countsB, size),
+              1e-12);
+  EXPECT_NEAR(Info::CalculateBinnedEntropy(fields.first.data(), size, 256),
+              Info::CalculateEntropy(countsA, size), 1e-12);
+}
+
+} // namespace
+
+TEST(BinnedMutualInformation, MatchesConvertDataWith256BinsUint16) {
+  expectMatchesConvertData<uint16_t>(65535);
+}
+
+TEST(BinnedMutualInformation, MatchesConvertDataWith256BinsFloat) {
+  expectMatchesConvertData<float>(1000);
+}
+
+// denseLimit 0 counts into the hash table at every bin count
+TEST(BinnedMutualInformation, HashMatchesDense) {
+  const auto fields = fieldPair<uint16_t>(65535);
+  const auto dense = std::numeric_limits<size_t>::max();
+  for (size_t binNum : {2, 64, 256, 1000, 1024}) {
+    SCOPED_TRACE(binNum);
+    EXPECT_NEAR(
+        Info::CalculateBinnedMutualInformation(
+            fields.first.data(), fields.second.data(), size, binNum, 0),
+        Info::CalculateBinnedMutualInformation(
+            fields.first.data(), fields.second.data(), size, binNum, dense),
+        1e-12);
+  }
+}
+
+// the other field takes 200 values that each fill many voxels, so noise
+// removal folds none of its bins
+TEST(BinnedMutualInformation, ConstantFieldSharesNothing) {
+  const std::vector<float> constant(size, 3.5f);
+  std::vector<float> field(size);
+  for (size_t idx = 0; idx < size; idx++) {
+    field[idx] = static_cast<float>(idx * 7 % 200) - 10.0f;
+  }
+  for (size_t binNum : {256, 4096}) {
+    SCOPED_TRACE(binNum);
+    EXPECT_NEAR(Info::CalculateBinnedMutualInformation(
+                    constant.data(), field.data(), size, binNum),
+                0.0, 1e-12);
+    EXPECT_NEAR(Info::CalculateBinnedMutualInformation(
+                    field.data(), constant.data(), size, binNum, 0),
+                0.0, 1e-12);
+    EXPECT_NEAR(Info::CalculateBinnedEntropy(constant.data(), size, binNum),
+                0.0, 1e-12);
+  }
+}
+
+TEST(BinnedMutualInformation, InvalidBinCountThrows) {
+  const auto field = randomField<float>(size, 3, -10, 10);
+  EXPECT_THROW(Info::CalculateBinnedMutualInformation(field.data(),
+                                                      field.data(), size, 1),
+               std::invalid_argument);
+  EXPECT_THROW(Info::CalculateBinnedEntropy(field.data(), size, 65537),
+               std::invalid_argument);
+}
@@ -0,0 +1,76 @@
+#include "Fields.hpp"
+#include "Info/ForceDirected.hpp"
+#include <array>
+#include <gtest/gtest.h>
+#include <utility>
+#include <vector>
+
+using namespace VolCorrelation;
+using namespace VolCorrelation::test;
+
+namespace {
+
+const std::vector<std::vector<double>> distances{{0, 40, 75, 100, 60},
+                                                 {40, 0, 55, 90, 100},
+                                                 {75, 55, 0, 35, 80},
+                                                 {100, 90, 35, 0, 50},
+                                                 {60, 100, 80, 50, 0}};
+
+// a layout and the newton steps it took
+auto layoutSteps(const std::vector<std::vector<double>> &ds,
+                 const Info::ForceDirectedOptions &options)
+    -> std::pair<std::vector<std::array<double, 2>>, double> {
+  auto &tracer = Tracer::instance();
+  tracer.clear();
+  tracer.enable();
+  auto positions = Info::CalculateForceDirected(ds, 400, 400, options);
+  tracer.enable(false);
+  const auto steps = traceCounter("layout newton iterations");
+  tracer.clear();
+  return {std::move(positions), steps};
+}
+
+} // namespace
+
+// the positions the solver found before it kept gradients incrementally
+TEST(ForceDirected, MatchesRecomputingSolver) {
+  const std::vector<std::array<double, 2>> expected{
+      {347.68793047793679, 127.96788026671106},
+      {248.12973780581291, 55.407131157808188},
+      {84.655980965129515, 140.23228360174639},
+      {108.81874216890314, 278.01268116846671},
+      {307.33126291998997, 253.66563145999496}};
+  const auto positions = Info::CalculateForceDirected(distances, 400, 400);
+  ASSERT_EQ(positions.size(), expected.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    EXPECT_NEAR(positions[i][0], expected[i][0], 1e-9) << "particle " << i;
+    EXPECT_NEAR(positions[i][1], expected[i][1], 1e-9) << "particle " << i;
+  }
+}
+
+TEST(ForceDirected, BudgetsStopTheSolve) {
+  const auto converged = layoutSteps(distances, {});
+  ASSERT_GT(converged.second, 5);
+
+  Info::ForceDirectedOptions options;
+  options.maxIterations = 5;
+  const auto limited = layoutSteps(distances, options);
+  EXPECT_EQ(limited.second, 5);
+  EXPECT_NE(limited.first, converged.first);
+
+  // without any budget the particles stay at their start positions
+  options.maxIterations = 0;
+  const auto start = layoutSteps(distances, options);
+  EXPECT_EQ(start.second, 0);
+  options = {};
+  options.timeBudget = 0;
+  const auto timed = layoutSteps(distances, options);
+  EXPECT_EQ(timed.second, 0);
+  EXPECT_EQ(timed.first, start.first);
+
+  // a previous layout is kept as the start positions
+  options = {};
+  options.maxIterations = 0;
+  options.initialPositions = converged.first;
+  EXPECT_EQ(layoutSteps(distances, options).first, converged.first);
+}
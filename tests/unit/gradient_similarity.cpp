@@ -0,0 +1,186 @@
+#include "Fields.hpp"
+#include "Info/MutualInformation.hpp"
+#include "VolCorrelation/GradientSimilarityMeasure.hpp"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+using namespace VolCorrelation;
+using namespace VolCorrelation::test;
+
+namespace {
+
+// the original pair-outer loop: every voxel runs the 27-tap stencil of both
+// fields of every pair
+auto referenceSimilarity(const std::vector<const uint8_t *> &fields,
+                         const Vec3<uint32_t> &dimensions, int sensitivity)
+    -> std::vector<double> {
+  const auto size = volumeSize(dimensions);
+  const auto offsetZ = static_cast<size_t>(dimensions.x) * dimensions.y;
+  std::vector<std::vector<double>> normalizeds;
+  for (auto field : fields) {
+    normalizeds.push_back(normalizeField<uint8_t, double>(field, size));
+  }
+  std::vector<double> result(size, 1.0);
+  for (size_t i = 0; i < fields.size(); i++) {
+    for (size_t j = i + 1; j < fields.size(); j++) {
+      size_t index = 0;
+      for (uint32_t z = 0; z < dimensions.z; z++) {
+        for (uint32_t y = 0; y < dimensions.y; y++) {
+          for (uint32_t x = 0; x < dimensions.x; x++, index++) {
+            const Vec3<uint32_t> pos(x, y, z);
+            const auto gi = calculateGradient(normalizeds[i].data(), pos,
+                                              dimensions, index, offsetZ);
+            const auto gj = calculateGradient(normalizeds[j].data(), pos,
+                                              dimensions, index, offsetZ);
+            result[index] = std::fmin(
+                result[index], calculatePairSimilarity(gi, gj, sensitivity));
+          }
+        }
+      }
+    }
+  }
+  return result;
+}
+
+void expectNear(const std::vector<double> &actual,
+                const std::vector<double> &expected, double tolerance) {
+  ASSERT_EQ(actual.size(), expected.size());
+  for (size_t idx = 0; idx < actual.size(); idx++) {
+    ASSERT_NEAR(actual[idx], expected[idx], tolerance) << "voxel " << idx;
+  }
+}
+
+auto randomFields(const Vec3<uint32_t> &dimensions)
+    -> std::vector<std::vector<uint8_t>> {
+  std::vector<std::vector<uint8_t>> fields;
+  for (uint32_t seed = 1; seed <= 4; seed++) {
+    fields.push_back(
+        randomField<uint8_t>(volumeSize(dimensions), seed, 0, 255, 0.3));
+  }
+  return fields;
+}
+
+auto cloudFields(const Vec3<uint32_t> &dimensions)
+    -> std::vector<std::vector<uint8_t>> {
+  return {cloudField<uint8_t>(dimensions, 10, 10, 8, 6, 1),
+          cloudField<uint8_t>(dimensions, 12, 11, 9, 7, 2),
+          cloudField<uint8_t>(dimensions, 25, 18, 15, 5, 3)};
+}
+
+} // namespace
+
+TEST(GradientSimilarity, MatchesPerVoxelStencil) {
+  const auto dimensions = testDimensions();
+  const auto fields = randomFields(dimensions);
+  const auto expected = referenceSimilarity(pointers(fields), dimensions, 2);
+  expectNear(calculateGradientSimilarity(pointers(fields), dimensions.x,
+                                         dimensions.y, dimensions.z, 2),
+             expected, 1e-12);
+}
+
+TEST(GradientSimilarity, GradientCacheMatchesVoxelOuter) {
+  const auto dimensions = testDimensions();
+  const auto fields = randomFields(dimensions);
+  const auto gradients = calculateGradientVolumes<const uint8_t, double>(
+      pointers(fields), dimensions.x, dimensions.y, dimensions.z);
+  EXPECT_EQ(calculateGradientSimilarity(gradients, 2),
+            calculateGradientSimilarityVoxelOuter(pointers(fields),
+                                                  dimensions.x, dimensions.y,
+                                                  dimensions.z, 2));
+}
+
+// the skipped runs of a sparse volume hold exactly what the unskipped
+// pair-outer kernel computes
+TEST(GradientSimilarity, SkippedBricksMatchUnskipped) {
+  const auto dimensions = testDimensions();
+  const auto fields = cloudFields(dimensions);
+  const auto gradients = calculateGradientVolumes<const uint8_t, double>(
+      pointers(fields), dimensions.x, dimensions.y, dimensions.z);
+
+  auto &tracer = Tracer::instance();
+  tracer.clear();
+  tracer.enable();
+  const auto result = calculateGradientSimilarityVoxelOuter(
+      pointers(fields), dimensions.x, dimensions.y, dimensions.z, 2);
+  tracer.enable(false);
+  EXPECT_GT(traceCounter("gsm voxels skipped"), 0);
+  tracer.clear();
+
+  EXPECT_EQ(result, calculateGradientSimilarity(gradients, 2));
+}
+
+// an all-zero field normalizes to NaN and must not be taken for a zero
+// gradient by the brick index
+TEST(GradientSimilarity, AllZeroFieldIsNotSkipped) {
+  const auto dimensions = testDimensions();
+  std::vector<std::vector<uint8_t>> fields{
+      std::vector<uint8_t>(volumeSize(dimensions), 0),
+      randomField<uint8_t>(volumeSize(dimensions), 7)};
+  const auto expected = referenceSimilarity(pointers(fields), dimensions, 2);
+  const auto result = calculateGradientSimilarity(
+      pointers(fields), dimensions.x, dimensions.y, dimensions.z, 2);
+  ASSERT_EQ(result.size(), expected.size());
+  for (size_t idx = 0; idx < result.size(); idx++) {
+    ASSERT_EQ(std::isnan(result[idx]), std::isnan(expected[idx]));
+    if (!std::isnan(expected[idx])) {
+      ASSERT_NEAR(result[idx], expected[idx], 1e-12) << "voxel " << idx;
+    }
+  }
+}
+
+TEST(GradientSimilarity, QuantizedEncodesVoxelOuter) {
+  const auto dimensions = testDimensions();
+  const auto fields = cloudFields(dimensions);
+  const auto values = calculateGradientSimilarityVoxelOuter(
+      pointers(fields), dimensions.x, dimensions.y, dimensions.z, 2);
+  const auto quantized = calculateGradientSimilarityQuantized<uint16_t>(
+      pointers(fields), dimensions.x, dimensions.y, dimensions.z, 2);
+  ASSERT_EQ(quantized.values.size(), values.size());
+  for (size_t idx = 0; idx < values.size(); idx++) {
+    ASSERT_EQ(quantized.values[idx], encodeResult<uint16_t>(values[idx]));
+  }
+  EXPECT_EQ(quantized.range.min,
+            *std::min_element(values.begin(), values.end()));
+  EXPECT_EQ(quantized.range.max,
+            *std::max_element(values.begin(), values.end()));
+}
+
+// stretching a uint16 result by its range gives the uint8 volume ConvertData
+// makes of the double result, up to one step of the uint16 quantization
+TEST(GradientSimilarity, StretchedMatchesConvertData) {
+  const auto dimensions = testDimensions();
+  const auto fields = cloudFields(dimensions);
+  const auto values = calculateGradientSimilarityVoxelOuter(
+      pointers(fields), dimensions.x, dimensions.y, dimensions.z, 2);
+  const auto stretched =
+      stretchResult<uint8_t>(calculateGradientSimilarityQuantized<uint16_t>(
+          pointers(fields), dimensions.x, dimensions.y, dimensions.z, 2));
+  const auto converted = Info::ConvertData(values);
+  ASSERT_EQ(stretched.size(), converted.size());
+  size_t equal = 0;
+  for (size_t idx = 0; idx < converted.size(); idx++) {
+    ASSERT_LE(std::abs(stretched[idx] - converted[idx]), 1) << "voxel " << idx;
+    equal += stretched[idx] == converted[idx];
+  }
+  EXPECT_GT(equal, converted.size() * 9 / 10);
+}
+
+TEST(GradientSimilarity, IsasAgree) {
+  const auto dimensions = testDimensions();
+  const auto fields = randomFields(dimensions);
+  std::vector<double> scalar;
+  {
+    IsaScope isa(Isa::Scalar);
+    scalar = calculateGradientSimilarity(pointers(fields), dimensions.x,
+                                         dimensions.y, dimensions.z, 2);
+  }
+  for (auto isa : supportedIsas()) {
+    IsaScope scope(isa);
+    SCOPED_TRACE(isaName(isa));
+    expectNear(calculateGradientSimilarity(pointers(fields), dimensions.x,
+                                           dimensions.y, dimensions.z, 2),
+               scalar, 1e-12);
+  }
+}
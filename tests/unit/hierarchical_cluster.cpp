@@ -0,0 +1,167 @@
+#include "Info/HierarchicalCluster.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <gtest/gtest.h>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace Info;
+
+namespace {
+
+// the closest-pair search the clustering started from, kept to compare with
+class GreedyCluster {
+public:
+  void process(const std::vector<std::vector<double>> &distances, size_t k) {
+    std::vector<Node *> nodes(distances.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+      nodes[i] = new Node();
+      nodes[i]->id = i;
+      owned.push_back(nodes[i]);
+    }
+    while (nodes.size() > 1) {
+      auto closest = std::make_pair<size_t, size_t>(0, 0);
+      double min = FLT_MAX;
+      for (size_t i = 0; i < nodes.size(); i++) {
+        for (size_t j = i + 1; j < nodes.size(); j++) {
+          auto distance = calcDistance(nodes[i], nodes[j], distances);
+          distance /= (nodes[i]->count * nodes[j]->count);
+          if (distance < min) {
+            min = distance;
+            closest.first = i;
+            closest.second = j;
+          }
+        }
+      }
+      auto node = new Node();
+      owned.push_back(node);
+      node->isLeaf = false;
+      node->left = nodes[closest.first];
+      node->right = nodes[closest.second];
+      node->count = node->left->count + node->right->count;
+      node->distance = min;
+      nodes[closest.first] = node;
+      nodes[closest.second] = nodes.back();
+      nodes.pop_back();
+      if (nodes.size() == k) {
+        clusters = nodes;
+      }
+    }
+    root = nodes[0];
+  }
+
+  ~GreedyCluster() {
+    for (auto node : owned) {
+      delete node;
+    }
+  }
+
+  Node *root = nullptr;
+  std::vector<Node *> clusters;
+
+private:
+  std::vector<Node *> owned;
+};
+
+void expectSameTree(const Node *expected, const Node *actual) {
+  ASSERT_EQ(expected->isLeaf, actual->isLeaf);
+  EXPECT_EQ(expected->count, actual->count);
+  if (expected->isLeaf) {
+    EXPECT_EQ(expected->id, actual->id);
+    return;
+  }
+  EXPECT_DOUBLE_EQ(expected->distance, actual->distance);
+  expectSameTree(expected->left, actual->left);
+  expectSameTree(expected->right, actual->right);
+}
+
+// leaf ids of a subtree, left to right
+void collectLeaves(const Node *node, std::vector<size_t> &ids) {
+  if (node->isLeaf) {
+    ids.push_back(node->id);
+    return;
+  }
+  collectLeaves(node->left, ids);
+  collectLeaves(node->right, ids);
+}
+
+// symmetric distances, either all different or drawn from a few values with
+// the 100.0 that pairs without shared information get
+auto randomDistances(size_t n, bool tied, std::mt19937 &rng)
+    -> std::vector<std::vector<double>> {
+  std::uniform_real_distribution<double> value(0.5, 100.0);
+  std::uniform_int_distribution<int> level(1, 8);
+  std::vector<std::vector<double>> distances(n, std::vector<double>(n, 0.0));
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = i + 1; j < n; j++) {
+      const auto l = level(rng);
+      distances[i][j] = !tied ? value(rng) : l > 4 ? 100.0 : l;
+      distances[j][i] = distances[i][j];
+    }
+  }
+  return distances;
+}
+
+void expectMatchesGreedy(bool tied) {
+  std::mt19937 rng(tied ? 2 : 1);
+  for (int trial = 0; trial < 200; trial++) {
+    const auto n = std::uniform_int_distribution<size_t>(2, 40)(rng);
+    const auto k = std::uniform_int_distribution<size_t>(1, n)(rng);
+    const auto distances = randomDistances(n, tied, rng);
+    SCOPED_TRACE(testing::Message() << "trial " << trial << ", n " << n
+                                    << ", k " << k);
+
+    GreedyCluster greedy;
+    greedy.process(distances, k);
+    HierarchicalCluster cluster;
+    cluster.process(distances, k);
+
+    expectSameTree(greedy.root, cluster.getRoot());
+    const auto leaves = cluster.getLeaves();
+    ASSERT_EQ(leaves.size(), n);
+    for (size_t i = 0; i < n; i++) {
+      EXPECT_EQ(leaves[i]->id, i);
+    }
+
+    // the k-cut: same clusters in the same order
+    const auto clusters = cluster.getClusters();
+    ASSERT_EQ(clusters.size(), greedy.clusters.size());
+    for (size_t c = 0; c < clusters.size(); c++) {
+      std::vector<size_t> expected, actual;
+      collectLeaves(greedy.clusters[c], expected);
+      collectLeaves(clusters[c], actual);
+      EXPECT_EQ(actual, expected);
+      for (auto leaf : leaves) {
+        if (std::find(actual.begin(), actual.end(), leaf->id) !=
+            actual.end()) {
+          EXPECT_EQ(leaf->belong, static_cast<int>(c));
+        }
+      }
+    }
+  }
+}
+
+} // namespace
+
+TEST(HierarchicalCluster, MatchesGreedyWithoutTies) {
+  expectMatchesGreedy(false);
+}
+
+// ties go to the first pair of the node list, as in the greedy search
+TEST(HierarchicalCluster, MatchesGreedyWithTies) { expectMatchesGreedy(true); }
+
+TEST(HierarchicalCluster, LinkagesMergeAtTheirDistances) {
+  // 0 and 1 are close, 2 is 4 from 0 and 6 from 1
+  const std::vector<std::vector<double>> distances{
+      {0, 1, 4}, {1, 0, 6}, {4, 6, 0}};
+  const std::pair<Linkage, double> expected[] = {{Linkage::Single, 4.0},
+                                                 {Linkage::Complete, 6.0},
+                                                 {Linkage::Average, 5.0}};
+  for (auto &linkage : expected) {
+    HierarchicalCluster cluster;
+    cluster.process(distances, 1, linkage.first);
+    EXPECT_DOUBLE_EQ(cluster.getRoot()->distance, linkage.second);
+    EXPECT_DOUBLE_EQ(cluster.getRoot()->left->distance, 1.0);
+  }
+}
@@ -0,0 +1,151 @@
+#include "Fields.hpp"
+#include "VolCorrelation/LocalCorrelationCoefficient.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace VolCorrelation;
+using namespace VolCorrelation::test;
+
+namespace {
+
+void expectNear(const std::vector<double> &actual,
+                const std::vector<double> &expected, double tolerance) {
+  ASSERT_EQ(actual.size(), expected.size());
+  for (size_t idx = 0; idx < actual.size(); idx++) {
+    ASSERT_NEAR(actual[idx], expected[idx], tolerance) << "voxel " << idx;
+  }
+}
+
+template <typename T>
+auto randomFields(const Vec3<uint32_t> &dimensions, double low, double high)
+    -> std::vector<std::vector<T>> {
+  std::vector<std::vector<T>> fields;
+  for (uint32_t seed = 1; seed <= 3; seed++) {
+    fields.push_back(
+        randomField<T>(volumeSize(dimensions), seed, low, high, 0.2));
+  }
+  return fields;
+}
+
+auto cloudFields(const Vec3<uint32_t> &dimensions)
+    -> std::vector<std::vector<uint8_t>> {
+  return {cloudField<uint8_t>(dimensions, 10, 10, 8, 6, 1),
+          cloudField<uint8_t>(dimensions, 12, 11, 9, 7, 2),
+          cloudField<uint8_t>(dimensions, 25, 18, 15, 5, 3)};
+}
+
+// the summed-area backend against the direct one on values of type T
+template <typename T> void expectSummedAreaMatches(double low, double high) {
+  const auto dimensions = testDimensions();
+  const auto fields = randomFields<T>(dimensions, low, high);
+  for (int windowSize : {1, 3}) {
+    SCOPED_TRACE(windowSize);
+    const auto direct = calcLocalCorrelationCoefficient(
+        pointers(fields), dimensions.x, dimensions.y, dimensions.z,
+        windowSize, LCCBackend::Direct);
+    expectNear(calcLocalCorrelationCoefficient(
+                   pointers(fields), dimensions.x, dimensions.y, dimensions.z,
+                   windowSize, LCCBackend::SummedArea),
+               direct, 1e-6);
+  }
+}
+
+} // namespace
+
+TEST(LocalCorrelation, VoxelOuterMatchesDirect) {
+  const auto dimensions = testDimensions();
+  const auto fields = randomFields<uint8_t>(dimensions, 0, 255);
+  for (int windowSize : {1, 2, 3}) {
+    SCOPED_TRACE(windowSize);
+    expectNear(calcLocalCorrelationCoefficientVoxelOuter(
+                   pointers(fields), dimensions.x, dimensions.y, dimensions.z,
+                   windowSize),
+               calcLocalCorrelationCoefficient(pointers(fields), dimensions.x,
+                                               dimensions.y, dimensions.z,
+                                               windowSize),
+               1e-12);
+  }
+}
+
+TEST(LocalCorrelation, SummedAreaMatchesDirectUint8) {
+  expectSummedAreaMatches<uint8_t>(0, 255);
+}
+
+TEST(LocalCorrelation, SummedAreaMatchesDirectUint16) {
+  expectSummedAreaMatches<uint16_t>(0, 65535);
+}
+
+TEST(LocalCorrelation, SummedAreaMatchesDirectInt16) {
+  expectSummedAreaMatches<int16_t>(-32768, 32767);
+}
+
+TEST(LocalCorrelation, SummedAreaMatchesDirectUint32) {
+  expectSummedAreaMatches<uint32_t>(0, 4294967295.0);
+}
+
+TEST(LocalCorrelation, SummedAreaMatchesDirectInt32) {
+  expectSummedAreaMatches<int32_t>(-2147483648.0, 2147483647.0);
+}
+
+TEST(LocalCorrelation, SummedAreaMatchesDirectFloat) {
+  expectSummedAreaMatches<float>(0, 1000);
+}
+
+// windows that fall in empty space are known to be 0 from the bricks; the
+// skipped voxels hold exactly what the unskipped direct kernel computes
+TEST(LocalCorrelation, SkippedBricksMatchUnskipped) {
+  const auto dimensions = testDimensions();
+  const auto fields = cloudFields(dimensions);
+
+  auto &tracer = Tracer::instance();
+  tracer.clear();
+  tracer.enable();
+  const auto result = calcLocalCorrelationCoefficientVoxelOuter(
+      pointers(fields), dimensions.x, dimensions.y, dimensions.z, 1);
+  tracer.enable(false);
+  EXPECT_GT(traceCounter("lcc voxels skipped"), 0);
+  tracer.clear();
+
+  expectNear(result,
+             calcLocalCorrelationCoefficient(pointers(fields), dimensions.x,
+                                             dimensions.y, dimensions.z, 1),
+             1e-12);
+}
+
+TEST(LocalCorrelation, QuantizedEncodesVoxelOuter) {
+  const auto dimensions = testDimensions();
+  const auto fields = cloudFields(dimensions);
+  const auto values = calcLocalCorrelationCoefficientVoxelOuter(
+      pointers(fields), dimensions.x, dimensions.y, dimensions.z, 2);
+  const auto quantized = calcLocalCorrelationCoefficientQuantized<uint8_t>(
+      pointers(fields), dimensions.x, dimensions.y, dimensions.z, 2);
+  ASSERT_EQ(quantized.values.size(), values.size());
+  for (size_t idx = 0; idx < values.size(); idx++) {
+    ASSERT_EQ(quantized.values[idx], encodeResult<uint8_t>(values[idx]));
+  }
+  EXPECT_EQ(quantized.range.min,
+            *std::min_element(values.begin(), values.end()));
+  EXPECT_EQ(quantized.range.max,
+            *std::max_element(values.begin(), values.end()));
+}
+
+TEST(LocalCorrelation, IsasAgree) {
+  const auto dimensions = testDimensions();
+  const auto fields = randomFields<uint8_t>(dimensions, 0, 255);
+  std::vector<double> scalar;
+  {
+    IsaScope isa(Isa::Scalar);
+    scalar = calcLocalCorrelationCoefficientVoxelOuter(
+        pointers(fields), dimensions.x, dimensions.y, dimensions.z, 3);
+  }
+  for (auto isa : supportedIsas()) {
+    IsaScope scope(isa);
+    SCOPED_TRACE(isaName(isa));
+    expectNear(calcLocalCorrelationCoefficientVoxelOuter(
+                   pointers(fields), dimensions.x, dimensions.y, dimensions.z,
+                   3),
+               scalar, 1e-12);
+  }
+}
@@ -0,0 +1,30 @@
+#include "Fields.hpp"
+#include "Info/MutualInformationMatrix.hpp"
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace VolCorrelation;
+using namespace VolCorrelation::test;
+
+// converting chunk by chunk buckets every chunk by its whole field's range,
+// so any chunk size counts what ConvertData copies of the fields count
+TEST(MutualInformation, ConvertedChunksMatchConvertData) {
+  const size_t size = 50000;
+  std::vector<std::vector<float>> fields;
+  for (uint32_t seed = 1; seed <= 5; seed++) {
+    fields.push_back(randomField<float>(size, seed, -1.0 * seed, 10.0 * seed));
+  }
+  std::vector<std::vector<uint8_t>> converted;
+  for (auto &field : fields) {
+    converted.push_back(Info::ConvertData(field));
+  }
+  const auto expected =
+      Info::CalculateMutualInformationMatrix(pointers(converted), size);
+  for (size_t chunkSize : {size_t(1000), size_t(4099), size}) {
+    SCOPED_TRACE(chunkSize);
+    const auto result = Info::CalculateConvertedMutualInformationMatrix(
+        pointers(fields), size, chunkSize);
+    EXPECT_EQ(result.histograms, expected.histograms);
+    EXPECT_EQ(result.mi, expected.mi);
+  }
+}
@@ -0,0 +1,35 @@
+#include "Fields.hpp"
+#include "VolCorrelation/Progressive.hpp"
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace VolCorrelation;
+using namespace VolCorrelation::test;
+
+// with the default options every brick is refined, so the last level is the
+// full-resolution result
+TEST(Progressive, LastLevelMatchesFullPass) {
+  const Vec3<uint32_t> dimensions(70, 66, 40);
+  std::vector<std::vector<uint8_t>> fields{
+      randomField<uint8_t>(volumeSize(dimensions), 1, 0, 255, 0.3),
+      cloudField<uint8_t>(dimensions, 30, 30, 30, 20, 2)};
+
+  std::vector<uint32_t> levels;
+  const auto gsm = calculateGradientSimilarityProgressive<uint8_t>(
+      pointers(fields), dimensions, 2, ProgressiveOptions(),
+      [&levels](const ProgressiveLevel<uint8_t> &level) {
+        levels.push_back(level.level);
+      });
+  EXPECT_EQ(levels, (std::vector<uint32_t>{1, 0}));
+  EXPECT_EQ(gsm.values, calculateGradientSimilarityQuantized<uint8_t>(
+                            pointers(fields), dimensions.x, dimensions.y,
+                            dimensions.z, 2)
+                            .values);
+
+  const auto lcc = calcLocalCorrelationCoefficientProgressive<uint8_t>(
+      pointers(fields), dimensions, 3);
+  EXPECT_EQ(lcc.values, calcLocalCorrelationCoefficientQuantized<uint8_t>(
+                            pointers(fields), dimensions.x, dimensions.y,
+                            dimensions.z, 3)
+                            .values);
+}
@@ -0,0 +1,143 @@
+#include "Fields.hpp"
+#include "VolCorrelation/Region.hpp"
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+using namespace VolCorrelation;
+using namespace VolCorrelation::test;
+
+namespace {
+
+auto testFields(const Vec3<uint32_t> &dimensions)
+    -> std::vector<std::vector<uint8_t>> {
+  return {randomField<uint8_t>(volumeSize(dimensions), 1, 0, 255, 0.3),
+          cloudField<uint8_t>(dimensions, 12, 11, 9, 9, 2),
+          randomField<uint8_t>(volumeSize(dimensions), 3, 0, 255, 0.3)};
+}
+
+// the voxels of region in a full-volume result
+template <typename Out>
+auto crop(const std::vector<Out> &values, const Vec3<uint32_t> &dimensions,
+          const Region &region) -> std::vector<Out> {
+  std::vector<Out> result;
+  for (auto z = region.begin.z; z < region.end.z; z++) {
+    for (auto y = region.begin.y; y < region.end.y; y++) {
+      for (auto x = region.begin.x; x < region.end.x; x++) {
+        result.push_back(
+            values[(static_cast<size_t>(z) * dimensions.y + y) * dimensions.x +
+                   x]);
+      }
+    }
+  }
+  return result;
+}
+
+// a scattered set of voxels, some repeated, in no particular order
+auto scatteredVoxels(const Vec3<uint32_t> &dimensions)
+    -> std::vector<Vec3<uint32_t>> {
+  std::vector<Vec3<uint32_t>> voxels;
+  for (uint32_t i = 0; i < 500; i++) {
+    voxels.emplace_back((i * 7) % dimensions.x, (i * 13) % dimensions.y,
+                        (i * 5) % dimensions.z);
+  }
+  voxels.emplace_back(0, 0, 0);
+  voxels.emplace_back(dimensions.x - 1, dimensions.y - 1, dimensions.z - 1);
+  return voxels;
+}
+
+template <typename Out>
+auto gather(const std::vector<Out> &values, const Vec3<uint32_t> &dimensions,
+            const std::vector<Vec3<uint32_t>> &voxels) -> std::vector<Out> {
+  std::vector<Out> result;
+  for (auto &voxel : voxels) {
+    result.push_back(values[(static_cast<size_t>(voxel.z) * dimensions.y +
+                             voxel.y) *
+                                dimensions.x +
+                            voxel.x]);
+  }
+  return result;
+}
+
+const Region regions[] = {
+    {{0, 0, 0}, {37, 29, 23}}, {{5, 3, 2}, {20, 17, 11}},
+    {{0, 0, 20}, {37, 29, 23}}, {{36, 28, 0}, {37, 29, 1}},
+    {{9, 0, 4}, {17, 29, 12}}};
+
+} // namespace
+
+TEST(Region, GradientSimilarityMatchesFullPass) {
+  const auto dimensions = testDimensions();
+  const auto fields = testFields(dimensions);
+  const auto full = calculateGradientSimilarity(
+      pointers(fields), dimensions.x, dimensions.y, dimensions.z, 2);
+  for (auto &region : regions) {
+    const auto result =
+        calculateGradientSimilarity(pointers(fields), dimensions, region, 2);
+    EXPECT_EQ(result.offset.x, region.begin.x);
+    EXPECT_EQ(result.offset.z, region.begin.z);
+    EXPECT_EQ(result.dimensions.y, region.dimensions().y);
+    EXPECT_EQ(result.values, crop(full, dimensions, region));
+  }
+}
+
+TEST(Region, LocalCorrelationMatchesFullPass) {
+  const auto dimensions = testDimensions();
+  const auto fields = testFields(dimensions);
+  for (int windowSize : {1, 3}) {
+    SCOPED_TRACE(windowSize);
+    const auto full = calcLocalCorrelationCoefficientVoxelOuter(
+        pointers(fields), dimensions.x, dimensions.y, dimensions.z,
+        windowSize);
+    for (auto &region : regions) {
+      EXPECT_EQ(calcLocalCorrelationCoefficient(pointers(fields), dimensions,
+                                                region, windowSize)
+                    .values,
+                crop(full, dimensions, region));
+    }
+  }
+}
+
+TEST(Region, QuantizedRegionMatchesFullPass) {
+  const auto dimensions = testDimensions();
+  const auto fields = testFields(dimensions);
+  const auto full = calculateGradientSimilarityQuantized<uint8_t>(
+      pointers(fields), dimensions.x, dimensions.y, dimensions.z, 2);
+  const auto result =
+      calculateGradientSimilarity<const uint8_t, double, uint8_t>(
+          pointers(fields), dimensions, regions[1], 2);
+  EXPECT_EQ(result.values, crop(full.values, dimensions, regions[1]));
+}
+
+TEST(Region, MaskMatchesFullPass) {
+  const auto dimensions = testDimensions();
+  const auto fields = testFields(dimensions);
+  const auto voxels = scatteredVoxels(dimensions);
+
+  const auto gsm = calculateGradientSimilarity(
+      pointers(fields), dimensions.x, dimensions.y, dimensions.z, 2);
+  EXPECT_EQ(
+      calculateGradientSimilarity(pointers(fields), dimensions, voxels, 2)
+          .values,
+      gather(gsm, dimensions, voxels));
+
+  const auto lcc = calcLocalCorrelationCoefficientVoxelOuter(
+      pointers(fields), dimensions.x, dimensions.y, dimensions.z, 3);
+  EXPECT_EQ(
+      calcLocalCorrelationCoefficient(pointers(fields), dimensions, voxels, 3)
+          .values,
+      gather(lcc, dimensions, voxels));
+}
+
+TEST(Region, InvalidRegionThrows) {
+  const auto dimensions = testDimensions();
+  const auto fields = testFields(dimensions);
+  const Region empty{{4, 4, 4}, {4, 8, 8}};
+  const Region outside{{0, 0, 0}, {38, 29, 23}};
+  EXPECT_THROW(
+      calculateGradientSimilarity(pointers(fields), dimensions, empty, 2),
+      std::invalid_argument);
+  EXPECT_THROW(
+      calcLocalCorrelationCoefficient(pointers(fields), dimensions, outside, 3),
+      std::invalid_argument);
+}
@@ -0,0 +1,101 @@
+#include "Fields.hpp"
+#include "Info/MutualInformationCache.hpp"
+#include "VolCorrelation/ResultCache.hpp"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+using namespace VolCorrelation;
+using namespace VolCorrelation::test;
+
+namespace {
+
+// a cache in a fresh directory, removed afterwards
+class CacheTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    directory = std::filesystem::temp_directory_path() /
+                ("volcorrelation_test_" +
+                 std::string(::testing::UnitTest::GetInstance()
+                                 ->current_test_info()
+                                 ->name()));
+    std::filesystem::remove_all(directory);
+  }
+  void TearDown() override { std::filesystem::remove_all(directory); }
+
+  std::filesystem::path directory;
+};
+
+} // namespace
+
+TEST_F(CacheTest, StoresAndLoads) {
+  ResultCache cache(directory.string());
+  const auto key = CacheKey("values").add(42);
+  const std::vector<double> values{1.5, -2.0, 3.25};
+  ASSERT_TRUE(cache.store(key, values));
+  std::vector<double> loaded;
+  ASSERT_TRUE(cache.load(key, loaded));
+  EXPECT_EQ(loaded, values);
+  for (auto &entry : std::filesystem::directory_iterator(directory)) {
+    EXPECT_EQ(entry.path().extension(), ".bin");
+  }
+}
+
+// a header claiming more values than the file holds is a miss, not an
+// allocation of that many values
+TEST_F(CacheTest, CorruptCountIsAMiss) {
+  ResultCache cache(directory.string());
+  const auto key = CacheKey("values").add(7);
+  ASSERT_TRUE(cache.store(key, std::vector<uint32_t>{1, 2, 3}));
+  {
+    std::fstream file(cache.path(key),
+                      std::ios::binary | std::ios::in | std::ios::out);
+    const uint64_t count = uint64_t(1) << 62;
+    file.seekp(8);
+    file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+  }
+  std::vector<uint32_t> loaded{9};
+  EXPECT_FALSE(cache.load(key, loaded));
+  EXPECT_EQ(loaded, std::vector<uint32_t>{9});
+}
+
+TEST_F(CacheTest, TruncatedEntryIsAMiss) {
+  ResultCache cache(directory.string());
+  const auto key = CacheKey("values").add(8);
+  ASSERT_TRUE(cache.store(key, std::vector<uint32_t>{1, 2, 3}));
+  std::filesystem::resize_file(cache.path(key), 16 + 2 * sizeof(uint32_t));
+  std::vector<uint32_t> loaded;
+  EXPECT_FALSE(cache.load(key, loaded));
+}
+
+// adding a field to a cached set counts only its pairs with the others
+TEST_F(CacheTest, MutualInformationCountsOnlyNewPairs) {
+  ResultCache cache(directory.string());
+  const size_t size = 10000;
+  std::vector<std::vector<uint8_t>> fields;
+  for (uint32_t seed = 1; seed <= 5; seed++) {
+    fields.push_back(randomField<uint8_t>(size, seed));
+  }
+  auto all = pointers(fields);
+  const std::vector<const uint8_t *> first(all.begin(), all.end() - 1);
+  Info::CalculateMutualInformationMatrix(first, size, cache);
+
+  auto &tracer = Tracer::instance();
+  tracer.clear();
+  tracer.enable();
+  const auto cached = Info::CalculateMutualInformationMatrix(all, size, cache);
+  tracer.enable(false);
+  EXPECT_EQ(traceCounter("joint histogram voxels"),
+            static_cast<double>(size * first.size()));
+  tracer.clear();
+
+  const auto exact = Info::CalculateMutualInformationMatrix(all, size);
+  ASSERT_EQ(cached.mi.size(), exact.mi.size());
+  for (size_t i = 0; i < exact.mi.size(); i++) {
+    for (size_t j = 0; j < exact.mi.size(); j++) {
+      EXPECT_DOUBLE_EQ(cached.mi[i][j], exact.mi[i][j]);
+    }
+  }
+}
@@ -0,0 +1,75 @@
+#include "Fields.hpp"
+#include "Info/MutualInformationMatrix.hpp"
+#include "Info/SampledMutualInformation.hpp"
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace VolCorrelation;
+using namespace VolCorrelation::test;
+
+namespace {
+
+// values in [0, 100] with a few values that occur once, which RemoveNoise
+// folds into bucket 0
+auto noisyField(size_t size, uint32_t seed) -> std::vector<uint8_t> {
+  auto field = randomField<uint8_t>(size, seed, 0, 100);
+  for (size_t k = 0; k < 20; k++) {
+    field[k * 97 + seed] = static_cast<uint8_t>(150 + k);
+  }
+  return field;
+}
+
+// occupied bins of a histogram
+auto occupied(const Info::Counts &counts) -> double {
+  size_t bins = 0;
+  for (auto count : counts) {
+    bins += count != 0;
+  }
+  return static_cast<double>(bins);
+}
+
+} // namespace
+
+// with every voxel sampled once the plug-in part of the estimate is the
+// exact value, so what remains is the Miller-Madow correction
+TEST(SampledMutualInformation, AllVoxelsMatchExactWithNoiseRemoved) {
+  const size_t size = 20000;
+  std::vector<std::vector<uint8_t>> fields;
+  for (uint32_t seed = 1; seed <= 3; seed++) {
+    fields.push_back(noisyField(size, seed));
+  }
+  const auto exact = Info::CalculateMutualInformationMatrix(pointers(fields),
+                                                            size);
+  Info::SampledMutualInformationOptions options;
+  options.initialSamples = size;
+  options.timeBudget = 1e9;
+  const auto sampled = Info::CalculateApproximateMutualInformationMatrix(
+      pointers(fields), size, exact.histograms, options);
+  ASSERT_EQ(sampled.samples, size);
+
+  const auto n = static_cast<double>(size);
+  for (size_t i = 0; i < fields.size(); i++) {
+    const auto correction = (occupied(exact.histograms[i]) - 1) / (2 * n);
+    EXPECT_NEAR(sampled.mi[i][i] - correction, exact.mi[i][i], 1e-12);
+  }
+
+  // joint bins of values that are noise in neither field
+  const auto noiseA = Info::NoiseValues(exact.histograms[0]);
+  const auto noiseB = Info::NoiseValues(exact.histograms[1]);
+  Info::Counts joint(Info::JointBucketNum, 0);
+  Info::CountJointScalar(fields[0].data(), fields[1].data(), size,
+                         joint.data());
+  size_t touched = 0;
+  for (size_t key = 0; key < joint.size(); key++) {
+    touched += joint[key] != 0 && !noiseA[key >> 8] && !noiseB[key & 0xff];
+  }
+  const auto correction = (occupied(exact.histograms[0]) +
+                           occupied(exact.histograms[1]) - touched - 1) /
+                          (2 * n);
+  EXPECT_NEAR(sampled.mi[0][1] - correction, exact.mi[0][1], 1e-12);
+
+  // the overload without histograms counts the same ones
+  const auto counted = Info::CalculateApproximateMutualInformationMatrix(
+      pointers(fields), size, options);
+  EXPECT_EQ(counted.mi, sampled.mi);
+}
@@ -0,0 +1,166 @@
+#include "Fields.hpp"
+#include "Info/MutualInformation.hpp"
+#include "VolCorrelation/FieldRange.hpp"
+#include "VolCorrelation/SobelKernel.hpp"
+#include "VolCorrelation/WindowKernel.hpp"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+using namespace VolCorrelation;
+using namespace VolCorrelation::test;
+
+namespace {
+
+// sizes around the vector widths, so that every tail length is covered
+const size_t sizes[] = {1, 7, 31, 32, 33, 63, 64, 65, 1000, 4099};
+
+template <typename T> void expectRangeMatchesScalar(double low, double high) {
+  for (auto size : sizes) {
+    const auto field = randomField<T>(size, 11, low, high);
+    const auto scalar =
+        valueRangeScalar(field.data(), size, ValueRange<T>{field[0], field[0]});
+    for (auto isa : supportedIsas()) {
+      IsaScope scope(isa);
+      SCOPED_TRACE(isaName(isa));
+      const auto range = valueRange(field.data(), size);
+      EXPECT_EQ(range.min, scalar.min) << "size " << size;
+      EXPECT_EQ(range.max, scalar.max) << "size " << size;
+    }
+  }
+}
+
+// NaN voxels are skipped the same way by every kernel
+template <typename T> void expectRangeSkipsNaN() {
+  for (auto size : sizes) {
+    auto field = randomField<T>(size, 12, -50, 50);
+    for (size_t idx = 1; idx < size; idx += 3) {
+      field[idx] = std::numeric_limits<T>::quiet_NaN();
+    }
+    const auto scalar =
+        valueRangeScalar(field.data(), size, ValueRange<T>{field[0], field[0]});
+    ASSERT_FALSE(std::isnan(scalar.min) || std::isnan(scalar.max));
+    for (auto isa : supportedIsas()) {
+      IsaScope scope(isa);
+      SCOPED_TRACE(isaName(isa));
+      const auto range = valueRange(field.data(), size);
+      EXPECT_EQ(range.min, scalar.min) << "size " << size;
+      EXPECT_EQ(range.max, scalar.max) << "size " << size;
+    }
+  }
+}
+
+} // namespace
+
+TEST(Simd, ValueRangeUint8) { expectRangeMatchesScalar<uint8_t>(0, 255); }
+
+TEST(Simd, ValueRangeUint16) { expectRangeMatchesScalar<uint16_t>(0, 65535); }
+
+TEST(Simd, ValueRangeFloat) { expectRangeMatchesScalar<float>(-50, 50); }
+
+TEST(Simd, ValueRangeDouble) { expectRangeMatchesScalar<double>(-50, 50); }
+
+TEST(Simd, ValueRangeFloatNaN) { expectRangeSkipsNaN<float>(); }
+
+TEST(Simd, ValueRangeDoubleNaN) { expectRangeSkipsNaN<double>(); }
+
+TEST(Simd, ConvertDataMatchesScalar) {
+  const auto field = randomField<float>(4099, 5, -3, 1000);
+  const auto words = randomField<uint16_t>(4099, 6, 0, 65535);
+  std::vector<uint8_t> scalar, scalarWords;
+  {
+    IsaScope isa(Isa::Scalar);
+    scalar = Info::ConvertData(field);
+    scalarWords = Info::ConvertData(words);
+  }
+  for (auto isa : supportedIsas()) {
+    IsaScope scope(isa);
+    SCOPED_TRACE(isaName(isa));
+    EXPECT_EQ(Info::ConvertData(field), scalar);
+    EXPECT_EQ(Info::ConvertData(words), scalarWords);
+  }
+}
+
+TEST(Simd, JointHistogramMatchesScalar) {
+  for (auto size : sizes) {
+    const auto a = randomField<uint8_t>(size, 1);
+    const auto b = randomField<uint8_t>(size, 2);
+    Info::Counts scalar(Info::JointBucketNum, 0);
+    Info::CountJointScalar(a.data(), b.data(), size, scalar.data());
+    for (auto isa : supportedIsas()) {
+      IsaScope scope(isa);
+      SCOPED_TRACE(isaName(isa));
+      Info::Counts counts(Info::JointBucketNum, 0);
+      Info::FillJointHistogram<uint32_t>(a.data(), b.data(), size, counts);
+      EXPECT_EQ(counts, scalar) << "size " << size;
+      EXPECT_EQ(Info::CountValue(a.data(), size).size(),
+                Info::BucketNum + 1);
+    }
+  }
+}
+
+TEST(Simd, DotProductMatchesScalar) {
+  for (auto size : sizes) {
+    const auto a = randomField<double>(size, 3, -1, 1);
+    const auto b = randomField<double>(size, 4, -1, 1);
+    const auto scalar = dotProductScalar(a.data(), b.data(), size);
+    for (auto isa : supportedIsas()) {
+      IsaScope scope(isa);
+      SCOPED_TRACE(isaName(isa));
+      EXPECT_NEAR(dotProduct(a.data(), b.data(), size), scalar, 1e-12)
+          << "size " << size;
+    }
+  }
+}
+
+TEST(Simd, WindowMomentsMatchScalar) {
+  const auto dimensions = testDimensions();
+  const auto a = randomField<double>(volumeSize(dimensions), 3);
+  const auto b = randomField<double>(volumeSize(dimensions), 4);
+  const auto offsetZ = static_cast<size_t>(dimensions.x) * dimensions.y;
+  for (size_t n : {1, 3, 5, 7, 9, 17}) {
+    const WindowBox box{n, 3, 3, dimensions.x, offsetZ};
+    WindowMoments scalar;
+    accumulateWindowScalar(a.data(), b.data(), box, 100.0, 120.0, scalar);
+    for (auto isa : supportedIsas()) {
+      IsaScope scope(isa);
+      SCOPED_TRACE(isaName(isa));
+      WindowMoments moments;
+      accumulateWindow(a.data(), b.data(), box, 100.0, 120.0, moments);
+      EXPECT_NEAR(moments.sumX, scalar.sumX, 1e-9);
+      EXPECT_NEAR(moments.sumY, scalar.sumY, 1e-9);
+      EXPECT_NEAR(moments.sqsumX, scalar.sqsumX, 1e-6);
+      EXPECT_NEAR(moments.sqsumY, scalar.sqsumY, 1e-6);
+      EXPECT_NEAR(moments.sumXY, scalar.sumXY, 1e-6);
+    }
+  }
+}
+
+TEST(Simd, SobelRowsMatchScalar) {
+  const auto dimensions = testDimensions();
+  const auto field = randomField<double>(volumeSize(dimensions), 8, 0, 1);
+  const auto width = static_cast<size_t>(dimensions.x);
+  std::vector<double> sx(width), sy(width), sz(width);
+  std::vector<double> gx(width), gy(width), gz(width);
+  for (uint32_t z : {0u, 1u, dimensions.z / 2, dimensions.z - 1}) {
+    for (uint32_t y : {0u, 1u, dimensions.y / 2, dimensions.y - 1}) {
+      {
+        IsaScope isa(Isa::Scalar);
+        sobelGradientRow(field.data(), dimensions, y, z, sx.data(), sy.data(),
+                         sz.data());
+      }
+      for (auto isa : supportedIsas()) {
+        IsaScope scope(isa);
+        SCOPED_TRACE(isaName(isa));
+        sobelGradientRow(field.data(), dimensions, y, z, gx.data(), gy.data(),
+                         gz.data());
+        for (size_t x = 0; x < width; x++) {
+          ASSERT_NEAR(gx[x], sx[x], 1e-12) << x << " " << y << " " << z;
+          ASSERT_NEAR(gy[x], sy[x], 1e-12) << x << " " << y << " " << z;
+          ASSERT_NEAR(gz[x], sz[x], 1e-12) << x << " " << y << " " << z;
+        }
+      }
+    }
+  }
+}